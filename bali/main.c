@@ -42,6 +42,7 @@
 
 #include "sys/defs.h"
 #include "sys/msg.h"
+#include "sys/prof.h"
 #include "sys/clk.h"
 #include "sys/ser.h"
 #include "sys/tty.h"
@@ -99,6 +100,9 @@ PUBLIC int main(void)
 
     config_sysinit();
     config_msg();
+#if PROFILE
+    config_prof();
+#endif
     config_ser();
     config_twi();
     config_bc4();
@@ -117,7 +121,7 @@ PUBLIC int main(void)
         extract_msg(&msg);
         if (msg.receiver && msg.receiver < NR_TASKS &&
                   (fp = (MsgProc) pgm_read_word_near(proctab + msg.receiver)))
-            if ((fp) (&msg) == ENOMSG)
+            if (DISPATCH(fp, &msg) == ENOMSG)
                 lost_msgs++;
     } 
 }
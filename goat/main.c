@@ -40,6 +40,7 @@
 
 #include "sys/defs.h"
 #include "sys/msg.h"
+#include "sys/prof.h"
 #include "sys/clk.h"
 #include "sys/dmp.h"
 #include "sys/ser.h"
@@ -69,6 +70,9 @@ PUBLIC int main(void)
 
     config_sysinit();
     config_msg();
+#if PROFILE
+    config_prof();
+#endif
     config_ser();
 
     sei(); /* enable interrupts. */
@@ -78,7 +82,7 @@ PUBLIC int main(void)
         extract_msg(&msg);
         if (msg.receiver && msg.receiver < NR_TASKS &&
                   (fp = (MsgProc) pgm_read_word_near(proctab + msg.receiver)))
-            if ((fp) (&msg) == ENOMSG)
+            if (DISPATCH(fp, &msg) == ENOMSG)
                 lost_msgs++;
     } 
 }
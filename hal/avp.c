@@ -39,7 +39,12 @@
  *            [-r flash_readbackfilename] 
  *            [-s eeprom_readbackfilename] 
  *            [-c] chip erase
+ *            [-v] verify flash by CRC
  *            [file.hex]
+ *
+ * With -v, ICSP or HVPP reads back each run of flash that the hex file
+ * programmed and prints only its CRC-16, which avp compares with its own.
+ * Only the pages of a run that differs are read back in full.
  */
 
 #include <stdlib.h>
@@ -79,6 +84,7 @@
 
 #define LINE_MAX 50 /* output buffer */
 #define EEPROM_SEGMENT 0x0081
+#define PAGE_SIZE 128 /* SPM_PAGESIZE */
 
 static int lindex;
 static char *prog_cmd;
@@ -86,11 +92,14 @@ FILE *portin;
 FILE *portout;
 static char response[BUF_LEN];
 static char lbuf[LINE_MAX];
+static uchar_t flash[FLASHEND + 1];
+static uchar_t flash_used[FLASHEND + 1];
 
 static void usage(void);
 static int procfile(FILE *hexfile);
 static uchar_t get_nibble(uchar_t c);
 static uchar_t get_misc_write_data_value(char *s);
+static uchar_t get_byte(char *s);
 static void bputc(uchar_t c);
 static void put_nibble(uchar_t c);
 static void print_misc_read_record(uchar_t subfunction, uchar_t selection);
@@ -100,6 +109,10 @@ static void print_erase_record(uchar_t subfunction, uchar_t selection);
 static void print_read_data_record(ushort_t start, ushort_t end,
                                                          uchar_t subfunction);
 static void print_extended_linear_address_record(ushort_t ulba);
+static int verify_flash(void);
+static int crc_check(ushort_t start, ushort_t end, unsigned short *crcp);
+static int compare_flash(ushort_t start, ushort_t end);
+static unsigned short crc_xmodem_update(unsigned short crc, uchar_t c);
 
 int main(int argc, char **argv)
 {
@@ -115,6 +128,7 @@ int main(int argc, char **argv)
     uchar_t set_hfuses = FALSE;
     uchar_t set_efuses = FALSE;
     uchar_t chiperase = FALSE;
+    uchar_t verify = FALSE;
     ushort_t start, end;
     char cin;
     int ret;
@@ -125,7 +139,7 @@ int main(int argc, char **argv)
         exit(0);
     }
 
-    while ((opt = getopt(argc, argv, "p:k:l:h:e:r:s:c")) != -1) {
+    while ((opt = getopt(argc, argv, "p:k:l:h:e:r:s:cv")) != -1) {
         switch (opt) {
         case 'p':
             portname = optarg;
@@ -171,6 +185,10 @@ int main(int argc, char **argv)
             chiperase = TRUE;
             break;
 
+        case 'v':
+            verify = TRUE;
+            break;
+
         default: /* '?' */
             usage();
             exit(EXIT_FAILURE);
@@ -617,6 +635,8 @@ int main(int argc, char **argv)
         fclose(hexfile);
         if (ret != 0)
             exit(ret);
+        if (verify && verify_flash() != 0)
+            exit(1);
     }
 
     /* ----------------------------------------------------------------- *
@@ -790,6 +810,7 @@ static void usage(void)
     fprintf(stderr, "           [-r flash_readbackfilename]\n");
     fprintf(stderr, "           [-s eeprom_readbackfilename]\n");
     fprintf(stderr, "           [-c] chip erase\n");
+    fprintf(stderr, "           [-v] verify flash by CRC\n");
     fprintf(stderr, "           [file.hex]\n");
 }
 
@@ -804,15 +825,34 @@ static int procfile(FILE *hexfile)
     ushort_t start, end;
     char cin;
 
-    /* Read the entire hexfile, counting the lines.
-     * A more thorough sanity check could be performed.
+    ushort_t ulba = 0;
+
+    /* Read the entire hexfile, counting the lines and keeping the flash
+     * image for verify_flash(). A more thorough sanity check could be
+     * performed.
      */
     while ((fgets(line, sizeof(line), hexfile)) != NULL) {
         if (line[0] == ':' && line[7] == '0') {
             switch (line[8] - '0') {
             case IHEX_DATA_RECORD:
-            case IHEX_END_OF_FILE_RECORD:
+                if (ulba != EEPROM_SEGMENT) {
+                    uchar_t len = get_byte(line + 1);
+                    ushort_t addr = get_byte(line + 3) << 8 |
+                                    get_byte(line + 5);
+                    for (uchar_t i = 0; i < len && addr + i <= FLASHEND; i++) {
+                        flash[addr + i] = get_byte(line + 9 + 2 * i);
+                        flash_used[addr + i] = TRUE;
+                    }
+                }
+                nlines++;
+                break;
+
             case IHEX_EXTENDED_LINEAR_ADDRESS_RECORD:
+                ulba = get_byte(line + 9) << 8 | get_byte(line + 11);
+                nlines++;
+                break;
+
+            case IHEX_END_OF_FILE_RECORD:
                 nlines++;
                 break;
             default:
@@ -922,6 +962,123 @@ static int procfile(FILE *hexfile)
     return(ret);
 }
 
+/* Compare the CRC of each run of programmed flash with the image's.
+ * A run that differs is checked a page at a time, and only the pages
+ * that differ are read back.
+ */
+static int verify_flash(void)
+{
+    int ret = 0;
+
+    fprintf(stderr, "verify:");
+    for (long a = 0; a <= FLASHEND; a++) {
+        if (!flash_used[a])
+            continue;
+
+        ushort_t start = a;
+        while (a + 1 <= FLASHEND && flash_used[a + 1])
+            a++;
+        ushort_t end = a;
+
+        unsigned short crc = 0, target;
+        for (long i = start; i <= end; i++)
+            crc = crc_xmodem_update(crc, flash[i]);
+        if (crc_check(start, end, &target) != 0)
+            return(1);
+        if (crc == target)
+            continue;
+
+        fprintf(stderr, " 0x%04X-0x%04X differs", start, end);
+        for (long p = start; p <= end; p = (p | (PAGE_SIZE - 1)) + 1) {
+            ushort_t pend = MIN(p | (PAGE_SIZE - 1), end);
+            crc = 0;
+            for (long i = p; i <= pend; i++)
+                crc = crc_xmodem_update(crc, flash[i]);
+            if (crc_check(p, pend, &target) != 0)
+                return(1);
+            if (crc != target && compare_flash(p, pend) != 0)
+                return(1);
+        }
+        ret = 1;
+    }
+    fprintf(stderr, ret ? "\n" : " ok\n");
+    return(ret);
+}
+
+/* Ask for the CRC of flash from start to end inclusive. */
+static int crc_check(ushort_t start, ushort_t end, unsigned short *crcp)
+{
+    char cin;
+
+    fprintf(portout, "%s\n", prog_cmd);
+    if ((cin = fgetc(portin)) != '.') {
+        fprintf(stderr, "expected '.', got '%c'\n", cin);
+        return(1);
+    }
+
+    print_read_data_record(start, end, IHEX_CRC_CHECK);
+    fgets(response, sizeof(response), portin);
+    if (!isxdigit(response[0]) || !isxdigit(response[3])) {
+        fprintf(stderr, "expected a CRC, got '%s'\n", response);
+        return(1);
+    }
+    *crcp = get_byte(response) << 8 | get_byte(response + 2);
+
+    fgets(response, sizeof(response), portin);
+    if (strncmp(response, "$", strlen("$"))) {
+        fprintf(stderr, "expected '$', got '%s'\n", response);
+        return(1);
+    }
+    return(0);
+}
+
+/* Read back flash from start to end inclusive and report the first byte
+ * that differs from the image.
+ */
+static int compare_flash(ushort_t start, ushort_t end)
+{
+    char cin;
+    int reported = FALSE;
+
+    fprintf(portout, "%s\n", prog_cmd);
+    if ((cin = fgetc(portin)) != '.') {
+        fprintf(stderr, "expected '.', got '%c'\n", cin);
+        return(1);
+    }
+
+    print_read_data_record(start, end, IHEX_DISPLAY_DATA);
+    while (fgets(response, sizeof(response), portin)) {
+        if (response[0] != ':')
+            break;
+        if (get_byte(response + 7) != IHEX_DATA_RECORD)
+            continue;
+
+        uchar_t len = get_byte(response + 1);
+        ushort_t addr = get_byte(response + 3) << 8 | get_byte(response + 5);
+        for (uchar_t i = 0; i < len && !reported; i++) {
+            uchar_t val = get_byte(response + 9 + 2 * i);
+            if (addr + i <= end && val != flash[addr + i]) {
+                fprintf(stderr, "\n  0x%04X: 0x%02X, expected 0x%02X",
+                                      addr + i, val, flash[addr + i]);
+                reported = TRUE;
+            }
+        }
+    }
+    if (strncmp(response, "$", strlen("$"))) {
+        fprintf(stderr, "expected '$', got '%s'\n", response);
+        return(1);
+    }
+    return(0);
+}
+
+static unsigned short crc_xmodem_update(unsigned short crc, uchar_t c)
+{
+    crc ^= (unsigned short)c << 8;
+    for (int i = 0; i < 8; i++)
+        crc = crc & 0x8000 ? crc << 1 ^ 0x1021 : crc << 1;
+    return(crc);
+}
+
 static uchar_t get_nibble(uchar_t c) {
     return(c > '9' ? c - 'A' + 10 : c - '0');
 }
@@ -931,6 +1088,11 @@ static uchar_t get_misc_write_data_value(char *s)
     return (get_nibble(toupper(s[13])) << 4 | get_nibble(toupper(s[14])));
 }
 
+static uchar_t get_byte(char *s)
+{
+    return (get_nibble(toupper(s[0])) << 4 | get_nibble(toupper(s[1])));
+}
+
 
 static void bputc(uchar_t c)
 {
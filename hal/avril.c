@@ -32,13 +32,23 @@
 /* AVR internal loader that communicates with ISP on bali.
  * The ISP can write to the flash and the eeprom.
  *
- * usage: avril hostname [hostname ...]
+ * The hex file is sent as binary page frames (see isp/ihex.h), as many
+ * at a time as ISP has credited with a '.', unless -x is given, when it
+ * is sent a line at a time as Intel hex. With -d, only the flash pages
+ * whose CRC differs from the target's are sent. With -f, the hostnames
+ * are programmed together with the first one's hex file, each page going
+ * to every target before the next is sent.
+ *
+ * usage: avril [-x] [-d] [-f] hostname [hostname ...]
  */
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <termios.h>
+#include <ctype.h>
+#include <time.h>
 
 #include "sys/defs.h"
 #include "isp/ihex.h"
@@ -46,7 +56,28 @@
 #define BUF_LEN 80
 #define PATH_MAX 32
 
-static int procfile(char *hostname);
+#define FLASH_LEN  0x10000
+#define EEPROM_LEN 0x1000
+#define MAX_PAGESIZE 255 /* the frame length is one byte */
+#define MAX_TARGETS 8   /* ISP_TARGETS */
+
+static int procfile(char **hosts, int nhosts);
+static int load_image(FILE *hexfile);
+static int send_frames(char **hosts, int nhosts, int pagesize, int flash_end);
+static int drop_unchanged(int nhosts, int pagesize, int flash_end,
+                                                      int *credits);
+static void send_frame(int type, int addr, unsigned char *data, int len);
+static unsigned short crc_xmodem_update(unsigned short crc, unsigned char c);
+static int hexbyte(char *s);
+
+static int hexmode;
+static int deltamode;
+static int fanout;
+static int ndown;       /* hosts whose bootloader did not answer */
+static unsigned char flash[FLASH_LEN];
+static unsigned char flash_used[FLASH_LEN];
+static unsigned char eeprom[EEPROM_LEN];
+static unsigned char eeprom_used[EEPROM_LEN];
 
 FILE *portin;
 FILE *portout;
@@ -64,6 +95,27 @@ int main(int argc, char **argv)
         exit(1);
     }
 
+    /* the options apply to every host, wherever they are given */
+    char **hosts = argv + 1;
+    int nhosts = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-x") == 0) {
+            hexmode = 1;
+        } else if (strcmp(argv[i], "-d") == 0) {
+            deltamode = 1;
+        } else if (strcmp(argv[i], "-f") == 0) {
+            fanout = 1;
+        } else {
+            hosts[nhosts++] = argv[i];
+        }
+    }
+    if (fanout && nhosts > MAX_TARGETS) {
+        printf("at most %d hosts can be programmed together\n",
+                                                      MAX_TARGETS);
+        exit(1);
+    }
+
     portout = fopen(portname, "w");
     portin = fopen(portname, "r");
 
@@ -90,8 +142,11 @@ int main(int argc, char **argv)
         exit(1);
     }
 
-    for (int i = 1; i < argc; i++) {
-        procfile(argv[i]);
+    if (fanout && nhosts) {
+        procfile(hosts, nhosts);
+    } else {
+        for (int i = 0; i < nhosts; i++)
+            procfile(hosts + i, 1);
     }
 
     fclose(portin);
@@ -99,8 +154,10 @@ int main(int argc, char **argv)
     exit(0);
 }
 
-static int procfile(char *hostname)
+static int procfile(char **hosts, int nhosts)
 {
+    char *hostname = hosts[0];
+    char chipinfo[BUF_LEN];
     char *hexfilename;
     FILE *hexfile;
     char line[BUF_LEN];
@@ -160,50 +217,99 @@ static int procfile(char *hostname)
     fclose(hexfile);
     hexfile = fopen(hexfilename, "r");
 
-    fprintf(portout, "blswitch %s\n", hostname);
-    fgets(response, sizeof(response), portin);
-    if (strncmp(response, "closed", strlen("closed"))) {
-        if (strncmp(response, "open", strlen("open")) == 0) {
-            fprintf(stderr, "%s blswitch: the switch is open: ", hostname);
-            fprintf(stderr, "it needs to be closed.\n");
-        } else {
-            int n = strlen(response);
-            if (n > 0 && response[n - 1] == '\n')
-                response[n-1] = '\0';
-            fprintf(stderr, "%s blswitch: expected 'closed', got '%s'\n",
-                                       hostname, response);
+    for (int h = 0; h < nhosts; h++) {
+        hostname = hosts[h];
+        fprintf(portout, "blswitch %s\n", hostname);
+        fgets(response, sizeof(response), portin);
+        if (strncmp(response, "closed", strlen("closed"))) {
+            if (strncmp(response, "open", strlen("open")) == 0) {
+                fprintf(stderr, "%s blswitch: the switch is open: ", hostname);
+                fprintf(stderr, "it needs to be closed.\n");
+            } else {
+                int n = strlen(response);
+                if (n > 0 && response[n - 1] == '\n')
+                    response[n-1] = '\0';
+                fprintf(stderr, "%s blswitch: expected 'closed', got '%s'\n",
+                                           hostname, response);
+            }
+            fclose(hexfile);
+            free(hexfilename);
+            return(1);
         }
-        fclose(hexfile);
-        free(hexfilename);
-        return(1);
-    }
 
-    fprintf(portout, "reboot %s\n", hostname);
-    fgets(response, sizeof(response), portin);
-    if (strncmp(response, "rebooting", strlen("rebooting"))) {
-        fprintf(stderr, "expected 'rebooting', got '%s'\n", response);
-        fclose(hexfile);
-        free(hexfilename);
-        return(1);
+        fprintf(portout, "reboot %s\n", hostname);
+        fgets(response, sizeof(response), portin);
+        if (strncmp(response, "rebooting", strlen("rebooting"))) {
+            fprintf(stderr, "expected 'rebooting', got '%s'\n", response);
+            fclose(hexfile);
+            free(hexfilename);
+            return(1);
+        }
     }
 
-    fprintf(portout, "isp %s\n", hostname);
-    /* read bootloader version */
-    fgets(response, sizeof(response), portin);
-    if (strncmp(response, "TWIBOOT", strlen("TWIBOOT"))) {
-        fprintf(stderr, "expected 'TWIBOOT', got '%s'\n", response);
+    fputs("isp", portout);
+    for (int h = 0; h < nhosts; h++)
+        fprintf(portout, " %s", hosts[h]);
+    fputc('\n', portout);
+
+    /* a bootloader version and chip info for each target, or a '?' for
+     * one that did not answer, which ISP leaves out
+     */
+    ndown = 0;
+    for (int h = 0, ref = -1; h < nhosts; h++) {
+        fgets(response, sizeof(response), portin);
+        if (strncmp(response, "TWIBOOT", strlen("TWIBOOT"))) {
+            if (response[0] == '?')
+                fprintf(stderr, "%s: no bootloader answered\n", hosts[h]);
+            else
+                fprintf(stderr, "%s: expected 'TWIBOOT', got '%s'\n",
+                                                       hosts[h], response);
+            fgets(response, sizeof(response), portin);
+            ndown++;
+            continue;
+        }
+        fgets(response, sizeof(response), portin);
+        if (ref < 0) {
+            strcpy(chipinfo, response);
+            ref = h;
+        } else if (strcmp(response, chipinfo)) {
+            fprintf(stderr, "%s: chip info '%s' differs from %s's\n",
+                                           hosts[h], response, hosts[ref]);
+            fclose(hexfile);
+            free(hexfilename);
+            return(1);
+        }
+    }
+    if (ndown == nhosts) {
+        /* ISP gives up with an 'N' and a '$' */
+        while ((cin = fgetc(portin)) != EOF && cin != '$')
+            ;
         fclose(hexfile);
         free(hexfilename);
         return(1);
     }
-    /* read chip info */
-    fgets(response, sizeof(response), portin);
 
     if ((cin = fgetc(portin)) != '.') {
         fprintf(stderr, "expected '.', got '%c'\n", cin);
         exit(1);
     }
 
+    if (!hexmode) {
+        /* chipinfo: signature[3], pagesize, bootloader start[2], .. */
+        int pagesize = hexbyte(chipinfo + 6);
+        int flash_end = hexbyte(chipinfo + 8) << 8 | hexbyte(chipinfo + 10);
+
+        if (pagesize <= 0 || pagesize > MAX_PAGESIZE || flash_end <= 0) {
+            fprintf(stderr, "bad chip info '%s'\n", chipinfo);
+            ret = 1;
+        } else if ((ret = load_image(hexfile)) == 0) {
+            ret = send_frames(hosts, nhosts, pagesize, flash_end);
+        }
+        fclose(hexfile);
+        free(hexfilename);
+        return(ret);
+    }
+
     while (fgets(line, sizeof(line), hexfile) != NULL) {
         progress++;
         fputs(line, portout);
@@ -230,4 +336,328 @@ static int procfile(char *hostname)
     return(ret);
 }
 
+/* Read the hex file into the flash and eeprom images. */
+static int load_image(FILE *hexfile)
+{
+    char line[BUF_LEN];
+    int in_eeprom = 0;
+
+    memset(flash, 0xFF, sizeof(flash));
+    memset(flash_used, 0, sizeof(flash_used));
+    memset(eeprom_used, 0, sizeof(eeprom_used));
+
+    while (fgets(line, sizeof(line), hexfile) != NULL) {
+        int len = hexbyte(line + 1);
+        int addr = hexbyte(line + 3) << 8 | hexbyte(line + 5);
+        int type = hexbyte(line + 7);
+
+        if (len < 0 || addr < 0 || type < 0) {
+            fprintf(stderr, "bad hex record: %s", line);
+            return(1);
+        }
+
+        /* the bytes of a record, with its checksum, sum to zero */
+        int sum = len + (addr >> 8) + (addr & 0xFF) + type;
+        for (int i = 0; i <= len; i++) {
+            int b = hexbyte(line + 9 + 2 * i);
+            if (b < 0) {
+                fprintf(stderr, "bad hex record: %s", line);
+                return(1);
+            }
+            sum += b;
+        }
+        if (sum & 0xFF) {
+            fprintf(stderr, "bad hex checksum: %s", line);
+            return(1);
+        }
+
+        switch (type) {
+        case IHEX_DATA_RECORD:
+            for (int i = 0; i < len; i++) {
+                int b = hexbyte(line + 9 + 2 * i);
+                if (in_eeprom) {
+                    eeprom[(addr + i) % EEPROM_LEN] = b;
+                    eeprom_used[(addr + i) % EEPROM_LEN] = 1;
+                } else {
+                    flash[(addr + i) % FLASH_LEN] = b;
+                    flash_used[(addr + i) % FLASH_LEN] = 1;
+                }
+            }
+            break;
+
+        case IHEX_EXTENDED_LINEAR_ADDRESS_RECORD:
+            /* 0x0081 equates to eeprom segment */
+            in_eeprom = (hexbyte(line + 9) == 0x00 &&
+                         hexbyte(line + 11) == 0x81);
+            break;
+
+        default:
+            break;
+        }
+    }
+    return(0);
+}
+
+/* Send every page of flash that holds data, then runs of eeprom bytes,
+ * then the end frame, keeping as many frames in flight as ISP credits.
+ */
+static int send_frames(char **hosts, int nhosts, int pagesize, int flash_end)
+{
+    struct termios saved, raw;
+    int nframes = 0;
+    int sent = 0;
+    int acked = 0;
+    int percent;
+    int prevpercent = -1;
+    int credits = 1;    /* the '.' already read */
+    int cin;
+    int ret = 0;
+    int addr = 0;
+    int eaddr = 0;
+    long nbytes = 0;
+    struct timespec t0, t1;
+
+    /* frames are binary: no translation of NL or CR either way */
+    fflush(portout);
+    tcgetattr(fileno(portout), &saved);
+    raw = saved;
+    cfmakeraw(&raw);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    tcsetattr(fileno(portout), TCSADRAIN, &raw);
+
+    if (deltamode && drop_unchanged(nhosts, pagesize, flash_end, &credits)) {
+        tcsetattr(fileno(portout), TCSADRAIN, &saved);
+        return(1);
+    }
+
+    for (int a = 0; a < FLASH_LEN; a += pagesize) {
+        for (int i = 0; i < pagesize; i++) {
+            if (flash_used[a + i]) {
+                if (a + pagesize > flash_end) {
+                    fprintf(stderr, "data at 0x%04x overwrites the bootloader\n",
+                                                                   a + i);
+                    return(1);
+                }
+                nframes++;
+                break;
+            }
+        }
+    }
+    for (int a = 0; a < EEPROM_LEN; ) {
+        if (eeprom_used[a]) {
+            int n = 0;
+            while (a + n < EEPROM_LEN && eeprom_used[a + n] && n < pagesize)
+                n++;
+            nframes++;
+            a += n;
+        } else {
+            a++;
+        }
+    }
+    nframes++;  /* the end frame */
+
+    printf("%d frames of up to %d bytes\n", nframes, pagesize);
+
+    while (sent < nframes) {
+        while (credits > 0 && sent < nframes) {
+            while (addr < FLASH_LEN) {
+                int i;
+                for (i = 0; i < pagesize && !flash_used[addr + i]; i++)
+                    ;
+                if (i < pagesize)
+                    break;
+                addr += pagesize;
+            }
+            while (eaddr < EEPROM_LEN && !eeprom_used[eaddr])
+                eaddr++;
+            if (addr < FLASH_LEN) {
+                send_frame(FRAME_FLASH, addr, flash + addr, pagesize);
+                nbytes += pagesize;
+                addr += pagesize;
+            } else if (eaddr < EEPROM_LEN) {
+                int n = 0;
+                while (eaddr + n < EEPROM_LEN && eeprom_used[eaddr + n] &&
+                                                            n < pagesize)
+                    n++;
+                send_frame(FRAME_EEPROM, eaddr, eeprom + eaddr, n);
+                nbytes += n;
+                eaddr += n;
+            } else {
+                send_frame(FRAME_END, 0, NULL, 0);
+            }
+            sent++;
+            credits--;
+        }
+        fflush(portout);
+
+        if (sent == nframes)
+            break;
+        if ((cin = fgetc(portin)) != '.') {
+            ret = 1;
+            break;
+        }
+        credits++;
+        acked++;
+        percent = (int)((long)acked * 100L / nframes);
+        if (prevpercent != percent) {
+            prevpercent = percent;
+            fprintf(stdout, "\r%3d%% ", percent);
+            fflush(stdout);
+        }
+    }
+
+    if (ret == 0) {
+        /* credits for the last frames, a '+' or an 'R' for each target,
+         * then a dollar sign for success
+         */
+        while ((cin = fgetc(portin)) == '.')
+            ;
+        for (int h = 0; h < nhosts && ret == 0; h++) {
+            if (cin == 'R') {
+                fprintf(stderr, "\n%s: readback failed", hosts[h]);
+            } else if (cin == 'N') {
+                fprintf(stderr, "\n%s: not answering", hosts[h]);
+            } else if (cin != '+') {
+                ret = 1;
+                break;
+            }
+            cin = fgetc(portin);
+        }
+        if (ret == 0 && cin == '$')
+            fprintf(stdout, "\r%3d%% ", 100);
+        else
+            ret = 1;
+    }
+    if (ret == 0) {
+        /* for comparing the throughput of twiboot and ISP versions */
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        fprintf(stdout, "%ld bytes in %.1fs", nbytes, (t1.tv_sec - t0.tv_sec)
+                                     + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+    }
+    fputc('\n', stdout);
+
+    tcsetattr(fileno(portout), TCSADRAIN, &saved);
+
+    fgets(response, sizeof(response), portin);
+    if (ret)
+        fprintf(stderr, "avril: error: %c%s", cin, response);
+    return(ret);
+}
+
+/* Ask ISP for each target's CRC of each flash page below the bootloader,
+ * and forget the image's pages that already match on every target. Any
+ * '.' credits that ISP sends meanwhile are counted.
+ */
+static int drop_unchanged(int nhosts, int pagesize, int flash_end,
+                                                      int *credits)
+{
+    int npages = flash_end / pagesize;
+    int ndropped = 0;
+    unsigned char count;
+    unsigned char matches[256];
+    unsigned short crc;
+    int cin;
+
+    if (npages > 255)
+        npages = 255;   /* the rest are sent in any case */
+    count = npages;
+    send_frame(FRAME_QUERY, 0, &count, 1);
+    fflush(portout);
+    (*credits)--;
+
+    memset(matches, 0, sizeof(matches));
+    for (int page = 0; page < npages * nhosts; page++) {
+        unsigned short target = 0;
+        int ndigits = 0;
+        int none = 0;
+
+        while (ndigits < 4) {
+            if ((cin = fgetc(portin)) == '.') {
+                (*credits)++;
+            } else if (cin == '-') {
+                /* a target without page CRCs, or one left out */
+                none = 1;
+                ndigits++;
+            } else if (isxdigit(cin)) {
+                target = target << 4 |
+                          (isdigit(cin) ? cin - '0' : toupper(cin) - 'A' + 10);
+                ndigits++;
+            } else if (cin != '\n' && cin != '\r') {
+                fprintf(stderr, "avril: error: %c in the page CRCs\n", cin);
+                return(1);
+            }
+        }
+
+        /* the targets' tables come one after another */
+        int a = page % npages * pagesize;
+        crc = 0;
+        for (int i = 0; i < pagesize; i++)
+            crc = crc_xmodem_update(crc, flash[a + i]);
+        if (!none && crc == target)
+            matches[page % npages]++;
+    }
+
+    for (int page = 0; page < npages; page++) {
+        int a = page * pagesize;
+        int used = 0;
+        for (int i = 0; i < pagesize; i++)
+            used |= flash_used[a + i];
+        if (used && matches[page] == nhosts - ndown) {
+            memset(flash_used + a, 0, pagesize);
+            ndropped++;
+        }
+    }
+    printf("%d unchanged pages\n", ndropped);
+    return(0);
+}
+
+static void send_frame(int type, int addr, unsigned char *data, int len)
+{
+    unsigned char head[FRAME_HEADER_LEN];
+    unsigned short crc = 0;
+
+    head[0] = type;
+    head[1] = addr >> 8 & 0xFF;
+    head[2] = addr & 0xFF;
+    head[3] = len;
+    for (int i = 0; i < FRAME_HEADER_LEN; i++)
+        crc = crc_xmodem_update(crc, head[i]);
+    for (int i = 0; i < len; i++)
+        crc = crc_xmodem_update(crc, data[i]);
+
+    fputc(FRAME_STX, portout);
+    fwrite(head, 1, sizeof(head), portout);
+    if (len)
+        fwrite(data, 1, len, portout);
+    fputc(crc >> 8 & 0xFF, portout);
+    fputc(crc & 0xFF, portout);
+}
+
+/* as _crc_xmodem_update() in avr-libc's util/crc16.h */
+static unsigned short crc_xmodem_update(unsigned short crc, unsigned char c)
+{
+    crc ^= (unsigned short)c << 8;
+    for (int i = 0; i < 8; i++)
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    return crc;
+}
+
+static int hexbyte(char *s)
+{
+    int v = 0;
+
+    for (int i = 0; i < 2; i++) {
+        char c = s[i];
+        if (c >= '0' && c <= '9')
+            v = v << 4 | (c - '0');
+        else if (c >= 'A' && c <= 'F')
+            v = v << 4 | (c - 'A' + 10);
+        else if (c >= 'a' && c <= 'f')
+            v = v << 4 | (c - 'a' + 10);
+        else
+            return(-1);
+    }
+    return(v);
+}
+
 /* end code */
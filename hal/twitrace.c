@@ -0,0 +1,250 @@
+/* hal/twitrace.c */
+
+/* Copyright (c) 2024 Peter Welch
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+   * Neither the name of the copyright holders nor the names of
+     contributors may be used to endorse or promote products derived
+     from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* decode the TWI transaction trace ring of lib/net/twi.c
+ *
+ * usage: twitrace [-r] < dump.txt
+ *
+ * The input is the output of 'dump <host> <twi_trace> +<size>', where the
+ * address of twi_trace is found in the host's .dsm file.
+ * -r prints the ring in the order it is stored, rather than oldest first.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#define TRACE_MAGIC 'T'
+#define HEADER_SIZE 8   /* magic, size, next, wrapped, rate */
+#define EVENT_SIZE  11  /* sizeof(twi_event) on the AVR */
+#define MAX_BYTES   4096
+#define LINE_MAX    256
+
+typedef struct {
+    uint32_t start;             /* the AVR's ticks, which wrap */
+    unsigned short duration;
+    unsigned char first;
+    unsigned char last;
+    unsigned char addr;
+    unsigned char cmd;
+    unsigned char count;
+} event_t;
+
+typedef struct {
+    unsigned char status;
+    const char *name;
+} status_name;
+
+/* the TW_STATUS values of util/twi.h */
+static const status_name names[] = {
+    { 0x08, "START" },
+    { 0x10, "REP_START" },
+    { 0x18, "MT_SLA_ACK" },
+    { 0x20, "MT_SLA_NACK" },
+    { 0x28, "MT_DATA_ACK" },
+    { 0x30, "MT_DATA_NACK" },
+    { 0x38, "ARB_LOST" },
+    { 0x40, "MR_SLA_ACK" },
+    { 0x48, "MR_SLA_NACK" },
+    { 0x50, "MR_DATA_ACK" },
+    { 0x58, "MR_DATA_NACK" },
+    { 0x60, "SR_SLA_ACK" },
+    { 0x68, "SR_ARB_LOST_SLA_ACK" },
+    { 0x70, "SR_GCALL_ACK" },
+    { 0x78, "SR_ARB_LOST_GCALL_ACK" },
+    { 0x80, "SR_DATA_ACK" },
+    { 0x88, "SR_DATA_NACK" },
+    { 0x90, "SR_GCALL_DATA_ACK" },
+    { 0x98, "SR_GCALL_DATA_NACK" },
+    { 0xA0, "SR_STOP" },
+    { 0xA8, "ST_SLA_ACK" },
+    { 0xB0, "ST_ARB_LOST_SLA_ACK" },
+    { 0xB8, "ST_DATA_ACK" },
+    { 0xC0, "ST_DATA_NACK" },
+    { 0xC8, "ST_LAST_DATA" },
+    { 0xF8, "NO_INFO" },
+    { 0x00, "BUS_ERROR" }
+};
+
+unsigned char image[MAX_BYTES];
+
+const char *status_of(unsigned char status)
+{
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (names[i].status == status)
+            return names[i].name;
+    }
+    return "?";
+}
+
+/* Read the dump lines, "ADDR XX:XX:XX:XX XX:..", into image.
+ * Lines that do not start with a four digit address are ignored.
+ */
+size_t read_dump(FILE *fp)
+{
+    char line[LINE_MAX];
+    size_t len = 0;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char *p = line;
+        int digits = 0;
+
+        while (isxdigit((unsigned char)p[digits]))
+            digits++;
+        if (digits != 4 || p[digits] != ' ')
+            continue;
+        p += digits;
+
+        unsigned int byte;
+        int n;
+        while ((*p == ' ' || *p == ':') &&
+                sscanf(p + 1, "%2x%n", &byte, &n) == 1 && n == 2) {
+            if (len < MAX_BYTES)
+                image[len++] = byte;
+            p += 1 + n;
+        }
+    }
+    return len;
+}
+
+uint32_t get_long(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) |
+           ((uint32_t)p[3] << 24);
+}
+
+void get_event(const unsigned char *p, event_t *ep)
+{
+    ep->start = get_long(p);
+    ep->duration = p[4] | (p[5] << 8);
+    ep->first = p[6];
+    ep->last = p[7];
+    ep->addr = p[8];
+    ep->cmd = p[9];
+    ep->count = p[10];
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+    int stored_order = 0;
+
+    while ((c = getopt(argc, argv, "r")) != -1) {
+        switch (c) {
+        case 'r':
+            stored_order = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: twitrace [-r] < dump.txt\n");
+            exit(1);
+        }
+    }
+
+    size_t len = read_dump(stdin);
+
+    if (len < HEADER_SIZE || image[0] != TRACE_MAGIC) {
+        fprintf(stderr, "not a twi_trace dump\n");
+        exit(1);
+    }
+
+    unsigned int size = image[1];
+    unsigned int next = image[2];
+    unsigned int wrapped = image[3];
+    uint32_t rate = get_long(image + 4);
+
+    if (rate == 0 || next >= size || len < HEADER_SIZE + size * EVENT_SIZE) {
+        fprintf(stderr, "short or corrupt dump: %zu of %u bytes\n",
+                len, HEADER_SIZE + size * EVENT_SIZE);
+        exit(1);
+    }
+
+    unsigned int count = wrapped ? size : next;
+    unsigned int first = (wrapped && !stored_order) ? next : 0;
+    double tick_us = 1000000.0 / rate;
+    uint32_t origin = 0;
+    uint32_t end = 0;
+    unsigned long busy[2] = { 0, 0 };
+    unsigned long bytes[2] = { 0, 0 };
+
+    /* Times are taken relative to the oldest entry, modulo 2^32, so that
+     * a trace across the wrap of the tick counter still reads forwards.
+     */
+    if (count) {
+        event_t ev;
+        get_event(image + HEADER_SIZE + (wrapped ? next : 0) * EVENT_SIZE,
+                  &ev);
+        origin = ev.start;
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        event_t ev;
+        get_event(image + HEADER_SIZE + i * EVENT_SIZE, &ev);
+        if ((uint32_t)(ev.start - origin) + ev.duration > end)
+            end = (uint32_t)(ev.start - origin) + ev.duration;
+    }
+
+    printf("%10s %8s %4s %4s %4s %5s  %s\n",
+           "ms", "us", "role", "addr", "cmd", "bytes", "first .. last");
+
+    for (unsigned int i = 0; i < count; i++) {
+        event_t ev;
+        get_event(image + HEADER_SIZE + ((first + i) % size) * EVENT_SIZE,
+                  &ev);
+
+        int slave = (ev.first != 0x08);
+        busy[slave] += ev.duration;
+        bytes[slave] += ev.count;
+
+        printf("%10.3f %8.0f %4s %4u %4u %5u  %s .. %s\n",
+               (uint32_t)(ev.start - origin) * tick_us / 1000.0,
+               ev.duration * tick_us,
+               slave ? "S" : "M",
+               ev.addr, ev.cmd, ev.count,
+               status_of(ev.first), status_of(ev.last));
+    }
+
+    if (count) {
+        double span_us = end * tick_us;
+        double busy_us = (busy[0] + busy[1]) * tick_us;
+
+        printf("\n%u transactions over %.3f ms\n", count, span_us / 1000.0);
+        printf("busy %.3f ms, %.1f%% utilisation\n",
+               busy_us / 1000.0, span_us ? 100.0 * busy_us / span_us : 0.0);
+        printf("master %.3f ms %lu bytes, slave %.3f ms %lu bytes\n",
+               busy[0] * tick_us / 1000.0, bytes[0],
+               busy[1] * tick_us / 1000.0, bytes[1]);
+    }
+    exit(0);
+}
+
+/* end code */
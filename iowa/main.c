@@ -41,6 +41,7 @@
 
 #include "sys/defs.h"
 #include "sys/msg.h"
+#include "sys/prof.h"
 #include "sys/clk.h"
 #include "sys/ser.h"
 #include "sys/tty.h"
@@ -100,6 +101,9 @@ int main (void)
 
     config_sysinit();
     config_msg();
+#if PROFILE
+    config_prof();
+#endif
     config_ser();
     config_bc4();
     config_twi();
@@ -118,7 +122,7 @@ int main (void)
         extract_msg(&msg);
         if (msg.receiver && msg.receiver < NR_TASKS &&
                   (fp = (MsgProc) pgm_read_word_near(proctab + msg.receiver)))
-            if ((fp) (&msg) == ENOMSG)
+            if (DISPATCH(fp, &msg) == ENOMSG)
                 lost_msgs++;
     } 
 }
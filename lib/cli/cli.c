@@ -85,6 +85,10 @@ typedef enum {
     REBOOTING_TARGET,
     MAKING_FILESYS,
     READING_SECTOR,
+    FETCHING_CACHE,
+    FETCHING_SPEED,
+    FETCHING_FRAG,
+    FETCHING_LATENCY,
     SENDING_ISTREAM,
     SENDING_BAR_MESSAGE,
     SENDING_HC05_COMMAND,
@@ -94,8 +98,15 @@ typedef enum {
     READING_MDAC,
     SENDING_PRINT_COMMAND,
     FETCHING_CYCLES,
+    FETCHING_OVERFLOW,
+    FETCHING_PROFILE,
     FETCHING_LASTRESET,
     SHOWING_ELAPSED,
+    FETCHING_WAKEUPS,
+    SHOWING_WAKE_RATE,
+    FETCHING_THROUGHPUT,
+    FETCHING_RETRIES,
+    SHOWING_THROUGHPUT,
     PUTTING_FILE,
     LISTING_ITEMS,
     CHANGING_DIR,
@@ -143,6 +154,7 @@ typedef struct {
     uchar_t pindex;         /* iterative loop hex record start point */
     uchar_t *src;
     char opt;
+    ulong_t twi_mark;       /* unix time of the last 'twi -c' */
     uchar_t *epp;
     inode_t myno;
     inum_t cwd;
@@ -178,6 +190,8 @@ PRIVATE void exit_func(char *bp);
 PRIVATE void ping_func(char *bp);
 PRIVATE void blswitch_func(char *bp);
 PRIVATE void cycles_func(char *bp);
+PRIVATE void lost_func(char *bp);
+PRIVATE void prof_func(char *bp);
 PRIVATE void uptime_func(char *bp);
 PRIVATE void curtime_func(char *bp);
 PRIVATE void dump_func(char *bp);
@@ -187,10 +201,17 @@ PRIVATE void reboot_func(char *bp);
 PRIVATE void hc05_func(char *bp);
 PRIVATE void mkfs_func(char *bp);
 PRIVATE void sector_func(char *bp);
+PRIVATE void cache_func(char *bp);
+PRIVATE void sdspeed_func(char *bp);
+PRIVATE void frag_func(char *bp);
+PRIVATE void fsdlat_func(char *bp);
 PRIVATE void inp_func(char *bp);
 PRIVATE void cat_func(char *bp);
 PRIVATE void print_func(char *bp);
 PRIVATE void last_func(char *bp);
+PRIVATE void wake_func(char *bp);
+PRIVATE void twi_func(char *bp);
+PRIVATE void retry_func(char *bp);
 PRIVATE void put_func(char *bp);
 PRIVATE void ls_func(char *bp);
 PRIVATE void cd_func(char *bp);
@@ -206,6 +227,8 @@ ProgmemStringFuncRef const __flash cmds_[] = {
     {(ProgmemStringLiteral){"ping"},     ping_func},
     {(ProgmemStringLiteral){"blswitch"}, blswitch_func},
     {(ProgmemStringLiteral){"cycles"},   cycles_func},
+    {(ProgmemStringLiteral){"lost"},     lost_func},
+    {(ProgmemStringLiteral){"prof"},     prof_func},
     {(ProgmemStringLiteral){"up"},       uptime_func},
     {(ProgmemStringLiteral){"date"},     curtime_func},
     {(ProgmemStringLiteral){"dump"},     dump_func},
@@ -219,10 +242,17 @@ ProgmemStringFuncRef const __flash cmds_[] = {
     {(ProgmemStringLiteral){"rmdir"},    rm_func},
     {(ProgmemStringLiteral){"mkfs"},     mkfs_func},
     {(ProgmemStringLiteral){"sector"},   sector_func},
+    {(ProgmemStringLiteral){"cache"},    cache_func},
+    {(ProgmemStringLiteral){"sdspeed"},  sdspeed_func},
+    {(ProgmemStringLiteral){"frag"},     frag_func},
+    {(ProgmemStringLiteral){"fsdlat"},   fsdlat_func},
     {(ProgmemStringLiteral){"inp"},      inp_func},
     {(ProgmemStringLiteral){"cat"},      cat_func},
     {(ProgmemStringLiteral){"print"},    print_func},
     {(ProgmemStringLiteral){"last"},     last_func},
+    {(ProgmemStringLiteral){"wake"},     wake_func},
+    {(ProgmemStringLiteral){"twi"},      twi_func},
+    {(ProgmemStringLiteral){"retry"},    retry_func},
     {(ProgmemStringLiteral){"put"},      put_func},
     {(ProgmemStringLiteral){"ls"},       ls_func},
     {(ProgmemStringLiteral){"cd"},       cd_func},
@@ -427,6 +457,78 @@ PRIVATE void resume(void)
         }
         break;
 
+    case FETCHING_CACHE:
+        /* hits, misses and the percentage of reads that were hits */
+        if (this.msg.fsd.reply.result) {
+            tty_putc('(');
+            tty_printl(this.msg.fsd.reply.result);
+            tty_putc(')');
+        } else {
+            tty_printl(this.msg.fsd.reply.p.cache.hits);
+            tty_putc(',');
+            tty_printl(this.msg.fsd.reply.p.cache.misses);
+            val = this.msg.fsd.reply.p.cache.hits +
+                  this.msg.fsd.reply.p.cache.misses;
+            if (val) {
+                tty_putc(',');
+                tty_printl(this.msg.fsd.reply.p.cache.hits * 100L / val);
+            }
+        }
+        break;
+
+    case FETCHING_SPEED:
+        /* sectors, milliseconds, sectors per second and the SPI divider */
+        if (this.msg.fsd.reply.result) {
+            tty_putc('(');
+            tty_printl(this.msg.fsd.reply.result);
+            tty_putc(')');
+        } else {
+            tty_printl(this.msg.fsd.reply.p.speed.sectors);
+            tty_putc(',');
+            tty_printl(this.msg.fsd.reply.p.speed.millis);
+            tty_putc(',');
+            val = this.msg.fsd.reply.p.speed.millis;
+            tty_printl(val ? this.msg.fsd.reply.p.speed.sectors * 1000L / val
+                           : 0);
+            tty_putc(',');
+            tty_printl(this.msg.fsd.reply.p.speed.divider);
+        }
+        break;
+
+    case FETCHING_FRAG:
+        /* free zones, runs of them, the largest run and its shortfall % */
+        if (this.msg.fsd.reply.result) {
+            tty_putc('(');
+            tty_printl(this.msg.fsd.reply.result);
+            tty_putc(')');
+        } else {
+            tty_printl(this.msg.fsd.reply.p.frag.free);
+            tty_putc(',');
+            tty_printl(this.msg.fsd.reply.p.frag.runs);
+            tty_putc(',');
+            tty_printl(this.msg.fsd.reply.p.frag.largest);
+            tty_putc(',');
+            val = this.msg.fsd.reply.p.frag.free;
+            tty_printl(val ? 100L - this.msg.fsd.reply.p.frag.largest * 100L
+                                                                  / val : 0);
+        }
+        break;
+
+    case FETCHING_LATENCY:
+        /* FSD requests by time taken, under 4, 16, 64 .. 1/256 s ticks */
+        if (this.msg.fsd.reply.result) {
+            tty_putc('(');
+            tty_printl(this.msg.fsd.reply.result);
+            tty_putc(')');
+        } else {
+            for (uchar_t i = 0; i < NR_LATENCY_BINS; i++) {
+                if (i)
+                    tty_putc(',');
+                tty_printl(this.msg.fsd.reply.p.latency.bins[i]);
+            }
+        }
+        break;
+
     case IN_ISP:
     case IN_ICSP:
     case PUTTING_FILE:
@@ -486,6 +588,77 @@ PRIVATE void resume(void)
         tty_printl(this.msg.syscon.reply.p.cycles.depth);
         tty_putc(',');
         tty_printl(this.msg.syscon.reply.p.cycles.lost);
+        tty_putc(',');
+        tty_printl(this.msg.syscon.reply.p.cycles.urgent_depth);
+        break;
+
+    case FETCHING_OVERFLOW:
+        {
+            overflow_reply *rp = &this.msg.syscon.reply.p.overflow;
+            uchar_t first = rp->first;
+            uchar_t limit = rp->limit;
+            if (first == 0) {
+                tty_puts_P(PSTR("lost:"));
+                tty_printl(rp->total);
+            }
+            for (uchar_t i = 0; i < OVERFLOW_SPAN && first + i < limit; i++) {
+                if (rp->count[i]) {
+                    tty_putc(' ');
+                    tty_printl(first + i);
+                    tty_putc(':');
+                    tty_printl(rp->count[i]);
+                }
+            }
+            first += OVERFLOW_SPAN;
+            if (first < limit) {
+                /* fetch the next span of counters */
+                this.msg.syscon.request.op = OP_OVERFLOW;
+                this.msg.syscon.request.p.overflow.table =
+                      (this.opt == 't') ? OVERFLOW_BY_TASK : OVERFLOW_BY_OPCODE;
+                this.msg.syscon.request.p.overflow.first = first;
+                send_syscon();
+                return;
+            }
+        }
+        break;
+
+    case FETCHING_PROFILE:
+        if (this.opt == 'c') {
+            ok = TRUE;
+        } else {
+            profile_reply *rp = &this.msg.syscon.reply.p.profile;
+            uchar_t first = rp->first;
+            uchar_t limit = rp->limit;
+            for (uchar_t i = 0; i < PROFILE_SPAN && first + i < limit; i++) {
+                if (this.opt == 'o') {
+                    if (rp->u.max[i]) {
+                        tty_putc(' ');
+                        tty_printl(first + i);
+                        tty_putc(':');
+                        tty_printl(rp->u.max[i]);
+                    }
+                } else if (rp->u.task[i].calls || rp->u.task[i].cycles) {
+                    tty_putc(' ');
+                    tty_printl(first + i);
+                    tty_putc(':');
+                    tty_printl(rp->u.task[i].calls);
+                    tty_putc(',');
+                    tty_printl(rp->u.task[i].cycles);
+                    tty_putc(',');
+                    tty_printl(rp->u.task[i].max);
+                }
+            }
+            first += PROFILE_SPAN;
+            if (first < limit) {
+                /* fetch the next span of entries */
+                this.msg.syscon.request.op = OP_PROFILE;
+                this.msg.syscon.request.p.profile.table =
+                      (this.opt == 'o') ? PROFILE_BY_OPCODE : PROFILE_BY_TASK;
+                this.msg.syscon.request.p.profile.first = first;
+                send_syscon();
+                return;
+            }
+        }
         break;
 
     case FETCHING_LASTRESET:
@@ -502,6 +675,75 @@ PRIVATE void resume(void)
         }
         break;
 
+    case FETCHING_WAKEUPS:
+        this.state = SHOWING_WAKE_RATE;
+        sae2_TWI_MR(this.info.twi, RV3028C7_I2C_ADDRESS,
+              RV_UNIX_TIME_0, this.dbuf.res);
+        return;
+
+    case SHOWING_WAKE_RATE:
+        /* wakeups since boot and per hour, from wakeups per minute */
+        tty_printl(this.msg.syscon.reply.p.wakeups.wakeups);
+        this.dbuf.res -= this.msg.syscon.reply.p.wakeups.boottime;
+        this.dbuf.res /= 60L;
+        if (this.dbuf.res) {
+            tty_putc(',');
+            val = this.msg.syscon.reply.p.wakeups.wakeups;
+            tty_printl(val / this.dbuf.res * 60L +
+                       val % this.dbuf.res * 60L / this.dbuf.res);
+        }
+        break;
+
+    case FETCHING_THROUGHPUT:
+        this.state = SHOWING_THROUGHPUT;
+        sae2_TWI_MR(this.info.twi, RV3028C7_I2C_ADDRESS,
+              RV_UNIX_TIME_0, this.dbuf.res);
+        return;
+
+    case SHOWING_THROUGHPUT:
+        /* master and slave bytes, and bytes per second since 'twi -c' */
+        tty_printl(this.msg.syscon.reply.p.throughput.master);
+        tty_putc(',');
+        tty_printl(this.msg.syscon.reply.p.throughput.slave);
+        if (this.opt == 'c') {
+            this.twi_mark = this.dbuf.res;
+        } else if (this.twi_mark && this.dbuf.res > this.twi_mark) {
+            tty_putc(',');
+            val = this.msg.syscon.reply.p.throughput.master +
+                  this.msg.syscon.reply.p.throughput.slave;
+            tty_printl(val / (this.dbuf.res - this.twi_mark));
+        }
+        break;
+
+    case FETCHING_RETRIES:
+        {
+            retries_reply *rp = &this.msg.syscon.reply.p.retries;
+            uchar_t first = rp->first;
+            uchar_t limit = rp->limit;
+            for (uchar_t i = 0; i < RETRIES_SPAN && first + i < limit; i++) {
+                tty_putc(' ');
+                tty_printl(rp->hist[i].dest_addr);
+                for (uchar_t j = 0; j < TWI_BINS; j++) {
+                    tty_putc(j ? ',' : ':');
+                    tty_printl(rp->hist[i].retries[j]);
+                }
+                for (uchar_t j = 0; j < TWI_BINS; j++) {
+                    tty_putc(j ? ',' : '/');
+                    tty_printl(rp->hist[i].losses[j]);
+                }
+            }
+            first += RETRIES_SPAN;
+            if (first < limit) {
+                /* fetch the next span of destinations */
+                this.msg.syscon.request.op = OP_RETRIES;
+                this.msg.syscon.request.p.retries.first = first;
+                this.msg.syscon.request.p.retries.clear = FALSE;
+                send_syscon();
+                return;
+            }
+        }
+        break;
+
     case SHOWING_ELAPSED:
         this.dbuf.res -= this.msg.syscon.reply.p.lastreset.boottime;
         tty_printl(this.dbuf.res);
@@ -746,6 +988,130 @@ PRIVATE void cycles_func( __attribute__ ((unused)) char *bp)
     }
 }
 
+PRIVATE void lost_func(char *bp)
+{
+    /* lost [-t] <host>
+     * print the number of messages that <host> discarded because its
+     * fifo was full, counted by opcode or, with -t, by receiving task.
+     */
+
+    if (*bp == '-') {
+        this.opt = *++bp;
+        while (*bp && *bp != ' ')
+            bp++;
+        while (*bp == ' ')
+            bp++;
+    }
+
+    if (*bp && lookup_host(bp, &this.target) == EOK) {
+        this.state = FETCHING_OVERFLOW;
+        this.msg.syscon.request.op = OP_OVERFLOW;
+        this.msg.syscon.request.p.overflow.table =
+                  (this.opt == 't') ? OVERFLOW_BY_TASK : OVERFLOW_BY_OPCODE;
+        this.msg.syscon.request.p.overflow.first = 0;
+        send_syscon();
+    } else {
+        send_REPLY_RESULT(SELF, EINVAL);
+    }
+}
+
+PRIVATE void prof_func(char *bp)
+{
+    /* prof [-o|-c] <host>
+     * print the number of calls, total cycles and longest call of each task
+     * on <host>, or with -o the longest call by opcode, or with -c clear
+     * the counters. <host> must be built with PROFILE.
+     */
+
+    if (*bp == '-') {
+        this.opt = *++bp;
+        while (*bp && *bp != ' ')
+            bp++;
+        while (*bp == ' ')
+            bp++;
+    }
+
+    if (*bp && lookup_host(bp, &this.target) == EOK) {
+        this.state = FETCHING_PROFILE;
+        this.msg.syscon.request.op = OP_PROFILE;
+        this.msg.syscon.request.p.profile.table =
+                  (this.opt == 'c') ? PROFILE_CLEAR :
+                  (this.opt == 'o') ? PROFILE_BY_OPCODE : PROFILE_BY_TASK;
+        this.msg.syscon.request.p.profile.first = 0;
+        send_syscon();
+    } else {
+        send_REPLY_RESULT(SELF, EINVAL);
+    }
+}
+
+PRIVATE void wake_func(char *bp)
+{
+    /* wake <host>
+     * print the number of times <host> has woken from sleep since it
+     * booted, and the number per hour.
+     */
+
+    if (*bp && lookup_host(bp, &this.target) == EOK) {
+        this.state = FETCHING_WAKEUPS;
+        this.msg.syscon.request.op = OP_WAKEUPS;
+        send_syscon();
+    } else {
+        send_REPLY_RESULT(SELF, EINVAL);
+    }
+}
+
+PRIVATE void twi_func(char *bp)
+{
+    /* twi [-c] <host>
+     * print the number of bytes that <host> has transferred on the bus as
+     * a master and as a slave, and the bytes per second since the counters
+     * were last cleared, or with -c clear them after printing.
+     */
+
+    if (*bp == '-') {
+        this.opt = *++bp;
+        while (*bp && *bp != ' ')
+            bp++;
+        while (*bp == ' ')
+            bp++;
+    }
+
+    if (*bp && lookup_host(bp, &this.target) == EOK) {
+        this.state = FETCHING_THROUGHPUT;
+        this.msg.syscon.request.op = OP_THROUGHPUT;
+        this.msg.syscon.request.p.throughput.clear = (this.opt == 'c');
+        send_syscon();
+    } else {
+        send_REPLY_RESULT(SELF, EINVAL);
+    }
+}
+
+PRIVATE void retry_func(char *bp)
+{
+    /* retry [-c] <host>
+     * print the TWI retry and arbitration loss histograms of each
+     * destination on <host>, or with -c clear them. <host> must be built
+     * with TWI_STATS.
+     */
+
+    if (*bp == '-') {
+        this.opt = *++bp;
+        while (*bp && *bp != ' ')
+            bp++;
+        while (*bp == ' ')
+            bp++;
+    }
+
+    if (*bp && lookup_host(bp, &this.target) == EOK) {
+        this.state = FETCHING_RETRIES;
+        this.msg.syscon.request.op = OP_RETRIES;
+        this.msg.syscon.request.p.retries.first = 0;
+        this.msg.syscon.request.p.retries.clear = (this.opt == 'c');
+        send_syscon();
+    } else {
+        send_REPLY_RESULT(SELF, EINVAL);
+    }
+}
 
 /* --------------------------- UTC ------------------------ */
 
@@ -867,11 +1233,21 @@ PRIVATE void fetch_buffer(void)
 
 PRIVATE void isp_func(char *bp)
 {
-    /* isp <host> */
+    /* isp <host> [host ...] */
 
-    if (*bp && lookup_host(bp, &this.target) == EOK) {
+    uchar_t n = 0;
+    while (*bp && n < ISP_TARGETS &&
+                  lookup_host(bp, &this.info.isp.target[n]) == EOK) {
+        n++;
+        while (*bp && *bp != ' ')
+            bp++;
+        while (*bp == ' ')
+            bp++;
+    }
+
+    if (n && *bp == '\0') {
         this.state = IN_ISP;
-        this.info.isp.target = this.target;
+        this.info.isp.ntargets = n;
         send_JOB(ISP, &this.info.isp);
     } else {
         send_REPLY_RESULT(SELF, EINVAL);
@@ -958,6 +1334,77 @@ PRIVATE void sector_func(char *bp)
     send_fsd();
 }
 
+PRIVATE void cache_func(char *bp)
+{
+    /* cache [-c]
+     * print the sector cache hits and misses on the file server, or with
+     * -c clear them after printing.
+     */
+
+    if (*bp == '-') {
+        this.opt = *++bp;
+        while (*bp && *bp != ' ')
+            bp++;
+    }
+
+    this.state = FETCHING_CACHE;
+    this.msg.fsd.request.op = OP_CACHE;
+    this.msg.fsd.request.p.cache.clear = (this.opt == 'c');
+    send_fsd();
+}
+
+PRIVATE void sdspeed_func(char *bp)
+{
+    /* sdspeed [-c]
+     * print the SDCard sectors transferred, the time taken, the sectors
+     * per second and the SPI clock divider, or with -c clear them after
+     * printing.
+     */
+
+    if (*bp == '-') {
+        this.opt = *++bp;
+        while (*bp && *bp != ' ')
+            bp++;
+    }
+
+    this.state = FETCHING_SPEED;
+    this.msg.fsd.request.op = OP_SPEED;
+    this.msg.fsd.request.p.speed.clear = (this.opt == 'c');
+    send_fsd();
+}
+
+PRIVATE void frag_func(char *bp)
+{
+    /* frag
+     * print the free zones on the file server, the runs they make, the
+     * zones in the largest run that a multiple zone allocation can use
+     * and the percentage of free zones outside it.
+     */
+
+    this.state = FETCHING_FRAG;
+    this.msg.fsd.request.op = OP_FRAG;
+    send_fsd();
+}
+
+PRIVATE void fsdlat_func(char *bp)
+{
+    /* fsdlat [-c]
+     * print the histogram of file server request times, or with -c clear
+     * it after printing.
+     */
+
+    if (*bp == '-') {
+        this.opt = *++bp;
+        while (*bp && *bp != ' ')
+            bp++;
+    }
+
+    this.state = FETCHING_LATENCY;
+    this.msg.fsd.request.op = OP_LATENCY;
+    this.msg.fsd.request.p.latency.clear = (this.opt == 'c');
+    send_fsd();
+}
+
 PRIVATE void inp_func(char *bp)
 {
     /* inp <host> <string> */
@@ -248,6 +248,12 @@ PRIVATE void resume(void)
             } else {
                 this->dir_items -= this->n_items;
             }
+            if ((this->arg_ino.i_mode & I_INDEXED) &&
+                         BYTE_SECTOR(this->fpos) == DIR_HASH_SECTOR) {
+                /* the hash sector holds no dirents */
+                this->fpos += BLOCK_SIZE;
+                this->dir_items -= MIN(this->dir_items, DIRENT_PER_BLOCK);
+            }
             this->cur_item = this->list_all ? 0 : 2;
         }
         /* fallthrough */
@@ -31,9 +31,9 @@
 
 /* create a file or make a directory.
  *
- * usage:  creat [nzones] <path>
- *         create [nzones] <path>
- *         mk [nzones] <path>
+ * usage:  creat [-l] [nzones] <path>
+ *         create [-l] [nzones] <path>
+ *         mk [-l] [nzones] <path>
  *         mkdir <path>
  */
 
@@ -142,23 +142,38 @@ PRIVATE void start_job(void)
             this->mode = I_DIRECTORY | X_BIT | R_BIT | W_BIT;
             this->path = this->headp->argv[1];
             ret = EOK;
+        } else if (this->headp->argc == 3 &&
+                   strcmp_P(this->headp->argv[1], PSTR("-i")) == 0) {
+            /* with a name hash sector */
+            this->nzones = 1;
+            this->mode = I_DIRECTORY | I_INDEXED | X_BIT | R_BIT | W_BIT;
+            this->path = this->headp->argv[2];
+            ret = EOK;
         }
     } else { /* creat,create,mk */
         int tval = 0;
-        if (this->headp->argc == 2) {
+        uchar_t argc = this->headp->argc;
+        char **argv = this->headp->argv;
+        this->mode = I_REGULAR | R_BIT | W_BIT;
+        if (argc > 2 && strcmp_P(argv[1], PSTR("-l")) == 0) {
+            /* a log file, zeroed as it is made */
+            this->mode |= I_LOG;
+            argc--;
+            argv++;
+        }
+        if (argc == 2) {
             tval = 1;
-            this->path = this->headp->argv[1];
-        } else if (this->headp->argc == 3) {
-            char *bp = this->headp->argv[1];
+            this->path = argv[1];
+        } else if (argc == 3) {
+            char *bp = argv[1];
 
             while (*bp && isdigit(*bp))
                 tval = tval * 10 + *bp++ - '0';  
 
-            this->path = this->headp->argv[2];
+            this->path = argv[2];
         }
         if (tval > 0 && tval < 4096) {
             this->nzones = (ushort_t) tval;
-            this->mode = I_REGULAR | R_BIT | W_BIT;
             ret = EOK;
         }
     }
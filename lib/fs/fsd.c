@@ -36,15 +36,29 @@
  * exclusion over the sd_admin sector buffer, which all the agents use.
  *
  * When the reply from the job is received an FSD_REPLY is sent to the caller.
+ *
+ * FSD_SLOTS requests are served at once, each slot listening for a request
+ * of its own. A slot claims sd_admin at its first agent job and releases it
+ * as it replies; a slot that finds it claimed waits in turn for it. So the
+ * TWI transfers of one request, i.e. receiving it, fetching a name and
+ * replying, overlap the agent jobs of another, and a client finds a slot
+ * listening rather than ENODEV while a long request is in progress.
+ *
+ * OP_SECTOR and OP_BUFFER_ADDRESS leave sd_admin for the client to read or
+ * write after the reply, so it is held for the client instead of released.
+ * The hold ends at the client's next request, or after FSD_HOLD_MILLIS.
  */
 
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 #include <avr/io.h>
 
 #include "sys/defs.h"
 #include "sys/ioctl.h"
 #include "sys/msg.h"
+#include "sys/clk.h"
+#include "sys/utc.h"
 #include "net/i2c.h"
 #include "net/twi.h"
 #include "net/memz.h"
@@ -54,6 +68,7 @@
 #include "fs/sdc.h"
 #include "fs/ssd.h"
 #include "fs/ino.h"
+#include "fs/map.h"
 #include "fs/mknod.h"
 #include "fs/readf.h"
 #include "fs/link.h"
@@ -63,7 +78,14 @@
 
 /* I am .. */
 #define SELF FSD
-#define this fsd
+#define this (*sp)
+
+#ifndef FSD_SLOTS
+#define FSD_SLOTS 2         /* requests in progress at once */
+#endif
+#ifndef FSD_HOLD_MILLIS
+#define FSD_HOLD_MILLIS 5000 /* sd_admin kept for the client of OP_SECTOR */
+#endif
 
 typedef enum {
     IDLE = 0,
@@ -88,11 +110,15 @@ typedef enum {
     RESOLVING_INUM_TO_NAME,
     SKIPPING_INDIR_TRANSFER,
     TRANSFERRING_INDIR_NAME,
+    SURVEYING_ZMAP,
     SENDING_REPLY
 } __attribute__ ((packed)) state_t;
 
 typedef struct {
     state_t state;
+    unsigned queued : 1;    /* waiting for sd_admin */
+    uchar_t turn;           /* in the queue for sd_admin */
+    ulong_t started;        /* uptime ticks as the request arrived */
     inum_t t_inum;
     inum_t dir_inum;
     union {
@@ -112,27 +138,48 @@ typedef struct {
         readf_info readf;
         indir_info indir;
         ino_info ino;
+        map_info map;
         ssd_info ssd;
         twi_info twi;
     } info;
+} fsd_slot;
+
+typedef struct {
+    fsd_slot *admin;        /* the slot that has claimed sd_admin */
+    unsigned held : 1;      /* sd_admin is held for a client's use */
+    hostid_t holder;        /* the client that it is held for */
+    clk_info clk;           /* the end of the hold */
+    uchar_t turn;           /* the next place in its queue */
+    ushort_t latency[NR_LATENCY_BINS];
+    fsd_slot slot[FSD_SLOTS];
 } fsd_t;
 
 /* I have .. */
-static fsd_t this;
+static fsd_t fsd;
+static fsd_slot *sp;        /* the slot in hand */
 
 /* I can .. */
 PRIVATE void exec_command(void);
 PRIVATE void resume(message *m_ptr);
 PRIVATE void get_request(void);
 PRIVATE void send_reply(uchar_t result);
+PRIVATE fsd_slot *find_slot(message *m_ptr);
+PRIVATE uchar_t claim(void);
+PRIVATE void release(void);
+PRIVATE void hold(void);
+PRIVATE void unhold(void);
+PRIVATE void wake_next(void);
 
 PUBLIC uchar_t receive_fsd(message *m_ptr)
 {
     switch (m_ptr->opcode) {
     case REPLY_INFO:
     case REPLY_RESULT:
-        if (this.state == ENSLAVED && m_ptr->sender == TWI) {
+        if ((sp = find_slot(m_ptr)) == NULL) {
+            break;
+        } else if (this.state == ENSLAVED && m_ptr->sender == TWI) {
             if (m_ptr->RESULT == EOK) {
+                this.started = get_uptime_ticks();
                 exec_command();
             } else {
                 get_request();
@@ -142,11 +189,20 @@ PUBLIC uchar_t receive_fsd(message *m_ptr)
         }
         break;
 
+    case ALARM:
+        /* the client has not come back for sd_admin */
+        if (fsd.held) {
+            sp = NULL;
+            unhold();
+        }
+        break;
+
     case INIT:
         {
             uchar_t result = EBUSY;
-            if (this.state == IDLE) {
-                get_request();
+            if (fsd.slot[0].state == IDLE) {
+                for (sp = fsd.slot; sp < fsd.slot + FSD_SLOTS; sp++)
+                    get_request();
                 result = EOK;
             }
             send_REPLY_RESULT(m_ptr->sender, result);
@@ -161,6 +217,26 @@ PUBLIC uchar_t receive_fsd(message *m_ptr)
 
 PRIVATE void exec_command(void)
 {
+    switch (this.sm.request.op) {
+    case OP_IFETCH:
+    case OP_READ:
+    case OP_MKFS:
+    case OP_SECTOR:
+    case OP_BUFFER_ADDRESS:
+    case OP_INDIR:
+    case OP_FRAG:
+        /* these start with an agent job, or hand out sd_admin */
+        if (!claim())
+            return;
+        break;
+
+    default:
+        /* the holder is done with sd_admin */
+        if (fsd.held && fsd.holder == this.sm.request.sender_addr)
+            unhold();
+        break;
+    }
+
     switch (this.sm.request.op) {
     case OP_MKNOD:
         if ((this.hp.cbuf = calloc(this.sm.request.p.mknod.len +1,
@@ -224,6 +300,8 @@ PRIVATE void exec_command(void)
         break;
 
     case OP_BUFFER_ADDRESS:
+        /* the caller may write into it */
+        sdc_dirty(sd_admin.buf);
         this.sm.reply.p.bufaddr.bufp = sd_admin.buf;
         send_reply(EOK);
         break;
@@ -286,6 +364,45 @@ PRIVATE void exec_command(void)
         }
         break;
 
+    case OP_CACHE:
+        {
+            uchar_t clear = this.sm.request.p.cache.clear;
+            this.sm.reply.p.cache.hits = sdc_hits();
+            this.sm.reply.p.cache.misses = sdc_misses();
+            if (clear)
+                sdc_clear_stats();
+            send_reply(EOK);
+        }
+        break;
+
+    case OP_SPEED:
+        {
+            uchar_t clear = this.sm.request.p.speed.clear;
+            this.sm.reply.p.speed.sectors = ssd_sectors();
+            this.sm.reply.p.speed.millis = ssd_millis();
+            this.sm.reply.p.speed.divider = ssd_divider();
+            if (clear)
+                ssd_clear_stats();
+            send_reply(EOK);
+        }
+        break;
+
+    case OP_FRAG:
+        this.state = SURVEYING_ZMAP;
+        sae_SURVEY_ZMAP(this.info.map);
+        break;
+
+    case OP_LATENCY:
+        {
+            uchar_t clear = this.sm.request.p.latency.clear;
+            memcpy(this.sm.reply.p.latency.bins, fsd.latency,
+                                                sizeof(fsd.latency));
+            if (clear)
+                memset(fsd.latency, 0, sizeof(fsd.latency));
+            send_reply(EOK);
+        }
+        break;
+
     default:
         send_reply(ENOSYS);
         break;
@@ -294,6 +411,21 @@ PRIVATE void exec_command(void)
  
 PRIVATE void resume(message *m_ptr)
 {
+    switch (this.state) {
+    case FETCHING_MKNOD_NAME:
+    case FETCHING_LINK_NAME:
+    case FETCHING_UNLINK_NAME:
+    case FETCHING_IWRITE_INODE:
+    case FETCHING_PATH:
+        /* the next step is an agent job */
+        if (!claim())
+            return;
+        break;
+
+    default:
+        break;
+    }
+
     switch (this.state) {
     case IDLE:
     case ENSLAVED:
@@ -345,6 +477,13 @@ PRIVATE void resume(message *m_ptr)
         send_reply(m_ptr->RESULT);
         break;
 
+    case SURVEYING_ZMAP:
+        this.sm.reply.p.frag.free = map_free_zones();
+        this.sm.reply.p.frag.runs = map_free_runs();
+        this.sm.reply.p.frag.largest = map_largest();
+        send_reply(m_ptr->RESULT);
+        break;
+
     case FETCHING_INODE:
         this.state = TRANSFERRING_INODE;
         this.msg.memp.request.taskid = SELF;
@@ -436,6 +575,19 @@ PRIVATE void get_request(void)
 
 PRIVATE void send_reply(uchar_t result)
 {
+    ulong_t ticks = get_uptime_ticks() - this.started;
+    uchar_t bin = 0;
+
+    /* under 4 ticks of 1/256 s, under 16, 64 .. ticks */
+    for (ticks >>= 2; ticks && bin < NR_LATENCY_BINS - 1; ticks >>= 2)
+        bin++;
+    fsd.latency[bin]++;
+
+    if (result == EOK && (this.sm.request.op == OP_SECTOR ||
+                          this.sm.request.op == OP_BUFFER_ADDRESS))
+        hold();
+    else
+        release();
     this.state = SENDING_REPLY;
     hostid_t reply_address = this.sm.request.sender_addr;
     this.sm.reply.sender_addr = HOST_ADDRESS;
@@ -443,4 +595,98 @@ PRIVATE void send_reply(uchar_t result)
     sae2_TWI_MT(this.info.twi, reply_address, FSD_REPLY, this.sm.reply);
 }
 
+/* The slot that a reply is for: the one whose info it returns, else, for
+ * MKFS, the one that has claimed sd_admin.
+ */
+PRIVATE fsd_slot *find_slot(message *m_ptr)
+{
+    if (m_ptr->opcode == REPLY_INFO) {
+        uchar_t *ip = m_ptr->INFO;
+        for (fsd_slot *tp = fsd.slot; tp < fsd.slot + FSD_SLOTS; tp++) {
+            if (ip >= (uchar_t *)tp && ip < (uchar_t *)(tp + 1))
+                return tp;
+        }
+        return NULL;
+    }
+    return fsd.admin;
+}
+
+/* Claim sd_admin for the slot in hand, or queue for it. A hold is taken
+ * over by a request from its client.
+ */
+PRIVATE uchar_t claim(void)
+{
+    if (fsd.held && fsd.holder == this.sm.request.sender_addr) {
+        fsd.held = FALSE;
+        fsd.admin = sp;
+    }
+    if (!fsd.held && (fsd.admin == NULL || fsd.admin == sp)) {
+        fsd.admin = sp;
+        this.queued = FALSE;
+        return TRUE;
+    }
+    if (!this.queued) {
+        this.queued = TRUE;
+        this.turn = fsd.turn++;
+    }
+    return FALSE;
+}
+
+/* Release sd_admin and continue the slot that has waited longest. */
+PRIVATE void release(void)
+{
+    if (fsd.admin != sp)
+        return;
+    fsd.admin = NULL;
+    wake_next();
+}
+
+/* Keep sd_admin from the other slots for the client of the slot in hand
+ * until its next request, or until the alarm.
+ */
+PRIVATE void hold(void)
+{
+    if (fsd.admin != sp)
+        return;
+    fsd.admin = NULL;
+    fsd.held = TRUE;
+    fsd.holder = this.sm.request.sender_addr;
+    sae_CLK_SET_ALARM(fsd.clk, FSD_HOLD_MILLIS);
+}
+
+/* End the hold. A pending alarm is left to find nothing held, or is set
+ * again by the next hold.
+ */
+PRIVATE void unhold(void)
+{
+    fsd.held = FALSE;
+    wake_next();
+}
+
+/* Continue the slot that has waited longest for sd_admin, if any. */
+PRIVATE void wake_next(void)
+{
+    fsd_slot *self = sp;
+    fsd_slot *next = NULL;
+
+    for (fsd_slot *tp = fsd.slot; tp < fsd.slot + FSD_SLOTS; tp++) {
+        if (tp->queued && (next == NULL ||
+                (uchar_t)(fsd.turn - tp->turn) >
+                (uchar_t)(fsd.turn - next->turn)))
+            next = tp;
+    }
+    if (next) {
+        sp = next;
+        if (this.state == ENSLAVED) {
+            exec_command();
+        } else {
+            message m;
+            m.sender = SELF;
+            m.RESULT = EOK;
+            resume(&m);
+        }
+        sp = self;
+    }
+}
+
 /* end code */
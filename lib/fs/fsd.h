@@ -46,6 +46,12 @@
 #define  OP_UNLINK  9
 #define  OP_PATH    10
 #define  OP_INDIR   11
+#define  OP_CACHE   12
+#define  OP_SPEED   13
+#define  OP_FRAG    14
+#define  OP_LATENCY 15
+
+#define NR_LATENCY_BINS 6
 
 typedef struct {
     char *src;
@@ -98,6 +104,18 @@ typedef struct {
     inode_t *ip;
 } path_request;
 
+typedef struct {
+    uchar_t clear;    /* zero the counters after reading them */
+} cache_request;
+
+typedef struct {
+    uchar_t clear;    /* zero the counters after reading them */
+} speed_request;
+
+typedef struct {
+    uchar_t clear;    /* zero the histogram after reading it */
+} latency_request;
+
 typedef struct {
     char *bp;         /* client memory address to receive the basename */
     inum_t base_inum; /* inode number of basename */
@@ -124,6 +142,28 @@ typedef struct {
     ushort_t d_idx;
 } indir_reply;
 
+typedef struct {
+    ulong_t hits;     /* sector READs answered by the block cache */
+    ulong_t misses;   /* sector READs sent to the card */
+} cache_reply;
+
+typedef struct {
+    ulong_t sectors;  /* sectors transferred to or from the card */
+    ulong_t millis;   /* time spent transferring them */
+    uchar_t divider;  /* SPI clock rate is F_CPU / divider */
+} speed_reply;
+
+typedef struct {
+    ushort_t free;    /* free zones */
+    ushort_t runs;    /* runs of consecutive free zones */
+    ushort_t largest; /* zones in the largest run of free bytes */
+} frag_reply;
+
+typedef struct {
+    ushort_t bins[NR_LATENCY_BINS]; /* requests taking under 4, 16, 64,
+                                       256, 1024 and more 1/256 s ticks */
+} latency_reply;
+
 typedef struct {
     ProcNumber taskid;
     jobref_t jobref;
@@ -139,6 +179,9 @@ typedef struct {
         unlink_request unlink;
         path_request path;
         indir_request indir;
+        cache_request cache;
+        speed_request speed;
+        latency_request latency;
     } p;
 } fsd_request;
 
@@ -152,6 +195,10 @@ typedef struct {
         bufaddr_reply bufaddr;
         path_reply path;
         indir_reply indir;
+        cache_reply cache;
+        speed_reply speed;
+        frag_reply frag;
+        latency_reply latency;
     } p;
 } fsd_reply;
 
@@ -166,6 +166,15 @@ PRIVATE void resume(void)
             }
             if (this->n_items) {
                 this->cur_sector++;
+                if ((this->myno.i_mode & I_INDEXED) && this->cur_sector ==
+                        ZONE_SECTORS(this->myno.i_zone) + DIR_HASH_SECTOR) {
+                    /* the hash sector holds no dirents */
+                    this->cur_sector++;
+                    this->headp->d_idx += DIRENT_PER_BLOCK;
+                    this->n_items -= MIN(this->n_items, DIRENT_PER_BLOCK);
+                }
+            }
+            if (this->n_items) {
                 sae_READ_SSD(this->info.ssd, this->cur_sector, sd_admin.buf);
             } else {
                 this->state = IDLE;
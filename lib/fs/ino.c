@@ -38,6 +38,14 @@
  * The private storage is permanent to prevent any failure caused by 
  * insufficient memory.
  *
+ * The most recently used inodes are cached, INO_CACHE of them, so a GET of
+ * a cached inode is answered without reading the inode table. A PUT is
+ * written through to the card. An UPDATE is written back: the cached copy
+ * is marked dirty and the client is answered at once. The client's buffer
+ * is then lent to INO until the client's next job, and the dirty inodes
+ * are written with it INO_FLUSH_DELAY milliseconds after the first of
+ * them, or with the buffer of the next job after that if it has been
+ * reclaimed. MKFS and MOUNT discard the cache with ino_invalidate().
  */
 
 #include <string.h>
@@ -45,6 +53,7 @@
 
 #include "sys/defs.h"
 #include "sys/msg.h"
+#include "sys/clk.h"
 #include "sys/utc.h"
 #include "fs/ssd.h"
 #include "fs/sfa.h"
@@ -55,14 +64,38 @@
 #define SELF INO
 #define this ino
 
+#ifndef INO_CACHE
+#define INO_CACHE 4            /* cached inodes, 17 bytes each */
+#endif
+
+#ifndef INO_FLUSH_DELAY
+#define INO_FLUSH_DELAY 30000  /* milliseconds */
+#endif
+
 typedef enum {
     IDLE = 0,
-    READING_ISECTOR
+    READING_ISECTOR,
+    FLUSH_READING,
+    FLUSH_WRITING
 } __attribute__ ((packed)) state_t;
 
+typedef struct {
+    inode_t ino;             /* i_inum is zero if the entry is free */
+    uchar_t used;            /* the clock when it was last used */
+    uchar_t dirty;           /* to be written back */
+} ino_entry;
+
 typedef struct {
     state_t state;
+    unsigned armed : 1;      /* the flush alarm is set */
+    unsigned flush_due : 1;  /* the flush alarm has gone off */
     ino_info *headp;
+    uchar_t *spare;          /* buffer lent by the last UPDATE */
+    uchar_t *fbuf;           /* buffer of the flush in progress */
+    ushort_t fsector;        /* itable sector of the flush in progress */
+    uchar_t clock;
+    ino_entry cache[INO_CACHE];
+    clk_info clk;
     union {
         ssd_info ssd;
     } info;
@@ -74,13 +107,22 @@ static ino_t this;
 /* I can .. */
 PRIVATE void start_job(void);
 PRIVATE void resume(void);
+PRIVATE ino_entry *find_entry(inum_t inum);
+PRIVATE ino_entry *new_entry(inum_t inum);
+PRIVATE void put_entry(inode_t *ip, uchar_t dirty);
+PRIVATE void patch_dirty(ushort_t sector, inode_t *dp);
+PRIVATE ino_entry *next_dirty(void);
+PRIVATE void flush(uchar_t *buf);
+PRIVATE void resume_flush(uchar_t result);
 
 PUBLIC uchar_t receive_ino(message *m_ptr)
 {
     switch (m_ptr->opcode) {
     case REPLY_INFO:
     case REPLY_RESULT:
-        if (this.state && m_ptr->RESULT == EOK) {
+        if (this.state == FLUSH_READING || this.state == FLUSH_WRITING) {
+            resume_flush(m_ptr->RESULT);
+        } else if (this.state && m_ptr->RESULT == EOK) {
             resume();
         } else {
             this.state = IDLE;
@@ -92,14 +134,26 @@ PUBLIC uchar_t receive_ino(message *m_ptr)
         }
         break;
 
+    case ALARM:
+        this.armed = FALSE;
+        this.flush_due = TRUE;
+        if (!this.headp && this.state == IDLE && this.spare)
+            flush(this.spare);
+        break;
+
     case JOB:
         {
             ino_info *ip = m_ptr->INFO;
             ip->nextp = NULL;
             ip->replyTo = m_ptr->sender;
+            if (ip->buf == this.spare) {
+                /* the client has reclaimed its buffer */
+                this.spare = NULL;
+            }
             if (!this.headp) {
                 this.headp = ip;
-                start_job();
+                if (this.state == IDLE)
+                    start_job();
             } else {
                 ino_info *tp;
                 for (tp = this.headp; tp->nextp; tp = tp->nextp)
@@ -115,8 +169,55 @@ PUBLIC uchar_t receive_ino(message *m_ptr)
     return EOK;
 }
 
+/* Discard the cached inodes, e.g. after MKFS has replaced the inode table.
+ * Any that are dirty are lost.
+ */
+PUBLIC void ino_invalidate(void)
+{
+    memset(this.cache, 0, sizeof(this.cache));
+    this.flush_due = FALSE;
+}
+
 PRIVATE void start_job(void)
 {
+    ino_entry *ep;
+
+    if (this.flush_due && next_dirty()) {
+        /* a buffer is to hand, so write the dirty inodes first */
+        flush(this.headp->buf);
+        return;
+    }
+
+    switch (this.headp->op) {
+    case GET_INODE:
+        if ((ep = find_entry(this.headp->inum)) != NULL) {
+            ep->used = ++this.clock;
+            memcpy(this.headp->ip, &ep->ino, INODE_SIZE);
+            send_REPLY_RESULT(SELF, EOK);
+            return;
+        }
+        break;
+
+    case UPDATE_INODE:
+        this.headp->ip->i_mtime = get_utc();
+        this.headp->ip->i_inum = this.headp->inum;
+        if ((ep = find_entry(this.headp->inum)) != NULL ||
+            (ep = new_entry(this.headp->inum)) != NULL) {
+            ep->used = ++this.clock;
+            memcpy(&ep->ino, this.headp->ip, INODE_SIZE);
+            ep->dirty = TRUE;
+            this.spare = this.headp->buf;
+            if (!this.armed) {
+                this.armed = TRUE;
+                sae_CLK_SET_ALARM(this.clk, INO_FLUSH_DELAY);
+            }
+            send_REPLY_RESULT(SELF, EOK);
+            return;
+        }
+        /* every entry is dirty, so write this one through */
+        break;
+    }
+
     this.state = READING_ISECTOR; 
     sae_READ_SSD(this.info.ssd,
         ITABLE_SECTOR_NUMBER + ITABLE_SECTOR(this.headp->inum),
@@ -130,6 +231,8 @@ PRIVATE void resume(void)
 
     switch (this.state) {
     case IDLE:
+    case FLUSH_READING:
+    case FLUSH_WRITING:
         break;
 
     case READING_ISECTOR:
@@ -138,12 +241,18 @@ PRIVATE void resume(void)
             this.state = IDLE; 
             memcpy(this.headp->ip, dp + n, INODE_SIZE);
             this.headp->ip->i_inum = this.headp->inum;
+            put_entry(this.headp->ip, FALSE);
             send_REPLY_RESULT(SELF, EOK);
             break;
 
         case PUT_INODE:
+        case UPDATE_INODE:
             this.state = IDLE; 
             this.headp->ip->i_mtime = get_utc();
+            this.headp->ip->i_inum = this.headp->inum;
+            put_entry(this.headp->ip, FALSE);
+            /* the sector carries any dirty neighbours with it */
+            patch_dirty(ITABLE_SECTOR(this.headp->inum), dp);
             memcpy(dp + n, this.headp->ip,  INODE_SIZE);
             sae_WRITE_SSD(this.info.ssd,
                 ITABLE_SECTOR_NUMBER + ITABLE_SECTOR(this.headp->inum),
@@ -158,6 +267,111 @@ PRIVATE void resume(void)
     }
 }
 
+PRIVATE ino_entry *find_entry(inum_t inum)
+{
+    for (ino_entry *ep = this.cache; ep < this.cache + INO_CACHE; ep++) {
+        if (ep->ino.i_inum == inum && inum)
+            return ep;
+    }
+    return NULL;
+}
+
+/* Take a free entry, or else the least recently used clean one. */
+PRIVATE ino_entry *new_entry(inum_t inum)
+{
+    ino_entry *vp = NULL;
+
+    for (ino_entry *ep = this.cache; ep < this.cache + INO_CACHE; ep++) {
+        if (ep->ino.i_inum == 0) {
+            vp = ep;
+            break;
+        } else if (!ep->dirty && (vp == NULL ||
+                   (uchar_t)(this.clock - ep->used) >
+                   (uchar_t)(this.clock - vp->used))) {
+            vp = ep;
+        }
+    }
+    if (vp) {
+        vp->ino.i_inum = inum;
+        vp->dirty = FALSE;
+    }
+    return vp;
+}
+
+/* Record an inode as it is on the card, or is about to be. */
+PRIVATE void put_entry(inode_t *ip, uchar_t dirty)
+{
+    ino_entry *ep;
+
+    if ((ep = find_entry(ip->i_inum)) != NULL ||
+        (ep = new_entry(ip->i_inum)) != NULL) {
+        ep->used = ++this.clock;
+        memcpy(&ep->ino, ip, INODE_SIZE);
+        ep->dirty = dirty;
+    }
+}
+
+/* Copy the dirty inodes of an itable sector into it, and mark them clean. */
+PRIVATE void patch_dirty(ushort_t sector, inode_t *dp)
+{
+    for (ino_entry *ep = this.cache; ep < this.cache + INO_CACHE; ep++) {
+        if (ep->dirty && ITABLE_SECTOR(ep->ino.i_inum) == sector) {
+            memcpy(dp + (ep->ino.i_inum & INODES_PER_BLOCK_MASK),
+                                                  &ep->ino, INODE_SIZE);
+            ep->dirty = FALSE;
+        }
+    }
+}
+
+PRIVATE ino_entry *next_dirty(void)
+{
+    for (ino_entry *ep = this.cache; ep < this.cache + INO_CACHE; ep++) {
+        if (ep->dirty)
+            return ep;
+    }
+    return NULL;
+}
+
+/* Write the dirty inodes, one itable sector at a time, using buf. */
+PRIVATE void flush(uchar_t *buf)
+{
+    ino_entry *ep;
+
+    this.flush_due = FALSE;
+    if ((ep = next_dirty()) == NULL) {
+        this.state = IDLE;
+        if (this.headp)
+            start_job();
+    } else {
+        this.fbuf = buf;
+        this.fsector = ITABLE_SECTOR(ep->ino.i_inum);
+        this.state = FLUSH_READING;
+        sae_READ_SSD(this.info.ssd,
+                     ITABLE_SECTOR_NUMBER + this.fsector, this.fbuf);
+    }
+}
+
+PRIVATE void resume_flush(uchar_t result)
+{
+    if (result != EOK) {
+        /* try again later */
+        this.state = IDLE;
+        if (!this.armed) {
+            this.armed = TRUE;
+            sae_CLK_SET_ALARM(this.clk, INO_FLUSH_DELAY);
+        }
+        if (this.headp)
+            start_job();
+    } else if (this.state == FLUSH_READING) {
+        this.state = FLUSH_WRITING;
+        patch_dirty(this.fsector, (inode_t *)this.fbuf);
+        sae_WRITE_SSD(this.info.ssd,
+                      ITABLE_SECTOR_NUMBER + this.fsector, this.fbuf);
+    } else {
+        flush(this.fbuf);
+    }
+}
+
 /* convenience function */
 
 PUBLIC void send_INO_JOB(ProcNumber sender, ino_info *cp, uchar_t op,
@@ -36,6 +36,7 @@
 
 #define GET_INODE 1
 #define PUT_INODE 2
+#define UPDATE_INODE 3  /* a PUT that is written back later */
  
 typedef struct _ino_info {
     struct _ino_info *nextp;   
@@ -60,6 +61,10 @@ PUBLIC void send_INO_JOB (
 
 #define sae_PUT_INODE(a,b,c,d)  send_INO_JOB(SELF, &(a),PUT_INODE,(b),(c),(d))
 #define sae_GET_INODE(a,b,c,d)  send_INO_JOB(SELF, &(a),GET_INODE,(b),(c),(d))
+#define sae_UPDATE_INODE(a,b,c,d) \
+                        send_INO_JOB(SELF, &(a),UPDATE_INODE,(b),(c),(d))
+
+PUBLIC void ino_invalidate(void);
 
 #else /* _MAIN_ */
 
@@ -57,6 +57,8 @@ typedef enum {
     WRITING_INODE,
     REFETCHING_PARENT_INODE,
     READING_PARENT_SECTOR,
+    READING_HASH_SECTOR,
+    WRITING_HASH_SECTOR,
     WRITING_PARENT_SECTOR
 } __attribute__ ((packed)) state_t;
 
@@ -65,6 +67,8 @@ typedef struct {
     link_info *headp;
     inode_t myno;
     ushort_t sector_nr;
+    ushort_t d_idx;       /* of the new dirent, in the hash sector */
+    uchar_t hashed;       /* the new dirent's hash has been written */
     union {
         scan_info scan;
         ino_info ino;
@@ -183,6 +187,7 @@ PRIVATE void resume(void)
     case REFETCHING_PARENT_INODE:
         this->state = READING_PARENT_SECTOR;
         this->sector_nr = 0;
+        this->hashed = FALSE;
         sae_READ_SSD(this->info.ssd,
                    ZONE_SECTORS(this->myno.i_zone) + this->sector_nr,
                                                       sd_admin.buf);
@@ -198,12 +203,26 @@ PRIVATE void resume(void)
                     break;
             }
             if (n == DIRENT_PER_BLOCK) {
-                if (this->sector_nr < ZONE_SECTORS(this->myno.i_nzones) -1) {
-                    this->sector_nr++;
+                ushort_t next = this->sector_nr + 1;
+                if ((this->myno.i_mode & I_INDEXED) && next == DIR_HASH_SECTOR)
+                    next++;
+                if (next < ZONE_SECTORS(this->myno.i_nzones)) {
+                    this->sector_nr = next;
                     sae_READ_SSD(this->info.ssd,
                           ZONE_SECTORS(this->myno.i_zone) + this->sector_nr,
                                                              sd_admin.buf);
+                } else {
+                    send_REPLY_RESULT(SELF, ENOSPC);
                 }
+            } else if ((this->myno.i_mode & I_INDEXED) && !this->hashed &&
+                                     this->sector_nr < DIR_HASH_SECTOR) {
+                /* enter the hash first, so no dirent is ever unindexed */
+                this->state = READING_HASH_SECTOR;
+                this->hashed = TRUE;
+                this->d_idx = (this->sector_nr << DIRENT_PER_BLOCK_SHIFT) + n;
+                sae_READ_SSD(this->info.ssd,
+                        ZONE_SECTORS(this->myno.i_zone) + DIR_HASH_SECTOR,
+                                                             sd_admin.buf);
             } else {
                 this->state = WRITING_PARENT_SECTOR;
                 dp[n].d_inum = this->headp->inum;
@@ -221,6 +240,22 @@ PRIVATE void resume(void)
         }
         break;
 
+    case READING_HASH_SECTOR:
+        this->state = WRITING_HASH_SECTOR;
+        sd_admin.buf[this->d_idx] = name_hash(this->headp->bname);
+        sae_WRITE_SSD(this->info.ssd,
+                ZONE_SECTORS(this->myno.i_zone) + DIR_HASH_SECTOR,
+                                                      sd_admin.buf);
+        break;
+
+    case WRITING_HASH_SECTOR:
+        /* read the dirent's sector again */
+        this->state = READING_PARENT_SECTOR;
+        sae_READ_SSD(this->info.ssd,
+                   ZONE_SECTORS(this->myno.i_zone) + this->sector_nr,
+                                                      sd_admin.buf);
+        break;
+
     case WRITING_PARENT_SECTOR:
         this->state = IDLE;
         sae_PUT_INODE(this->info.ino, this->headp->cwd, &this->myno,
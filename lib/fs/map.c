@@ -32,9 +32,18 @@
 /* A bitmap server.
  * Accepts alloc and free requests for inode and zone bitmaps.
  *
+ * The runs of free bytes in the zone bitmap, i.e. of 8 free zones, are
+ * summarised as up to NR_EXTENTS extents, the largest ones. A multiple zone
+ * allocation takes the smallest extent that fits, without walking the
+ * bitmap, and the extents are kept up to date as zones are allocated and
+ * freed. The bitmap is only walked if no extent fits and some free runs
+ * were left out of the summary. The summary is made by a SURVEY, which
+ * MOUNT requests, or on the next use of the bitmap after map_invalidate().
+ *
  * This task always uses sd_admin.buf.
  */
 #include <avr/io.h>
+#include <string.h>
 
 #include "sys/defs.h"
 #include "sys/msg.h"
@@ -47,6 +56,8 @@
 #define SELF MAP
 #define this map
 
+#define NR_EXTENTS 8
+
 typedef enum {
     IDLE = 0,
     SCANNING_BITMAP,
@@ -54,15 +65,27 @@ typedef enum {
     FREEING_BIT,
     READING_BIT,
     FREEING_CHUNK,
-    WRITING_FREED_CHUNK
+    WRITING_FREED_CHUNK,
+    SURVEYING_BITMAP
 } __attribute__ ((packed)) state_t;
 
+typedef struct {
+    ushort_t start;           /* zone bitmap byte, i.e. zone / 8 */
+    ushort_t len;             /* bytes */
+} extent_t;
+
 typedef struct {
     state_t state;
+    unsigned surveyed : 1;    /* the extents match the zone bitmap */
+    unsigned complete : 1;    /* every free run of bytes is an extent */
     map_info *headp;
     ushort_t cur_sector;
     ushort_t sector_ofs;
     ushort_t span;
+    ushort_t free_zones;      /* at the last survey */
+    ushort_t free_runs;       /* runs of free zones at the last survey */
+    uchar_t n_ext;
+    extent_t ext[NR_EXTENTS];
     union {
         ssd_info ssd;
     } info;
@@ -75,6 +98,12 @@ static map_t this;
 PRIVATE void start_job(void);
 PRIVATE void resume(void);
 PRIVATE uchar_t lowest_zero_idx(uchar_t x);
+PRIVATE ushort_t zmap_bytes(void);
+PRIVATE void survey(void);
+PRIVATE void add_extent(ushort_t start, ushort_t len);
+PRIVATE extent_t *best_fit(ushort_t span);
+PRIVATE void take_byte(ushort_t i);
+PRIVATE void give_bytes(ushort_t start, ushort_t len);
 
 PUBLIC uchar_t receive_map(message *m_ptr)
 {
@@ -154,7 +183,7 @@ PRIVATE void start_job(void)
         } else {
             this.state = FREEING_CHUNK;
             this.cur_sector += this.headp->bit_number >> BITS_PER_BLOCK_SHIFT;
-            this.sector_ofs = (this.headp->bit_number & BLOCK_SIZE_MASK) >>
+            this.sector_ofs = (this.headp->bit_number & BITS_PER_BLOCK_MASK) >>
                                                      BITS_PER_BYTE_SHIFT;
             this.span = (this.headp->nr_bits >> BITS_PER_BYTE_SHIFT) +
                           ((this.headp->nr_bits & BITS_PER_BYTE_MASK) ? 1 : 0); 
@@ -162,6 +191,11 @@ PRIVATE void start_job(void)
         }
         break;
 
+    case SURVEY_BIT:
+        this.state = SURVEYING_BITMAP;
+        sae_READ_SSD(this.info.ssd, this.cur_sector, sd_admin.buf);
+        break;
+
     default:
         send_REPLY_RESULT(SELF, EINVAL);
         break;
@@ -196,7 +230,14 @@ PRIVATE void resume(void)
              */
             this.state = IDLE;
             uchar_t n = lowest_zero_idx(sd_admin.buf[i]);
+            uchar_t was_free = (sd_admin.buf[i] == 0x00);
             sd_admin.buf[i] |= 1 << n;
+            if (this.headp->type == ZMAP) {
+                if (!this.surveyed)
+                    survey();
+                else if (was_free)
+                    take_byte(i);
+            }
             this.headp->bit_number =
                           ((this.sector_ofs + i) << BITS_PER_BYTE_SHIFT) + n;
             this.headp->nr_bits = 1;
@@ -215,8 +256,36 @@ PRIVATE void resume(void)
         break;
 
     case PERUSING_BITMAP:
+        if (this.headp->type == ZMAP) {
+            extent_t *ep;
+            if (!this.surveyed)
+                survey();
+            if ((ep = best_fit(this.span)) != NULL) {
+                for (j = 0; j < this.span; j++) {
+                    if (sd_admin.buf[ep->start + j])
+                        break;
+                }
+                if (j == this.span) {
+                    /* a lookup rather than a walk */
+                    this.state = IDLE;
+                    memset(sd_admin.buf + ep->start, 0xFF, this.span);
+                    this.headp->bit_number = ep->start << BITS_PER_BYTE_SHIFT;
+                    ep->start += this.span;
+                    if ((ep->len -= this.span) == 0)
+                        *ep = this.ext[--this.n_ext];
+                    sae_WRITE_SSD(this.info.ssd, this.cur_sector, sd_admin.buf);
+                    break;
+                }
+                /* the bitmap has changed under the summary */
+                survey();
+            } else if (this.complete) {
+                send_REPLY_RESULT(SELF, ENOSPC);
+                break;
+            }
+        }
         j = 0;
-        for (i = 0; i < BLOCK_SIZE; i++) {
+        k = (this.headp->type == ZMAP) ? zmap_bytes() : BLOCK_SIZE;
+        for (i = 0; i < k; i++) {
             if (sd_admin.buf[i] == 0x00) {
                 if (j == 0) {
                     start = i;
@@ -229,6 +298,8 @@ PRIVATE void resume(void)
                     }
                     this.headp->bit_number =
                                (this.sector_ofs + start) << BITS_PER_BYTE_SHIFT;
+                    if (this.headp->type == ZMAP)
+                        survey();
                     sae_WRITE_SSD(this.info.ssd, this.cur_sector, sd_admin.buf);
                     break;
                 }
@@ -237,9 +308,8 @@ PRIVATE void resume(void)
             }
         }
         if (this.state == PERUSING_BITMAP) {
-            this.cur_sector++;
-            this.sector_ofs += BLOCK_SIZE;
-            sae_READ_SSD(this.info.ssd, this.cur_sector, sd_admin.buf);
+            /* there is only one bitmap sector */
+            send_REPLY_RESULT(SELF, ENOSPC);
         }
         break;
 
@@ -251,6 +321,12 @@ PRIVATE void resume(void)
         shift = this.headp->bit_number & BITS_PER_BYTE_MASK;
         if (sd_admin.buf[i] & _BV(shift)) {
             sd_admin.buf[i] &= ~_BV(shift);
+            if (this.headp->type == ZMAP) {
+                if (!this.surveyed)
+                    survey();
+                else if (sd_admin.buf[i] == 0x00)
+                    give_bytes(i, 1);
+            }
             sae_WRITE_SSD(this.info.ssd, this.cur_sector, sd_admin.buf);
         } else {
             send_REPLY_RESULT(SELF, EBADSLT);
@@ -276,12 +352,19 @@ PRIVATE void resume(void)
          * If the are more bytes to zero, request the next sector;
          * otherwise set the state to IDLE and sent a note to self.
          */
+        j = MIN(this.span, BLOCK_SIZE - this.sector_ofs);
         for (i = this.sector_ofs; i < BLOCK_SIZE; i++) {
             sd_admin.buf[i] = 0;
             if (--this.span == 0) {
                 break;
             }
         }
+        if (this.headp->type == ZMAP) {
+            if (!this.surveyed)
+                survey();
+            else
+                give_bytes(this.sector_ofs, j);
+        }
 
         this.state = this.span ? WRITING_FREED_CHUNK : IDLE;
         sae_WRITE_SSD(this.info.ssd, this.cur_sector, sd_admin.buf);
@@ -293,7 +376,154 @@ PRIVATE void resume(void)
         this.cur_sector++;
         sae_READ_SSD(this.info.ssd, this.cur_sector, sd_admin.buf);
         break;
+
+    case SURVEYING_BITMAP:
+        this.state = IDLE;
+        if (this.headp->type == ZMAP)
+            survey();
+        send_REPLY_RESULT(SELF, EOK);
+        break;
+    }
+}
+
+/* the bytes of the zone bitmap that are within the file system */
+PRIVATE ushort_t zmap_bytes(void)
+{
+    ushort_t n = sd_meta.super.s_nzones;
+
+    return (n && n < BITS_PER_BLOCK) ? n >> BITS_PER_BYTE_SHIFT : BLOCK_SIZE;
+}
+
+/* Summarise the zone bitmap in sd_admin.buf as its largest free extents,
+ * and count the free zones and the runs of them.
+ */
+PRIVATE void survey(void)
+{
+    ushort_t limit = zmap_bytes();
+    ushort_t i;
+    ushort_t start = 0;
+    uchar_t in_run = FALSE;
+
+    this.n_ext = 0;
+    this.complete = TRUE;
+    this.free_zones = 0;
+    this.free_runs = 0;
+    for (i = 0; i < limit; i++) {
+        uchar_t x = sd_admin.buf[i];
+        if (x == 0x00 && (i == 0 || sd_admin.buf[i - 1])) {
+            start = i;
+        } else if (x && i && sd_admin.buf[i - 1] == 0x00) {
+            add_extent(start, i - start);
+        }
+        for (uchar_t b = 0; b < BITS_PER_BYTE; b++) {
+            if (x & _BV(b)) {
+                in_run = FALSE;
+            } else {
+                this.free_zones++;
+                if (!in_run)
+                    this.free_runs++;
+                in_run = TRUE;
+            }
+        }
+    }
+    if (limit && sd_admin.buf[limit - 1] == 0x00)
+        add_extent(start, limit - start);
+    this.surveyed = TRUE;
+}
+
+/* Record an extent, displacing the smallest if they are all in use. */
+PRIVATE void add_extent(ushort_t start, ushort_t len)
+{
+    extent_t *ep = this.ext;
+
+    if (this.n_ext < NR_EXTENTS) {
+        ep += this.n_ext++;
+    } else {
+        this.complete = FALSE;
+        for (extent_t *tp = this.ext; tp < this.ext + NR_EXTENTS; tp++) {
+            if (tp->len < ep->len)
+                ep = tp;
+        }
+        if (ep->len >= len)
+            return;
     }
+    ep->start = start;
+    ep->len = len;
+}
+
+/* the smallest extent of at least span bytes */
+PRIVATE extent_t *best_fit(ushort_t span)
+{
+    extent_t *bp = NULL;
+
+    for (extent_t *ep = this.ext; ep < this.ext + this.n_ext; ep++) {
+        if (ep->len >= span && (bp == NULL || ep->len < bp->len))
+            bp = ep;
+    }
+    return bp;
+}
+
+/* A single zone has been taken from the free byte i. */
+PRIVATE void take_byte(ushort_t i)
+{
+    for (extent_t *ep = this.ext; ep < this.ext + this.n_ext; ep++) {
+        if ((ushort_t)(i - ep->start) < ep->len) {
+            ushort_t end = ep->start + ep->len;
+            if ((ep->len = i - ep->start) == 0)
+                *ep = this.ext[--this.n_ext];
+            if (end - i > 1)
+                add_extent(i + 1, end - i - 1);
+            return;
+        }
+    }
+}
+
+/* The bytes from start have become free: join them to their neighbours. */
+PRIVATE void give_bytes(ushort_t start, ushort_t len)
+{
+    extent_t *ep = this.ext;
+
+    while (ep < this.ext + this.n_ext) {
+        if (ep->start + ep->len == start) {
+            start = ep->start;
+            len += ep->len;
+        } else if (start + len == ep->start) {
+            len += ep->len;
+        } else {
+            ep++;
+            continue;
+        }
+        *ep = this.ext[--this.n_ext];
+    }
+    add_extent(start, len);
+}
+
+/* Forget the summary, e.g. after MKFS has rewritten the zone bitmap. */
+PUBLIC void map_invalidate(void)
+{
+    this.surveyed = FALSE;
+}
+
+/* fragmentation statistics, for FSD, as at the last SURVEY */
+PUBLIC ushort_t map_free_zones(void)
+{
+    return this.free_zones;
+}
+
+PUBLIC ushort_t map_free_runs(void)
+{
+    return this.free_runs;
+}
+
+PUBLIC ushort_t map_largest(void)
+{
+    ushort_t n = 0;
+
+    for (extent_t *ep = this.ext; ep < this.ext + this.n_ext; ep++) {
+        if (ep->len > n)
+            n = ep->len;
+    }
+    return n << BITS_PER_BYTE_SHIFT;
 }
 
 /* fxtbook.pdf section 1.3.2 Computing the index of the lowest one */
@@ -328,4 +558,11 @@ PUBLIC void send_FREE_MAP(ProcNumber sender, map_info *cp, uchar_t type,
     cp->nr_bits = nr_bits;
     send_m3(sender, SELF, JOB, cp);
 }
+
+PUBLIC void send_SURVEY_MAP(ProcNumber sender, map_info *cp, uchar_t type)
+{
+    cp->op = SURVEY_BIT;
+    cp->type = type;
+    send_m3(sender, SELF, JOB, cp);
+}
 /* end code */
@@ -39,6 +39,7 @@
 
 #define ALLOC_BIT 1
 #define FREE_BIT 2
+#define SURVEY_BIT 3
  
 typedef struct _map_info {
     struct _map_info *nextp;   
@@ -66,12 +67,25 @@ PUBLIC void send_FREE_MAP (
     ushort_t nr_bits
 );
 
+PUBLIC void send_SURVEY_MAP (
+    ProcNumber sender,
+    map_info *cp,
+    uchar_t type
+);
+
+/* the zone bitmap's free space, as at the last SURVEY */
+PUBLIC ushort_t map_free_zones(void);
+PUBLIC ushort_t map_free_runs(void);
+PUBLIC ushort_t map_largest(void);
+PUBLIC void map_invalidate(void);
+
 /* convenience macros insert SELF in the sender arg. */
 
 #define sae_ALLOC_IMAP(a,b)     send_ALLOC_MAP(SELF, &(a),IMAP,(b))
 #define sae_ALLOC_ZMAP(a,b)     send_ALLOC_MAP(SELF, &(a),ZMAP,(b))
 #define sae_FREE_IMAP(a,b,c)    send_FREE_MAP(SELF, &(a),IMAP,(b),(c))
 #define sae_FREE_ZMAP(a,b,c)    send_FREE_MAP(SELF, &(a),ZMAP,(b),(c))
+#define sae_SURVEY_ZMAP(a)      send_SURVEY_MAP(SELF, &(a),ZMAP)
 
 #else /* _MAIN_ */
 
@@ -58,5 +58,15 @@ typedef struct {
     uchar_t    mbrSig1;
 } mbr_t;
 
+/* Byte offsets into an mbr sector, for reading it where the structures
+ * above, being laid out for a 32 bit long, would not match it.
+ */
+#define MBR_PART_OFFSET    446
+#define MBR_SIG_OFFSET     510
+#define PART_ENTRY_SIZE    16
+#define PART_TYPE_OFFSET   4
+#define PART_FIRST_OFFSET  8
+#define PART_TOTAL_OFFSET  12
+
 #endif /* _MBR_H_ */
 
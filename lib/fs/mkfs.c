@@ -48,6 +48,8 @@
 #include "fs/sfa.h"
 #include "fs/mbr.h"
 #include "fs/sdc.h"
+#include "fs/ino.h"
+#include "fs/map.h"
 #include "fs/fsd.h"
 #include "fs/mkfs.h"
 
@@ -66,16 +68,13 @@ typedef enum {
     WRITING_ROOT_DIRECTORY,
     WRITING_BOOTBLOCK,
     ZEROING_IMAP,
-    ZEROING_ZMAP,
-    ZEROING_ITABLE
+    ZEROING_ZMAP
 } __attribute__ ((packed)) state_t;
 
 typedef struct {
     state_t state;
     ProcNumber replyTo;
     super_t super;
-    ushort_t down_counter;
-    ushort_t cur_sector;
     union {
         ssd_info ssd;
     } info;
@@ -117,6 +116,7 @@ PUBLIC uchar_t receive_mkfs(message *m_ptr)
                     this->info.ssd.buf = sd_admin.buf;
                     this->info.ssd.phys_sector = PARTITION_TABLE_SECTOR;
                     this->info.ssd.op = READ_SECTOR;
+                    this->info.ssd.count = 1;
                     send_JOB(SSD, &this->info.ssd);
                 } else {
                     send_REPLY_RESULT(SELF, EBUSY);
@@ -164,6 +164,8 @@ PRIVATE void resume(void)
 
     case WRITING_SUPERBLOCK:
         this->state = WRITING_ROOT_INODE;
+        ino_invalidate();
+        map_invalidate();
         memset(sd_admin.buf, '\0', sizeof(sd_admin.buf));
         inode_t *ip = (inode_t *)sd_admin.buf;
         ip++;       /* move pointer to &inode[1] */
@@ -217,17 +219,11 @@ PRIVATE void resume(void)
         break;
 
     case ZEROING_ZMAP:
-        this->state = ZEROING_ITABLE;
-        this->down_counter = NR_ITABLE_SECTORS -1;
-        this->cur_sector = ITABLE_SECTOR_NUMBER +1;
+        /* the rest of the inode table, in one multiple block write */
+        this->state = IDLE;
         memset(sd_admin.buf, '\0', sizeof(sd_admin.buf));
-        /* fallthrough */
-
-    case ZEROING_ITABLE:
-        if (--this->down_counter == 0) {
-            this->state = IDLE;
-        }
-        sae_WRITE_SSD(this->info.ssd, this->cur_sector++, sd_admin.buf);
+        sae_FILL_SSD(this->info.ssd, ITABLE_SECTOR_NUMBER + 1,
+                               NR_ITABLE_SECTORS - 1, sd_admin.buf);
         break;
     }
 }
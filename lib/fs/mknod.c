@@ -57,10 +57,15 @@ typedef enum {
     SCANNING_DIRECTORY,
     ALLOCATING_INODE,
     ALLOCATING_ZONES,
+    WRITING_DIR_HASH,
+    ALLOCATING_LOG,
+    ZEROING_LOG,
     WRITING_FIRST_SECTOR,
     WRITING_INODE,
     REFETCHING_PARENT_INODE,
     READING_PARENT_SECTOR,
+    READING_HASH_SECTOR,
+    WRITING_HASH_SECTOR,
     WRITING_PARENT_SECTOR
 } __attribute__ ((packed)) state_t;
 
@@ -70,6 +75,9 @@ typedef struct {
     inode_t myno;
     inum_t new_inum;
     ushort_t sector_nr;
+    ushort_t to_zero;     /* sectors of a new log file still to be zeroed */
+    ushort_t d_idx;       /* of the new dirent, in the hash sector */
+    uchar_t hashed;       /* the new dirent's hash has been written */
     union {
         scan_info scan;
         ino_info ino;
@@ -84,6 +92,7 @@ static mknod_t *this;
 /* I can .. */
 PRIVATE void start_job(void);
 PRIVATE void resume(void);
+PRIVATE void zero_log(void);
 
 PUBLIC uchar_t receive_mknod(message *m_ptr)
 {
@@ -171,7 +180,8 @@ PRIVATE void resume(void)
         if ((this->headp->mode & I_TYPE) == I_DIRECTORY) {
             this->state = ALLOCATING_ZONES;
         } else if ((this->headp->mode & I_TYPE) == I_REGULAR) {
-            this->state = WRITING_FIRST_SECTOR;
+            this->state = (this->headp->mode & I_LOG) ?
+                                     ALLOCATING_LOG : WRITING_FIRST_SECTOR;
         }
         sae_ALLOC_ZMAP(this->info.map, this->headp->nzones);
         break;
@@ -180,7 +190,8 @@ PRIVATE void resume(void)
         {
             this->myno.i_zone = this->info.map.bit_number;
             this->myno.i_nzones = this->info.map.nr_bits;
-            this->state = WRITING_FIRST_SECTOR;
+            this->state = (this->headp->mode & I_INDEXED) ?
+                                     WRITING_DIR_HASH : WRITING_FIRST_SECTOR;
             memset(sd_admin.buf, '\0', sizeof(sd_admin.buf));
             dir_struct *dp = (dir_struct *)sd_admin.buf;
             dp->d_inum = this->new_inum;
@@ -194,8 +205,33 @@ PRIVATE void resume(void)
         }
         break;
 
+    case WRITING_DIR_HASH:
+        /* the hash sector of a new I_INDEXED directory */
+        this->state = WRITING_FIRST_SECTOR;
+        memset(sd_admin.buf, '\0', sizeof(sd_admin.buf));
+        sd_admin.buf[0] = name_hash(".");
+        sd_admin.buf[1] = name_hash("..");
+        sae_WRITE_SSD(this->info.ssd,
+                ZONE_SECTORS(this->myno.i_zone) + DIR_HASH_SECTOR,
+                                                      sd_admin.buf);
+        break;
+
+    case ALLOCATING_LOG:
+        this->myno.i_zone = this->info.map.bit_number;
+        this->myno.i_nzones = this->info.map.nr_bits;
+        this->sector_nr = ZONE_SECTORS(this->myno.i_zone);
+        this->to_zero = ZONE_SECTORS(this->myno.i_nzones);
+        this->state = ZEROING_LOG;
+        memset(sd_admin.buf, '\0', sizeof(sd_admin.buf));
+        zero_log();
+        break;
+
+    case ZEROING_LOG:
+        zero_log();
+        break;
+
     case WRITING_FIRST_SECTOR:
-        if ((this->headp->mode & I_TYPE) == I_REGULAR) {
+        if ((this->headp->mode & (I_TYPE | I_LOG)) == I_REGULAR) {
             this->myno.i_zone = this->info.map.bit_number;
             this->myno.i_nzones = this->info.map.nr_bits;
         }
@@ -222,6 +258,7 @@ PRIVATE void resume(void)
     case REFETCHING_PARENT_INODE:
         this->state = READING_PARENT_SECTOR;
         this->sector_nr = 0;
+        this->hashed = FALSE;
         sae_READ_SSD(this->info.ssd,
                    ZONE_SECTORS(this->myno.i_zone) + this->sector_nr,
                                                       sd_admin.buf);
@@ -237,12 +274,26 @@ PRIVATE void resume(void)
                     break;
             }
             if (n == DIRENT_PER_BLOCK) {
-                if (this->sector_nr < ZONE_SECTORS(this->myno.i_nzones) -1) {
-                    this->sector_nr++;
+                ushort_t next = this->sector_nr + 1;
+                if ((this->myno.i_mode & I_INDEXED) && next == DIR_HASH_SECTOR)
+                    next++;
+                if (next < ZONE_SECTORS(this->myno.i_nzones)) {
+                    this->sector_nr = next;
                     sae_READ_SSD(this->info.ssd,
                           ZONE_SECTORS(this->myno.i_zone) + this->sector_nr,
                                                              sd_admin.buf);
+                } else {
+                    send_REPLY_RESULT(SELF, ENOSPC);
                 }
+            } else if ((this->myno.i_mode & I_INDEXED) && !this->hashed &&
+                                     this->sector_nr < DIR_HASH_SECTOR) {
+                /* enter the hash first, so no dirent is ever unindexed */
+                this->state = READING_HASH_SECTOR;
+                this->hashed = TRUE;
+                this->d_idx = (this->sector_nr << DIRENT_PER_BLOCK_SHIFT) + n;
+                sae_READ_SSD(this->info.ssd,
+                        ZONE_SECTORS(this->myno.i_zone) + DIR_HASH_SECTOR,
+                                                             sd_admin.buf);
             } else {
                 this->state = WRITING_PARENT_SECTOR;
                 dp[n].d_inum = this->new_inum;
@@ -260,6 +311,22 @@ PRIVATE void resume(void)
         }
         break;
 
+    case READING_HASH_SECTOR:
+        this->state = WRITING_HASH_SECTOR;
+        sd_admin.buf[this->d_idx] = name_hash(this->headp->bname);
+        sae_WRITE_SSD(this->info.ssd,
+                ZONE_SECTORS(this->myno.i_zone) + DIR_HASH_SECTOR,
+                                                      sd_admin.buf);
+        break;
+
+    case WRITING_HASH_SECTOR:
+        /* read the dirent's sector again */
+        this->state = READING_PARENT_SECTOR;
+        sae_READ_SSD(this->info.ssd,
+                   ZONE_SECTORS(this->myno.i_zone) + this->sector_nr,
+                                                      sd_admin.buf);
+        break;
+
     case WRITING_PARENT_SECTOR:
         this->state = IDLE;
         sae_PUT_INODE(this->info.ino, this->headp->cwd, &this->myno,
@@ -268,4 +335,20 @@ PRIVATE void resume(void)
     }
 }
 
+/* A log file's zones are zeroed, so that RWR can find the end of its
+ * data after a power loss, however much of it had been committed.
+ */
+PRIVATE void zero_log(void)
+{
+    if (this->to_zero) {
+        uchar_t n = MIN(this->to_zero, 255);
+        sae_FILL_SSD(this->info.ssd, this->sector_nr, n, sd_admin.buf);
+        this->sector_nr += n;
+        this->to_zero -= n;
+    } else {
+        this->state = WRITING_FIRST_SECTOR;
+        send_REPLY_RESULT(SELF, EOK);
+    }
+}
+
 /* end code */
@@ -44,6 +44,7 @@
 #include "fs/mbr.h"
 #include "fs/ino.h"
 #include "fs/sdc.h"
+#include "fs/map.h"
 #include "fs/mount.h"
 
 /* I am .. */
@@ -53,7 +54,8 @@
 typedef enum {
     IDLE = 0,
     AWAITING_PARTITION_TABLE,
-    AWAITING_SUPER_BLOCK
+    AWAITING_SUPER_BLOCK,
+    SURVEYING_ZMAP
 } __attribute__ ((packed)) state_t;
 
 typedef struct {
@@ -62,6 +64,7 @@ typedef struct {
     union {
         ssd_info ssd;
         ino_info ino;
+        map_info map;
     } info;
 } mount_t;
 
@@ -97,6 +100,7 @@ PUBLIC uchar_t receive_mount(message *m_ptr)
         this.info.ssd.buf = sd_admin.buf;
         this.info.ssd.phys_sector = PARTITION_TABLE_SECTOR;
         this.info.ssd.op = READ_SECTOR;
+        this.info.ssd.count = 1;
         send_JOB(SSD, &this.info.ssd);
         break;
 
@@ -126,8 +130,19 @@ PRIVATE void resume(void)
         break;
 
     case AWAITING_SUPER_BLOCK:
-        this.state = IDLE;
+        this.state = SURVEYING_ZMAP;
         memcpy(&sd_meta.super, sd_admin.buf, SUPER_SIZE);
+        ino_invalidate();
+        map_invalidate();
+        /* every allocation reads one of the bitmaps */
+        sdc_pin(IMAP_SECTOR_NUMBER);
+        sdc_pin(ZMAP_SECTOR_NUMBER);
+        /* so that the first multiple zone allocation need not walk it */
+        sae_SURVEY_ZMAP(this.info.map);
+        break;
+
+    case SURVEYING_ZMAP:
+        this.state = IDLE;
         send_REPLY_RESULT(SELF, EOK);
         break;
     }
@@ -33,6 +33,12 @@
  *
  * Read a portion of a file and write it to a remote buffer address.
  *
+ * Each sector is read into sd_admin.buf and the client pulls its part of
+ * it with MEMZ. A partial pull is continued from the same sector, which
+ * SDC answers from the buffer without the card.
+ *
+ * use_cache asserts that the file has not changed since the last request,
+ * so that its inode may be used again.
  */
 
 #include <string.h>
@@ -85,6 +91,7 @@ static readf_t this;
 /* I can .. */
 PRIVATE void start_job(void);
 PRIVATE void resume(void);
+PRIVATE void next_sector(void);
 
 PUBLIC uchar_t receive_readf(message *m_ptr)
 {
@@ -168,13 +175,7 @@ PRIVATE void resume(void)
             long n = this.myno.i_size - this.headp->offset;
             this.bytes_remaining = MIN(this.headp->len, n);
             this.nbytes = 0;
-            
-            this.state = READING_SECTOR;
-            this.sect_nr = BYTE_SECTOR(this.headp->offset) +
-                           ZONE_SECTORS(this.myno.i_zone);
-            this.sect_ofs = this.headp->offset & BLOCK_SIZE_MASK;
-
-            sae_READ_SSD(this.info.ssd, this.sect_nr++, sd_admin.buf);
+            next_sector();
         } else {
             /* no data to output */
             this.state = IDLE;
@@ -185,28 +186,36 @@ PRIVATE void resume(void)
         break;
 
     case READING_SECTOR:
+        {
+            ushort_t len = BLOCK_SIZE - this.sect_ofs;
+            len = MIN(this.bytes_remaining, len);
+            this.msg.memp.request.len = len;
+        }
         this.state = WRITING_OUTPUT;
         this.msg.memp.request.taskid = SELF;
         this.msg.memp.request.jobref = &this.info.twi;
         this.msg.memp.request.sender_addr = HOST_ADDRESS;
         this.msg.memp.request.src = sd_admin.buf + this.sect_ofs;
         this.msg.memp.request.dst = this.headp->dst;
-        this.msg.memp.request.len = MIN(this.bytes_remaining,
-                                   BLOCK_SIZE - this.sect_ofs);
         sae2_TWI_MTSR(this.info.twi, this.headp->sender_addr,
               MEMP_REQUEST, this.msg.memp.request,
               MEMP_REPLY, this.msg.memp.reply);
         break;
 
     case WRITING_OUTPUT:
-        this.bytes_remaining -= this.msg.memp.reply.count;
-        this.headp->dst += this.msg.memp.reply.count;
-        this.nbytes += this.msg.memp.reply.count;
-        this.headp->offset += this.msg.memp.reply.count;
-        this.sect_ofs = this.headp->offset & BLOCK_SIZE_MASK;
+        if (this.msg.memp.reply.count == 0) {
+            /* the client will take no more, so end the request short */
+            this.bytes_remaining = 0;
+        } else {
+            ushort_t count = MIN(this.msg.memp.reply.count,
+                                 this.msg.memp.request.len);
+            this.bytes_remaining -= count;
+            this.headp->dst += count;
+            this.nbytes += count;
+            this.headp->offset += count;
+        }
         if (this.bytes_remaining) {
-            this.state = READING_SECTOR;
-            sae_READ_SSD(this.info.ssd, this.sect_nr++, sd_admin.buf);
+            next_sector();
         } else {
             this.state = IDLE;
             this.headp->len = this.nbytes;
@@ -216,4 +225,16 @@ PRIVATE void resume(void)
     }
 }
 
+/* Read the sector that holds the offset, which is the one just pulled
+ * from if the pull was partial.
+ */
+PRIVATE void next_sector(void)
+{
+    this.state = READING_SECTOR;
+    this.sect_nr = BYTE_SECTOR(this.headp->offset) +
+                   ZONE_SECTORS(this.myno.i_zone);
+    this.sect_ofs = this.headp->offset & BLOCK_SIZE_MASK;
+    sae_READ_SSD(this.info.ssd, this.sect_nr, sd_admin.buf);
+}
+
 /* end code */
@@ -36,12 +36,29 @@
  * This requires exclusive access to the sd_datum.buf for the entire
  * operation, not merely the processing of an individual message.
  *
+ * A sector is read before the remote data is pulled into it only if it
+ * holds file data that the fragment does not replace, so an append to a
+ * new sector or a whole sector is not read first.
+ *
+ * An I_LOG file that is appended to (SEEK_END, without truncate) is kept
+ * open between requests, with its inode in myno. Each append writes its
+ * sectors through, and SDC answers the next append's read of the partly
+ * filled tail sector from sd_datum.buf. Only i_size waits, to be committed
+ * LOG_COMMIT_DELAY ms after the last append, and before any other request
+ * is served. Before each append and each commit the inode is fetched
+ * again, from INO's cache as a rule, and a log that has been removed or
+ * changed meanwhile is opened afresh, or its commit dropped. On opening a
+ * log, the data appended since its last commit is recovered by scanning
+ * from i_size to the last nonzero byte; MKNOD zeroes a log's zones as it
+ * makes it, and so does a truncate here.
  */
 
 #include <string.h>
+#include <time.h>
 
 #include "sys/defs.h"
 #include "sys/msg.h"
+#include "sys/utc.h"
 #include "net/i2c.h"
 #include "net/twi.h"
 #include "net/memz.h"
@@ -50,36 +67,68 @@
 #include "fs/sdc.h"
 #include "fs/ino.h"
 #include "fs/rwr.h"
+#include "sys/clk.h"
 
 /* I am .. */
 #define SELF RWR
 #define this rwr
 
+#ifndef LOG_COMMIT_DELAY
+#define LOG_COMMIT_DELAY 2000   /* ms from the last append to a commit */
+#endif
+
 typedef enum {
     IDLE = 0,
     ENSLAVED,
     READING_INODE,
-    READING_SECTOR,
-    FETCHING_DATA,
-    WRITING_SECTOR,
-    WRITING_LAST_SECTOR,
+    CHECKING_LOG,
+    TRUNCATING_LOG,
+    ZEROING_LOG,
+    RECOVERING_TAIL,
+    WRITING_FILE,
     WRITING_INODE,
     SENDING_REPLY
 }  __attribute__ ((packed))  state_t;
 
+typedef struct {
+    uchar_t *buf;
+    unsigned busy : 1;      /* being written to the card */
+    ssd_info ssd;
+} rw_block;
+
+typedef struct {
+    inum_t inum;            /* of the open log file, or 0 */
+    off_t size;             /* its i_size on the card */
+    unsigned size_dirty : 1;  /* myno.i_size is not yet on the card */
+} log_t;
+
 typedef struct {
     state_t state;
+    unsigned reading : 1;   /* the current block is being read */
+    unsigned pulling : 1;   /* the remote data is being pulled into it */
+    unsigned done : 1;      /* no more data is to be pulled */
+    unsigned committing : 1;  /* the log is being committed */
+    unsigned putting : 1;   /* its inode, having been checked */
+    unsigned closing : 1;   /* and then closed */
+    unsigned pending : 1;   /* a request waits for the commit */
+    unsigned armed : 1;     /* a commit alarm is set */
+    uchar_t result;         /* of the first transfer to fail */
     ushort_t sect;
     ushort_t frag;
     ushort_t n_written;
+    ushort_t to_zero;       /* sectors of a truncated log still to zero */
+    ulong_t started;        /* uptime ticks as the request arrived */
     inode_t myno;
+    rw_block block;
+    log_t log;
     rwr_msg sm;  /* service message */
     union {
         memz_msg memz;
+        inode_t check;      /* the open log's inode as on the card */
     } msg;
+    ino_info ino;  /* apart from twi, which listens while a log commits */
+    clk_info clk;
     union {
-        ssd_info ssd;
-        ino_info ino;
         twi_info twi;
     } info;
 } rwr_t;
@@ -90,6 +139,18 @@ static rwr_t this;
 /* I can .. */
 PRIVATE void start_job(void);
 PRIVATE void resume(void);
+PRIVATE void begin_write(void);
+PRIVATE void zero_log(void);
+PRIVATE void recover(void);
+PRIVATE void open_log(void);
+PRIVATE bool_t unchanged(void);
+PRIVATE void commit(uchar_t result);
+PRIVATE void arm(void);
+PRIVATE void fill(void);
+PRIVATE void pull(void);
+PRIVATE void pulled(void);
+PRIVATE void transferred(ssd_info *ip, uchar_t result);
+PRIVATE void drain(void);
 PRIVATE void get_request(void);
 PRIVATE void send_reply(uchar_t result);
 
@@ -100,19 +161,47 @@ PUBLIC uchar_t receive_rwr(message *m_ptr)
     case REPLY_RESULT:
         if (this.state == ENSLAVED && m_ptr->sender == TWI) {
             if (m_ptr->RESULT == EOK) {
+                this.started = get_uptime_ticks();
                 start_job();
             } else {
                 get_request();
             }
+        } else if (this.state == ENSLAVED && this.committing) {
+            commit(m_ptr->RESULT);
+        } else if (this.state == WRITING_FILE) {
+            if (m_ptr->sender == SSD) {
+                transferred(m_ptr->INFO, m_ptr->RESULT);
+            } else if (m_ptr->RESULT == EOK) {
+                pulled();
+            } else {
+                this.pulling = FALSE;
+                this.result = m_ptr->RESULT;
+                drain();
+            }
+        } else if (this.state >= READING_INODE &&
+                   this.state <= WRITING_INODE && m_ptr->RESULT != EOK) {
+            send_reply(m_ptr->RESULT);
         } else if (this.state) {
             resume();
         }
         break;
 
+    case ALARM:
+        this.armed = FALSE;
+        if (this.log.size_dirty) {
+            if (this.state == ENSLAVED && !this.committing) {
+                commit(EOK);
+            } else {
+                arm();
+            }
+        }
+        break;
+
     case INIT:
         {
             uchar_t result = EBUSY;
             if (this.state == IDLE) {
+                this.block.buf = sd_datum.buf;
                 get_request();
                 result = EOK;
             }
@@ -128,8 +217,31 @@ PUBLIC uchar_t receive_rwr(message *m_ptr)
 
 PRIVATE void start_job(void)
 {
+    if (this.committing) {
+        this.pending = TRUE;
+        return;
+    }
+
+    this.n_written = 0;
+    if (this.log.inum) {
+        if (this.log.inum == this.sm.request.inum &&
+                this.sm.request.whence == SEEK_END &&
+               !this.sm.request.truncate) {
+            /* an append to the open log, if it is still as it was */
+            this.state = CHECKING_LOG;
+            sae_GET_INODE(this.ino, this.log.inum,
+                               &this.msg.check, sd_datum.buf);
+        } else {
+            /* myno and sd_datum are needed for this request */
+            this.closing = TRUE;
+            this.pending = TRUE;
+            commit(EOK);
+        }
+        return;
+    }
+
     this.state = READING_INODE;
-    sae_GET_INODE(this.info.ino, this.sm.request.inum,
+    sae_GET_INODE(this.ino, this.sm.request.inum,
                        &this.myno, sd_datum.buf);
 }
 
@@ -138,6 +250,7 @@ PRIVATE void resume(void)
     switch (this.state) {
     case IDLE:
     case ENSLAVED:
+    case WRITING_FILE:
         break;
 
     case READING_INODE:
@@ -150,69 +263,58 @@ PRIVATE void resume(void)
             this.myno.i_size = 0;
         }
 
-        if (this.sm.request.whence == SEEK_END) {
-            this.sm.request.offset += this.myno.i_size;
-        }
-
-        if (BYTE_ZONE(this.sm.request.offset + this.sm.request.len) <
-                                            this.myno.i_nzones) {
-            this.state = READING_SECTOR;
-            this.sect = ZONE_SECTORS(this.myno.i_zone) +
-                                        BYTE_SECTOR(this.sm.request.offset);
-            sae_READ_SSD(this.info.ssd, this.sect, sd_datum.buf);
-        } else {
-           /* Not enough space available to hold the complete message.
-            * Inform the caller.
-            */
-            send_reply(EXFULL);
+        if ((this.myno.i_mode & (I_TYPE | I_LOG)) == (I_REGULAR | I_LOG)) {
+            this.log.size = this.myno.i_size;
+            if (this.sm.request.truncate) {
+                /* the new size is on the card before the zeros */
+                this.state = TRUNCATING_LOG;
+                sae_PUT_INODE(this.ino, this.myno.i_inum,
+                                   &this.myno, sd_datum.buf);
+                break;
+            } else if (this.sm.request.whence == SEEK_END) {
+                this.state = RECOVERING_TAIL;
+                this.sect = ZONE_SECTORS(this.myno.i_zone) +
+                                       BYTE_SECTOR(this.myno.i_size);
+                if (BYTE_ZONE(this.myno.i_size) < this.myno.i_nzones) {
+                    sae_READ_SSD(this.block.ssd, this.sect, sd_datum.buf);
+                } else {
+                    /* full, so every append will fail */
+                    open_log();
+                    begin_write();
+                }
+                break;
+            }
         }
+        begin_write();
         break;
 
-    case READING_SECTOR:
-        {
-            this.state = FETCHING_DATA;
-            ushort_t ofs = this.sm.request.offset & BLOCK_SIZE_MASK;
-            this.frag = MIN(BLOCK_SIZE - ofs, this.sm.request.len);
-            if (this.frag) {
-                this.msg.memz.request.src = this.sm.request.src;
-                this.msg.memz.request.len = this.frag;
-                sae1_TWI_MTMR(this.info.twi, this.sm.request.sender_addr,
-                        MEMZ_REQUEST,
-                       &this.msg.memz.request, sizeof(this.msg.memz.request),
-                        sd_datum.buf + ofs, this.frag);
-            } else {
-                send_REPLY_RESULT(SELF, EOK);
-            }
+    case CHECKING_LOG:
+        if (unchanged()) {
+            begin_write();
+        } else {
+            /* removed or changed meanwhile, so open it afresh */
+            this.log.inum = 0;
+            this.log.size_dirty = FALSE;
+            memcpy(&this.myno, &this.msg.check, INODE_SIZE);
+            this.state = READING_INODE;
+            resume();
         }
         break;
 
-    case FETCHING_DATA:
-       {
-            /* MEMZ has inserted data into sd_datum.buf */
-            ushort_t n = this.frag - this.info.twi.rcnt; 
-            this.sm.request.offset += n;
-            this.n_written += n;
-            if (this.myno.i_size < this.sm.request.offset)
-                this.myno.i_size = this.sm.request.offset;
-            this.sm.request.src += n;
-            this.sm.request.len -= n;
-
-            this.state = this.sm.request.len ?
-                                 WRITING_SECTOR : WRITING_LAST_SECTOR;
-
-            sae_WRITE_SSD(this.info.ssd, this.sect, sd_datum.buf);
-        }
+    case TRUNCATING_LOG:
+        this.state = ZEROING_LOG;
+        this.sect = ZONE_SECTORS(this.myno.i_zone);
+        this.to_zero = ZONE_SECTORS(this.myno.i_nzones);
+        memset(sd_datum.buf, 0, BLOCK_SIZE);
+        zero_log();
         break;
 
-    case WRITING_SECTOR:
-        this.state = READING_SECTOR;
-        sae_READ_SSD(this.info.ssd, this.sect++, sd_datum.buf);
+    case ZEROING_LOG:
+        zero_log();
         break;
 
-    case WRITING_LAST_SECTOR:
-        this.state = WRITING_INODE;
-        sae_PUT_INODE(this.info.ino, this.myno.i_inum,
-                       &this.myno, sd_datum.buf);
+    case RECOVERING_TAIL:
+        recover();
         break;
 
     case WRITING_INODE:
@@ -225,6 +327,268 @@ PRIVATE void resume(void)
     }
 }
 
+PRIVATE void begin_write(void)
+{
+    if (this.sm.request.whence == SEEK_END) {
+        this.sm.request.offset += this.myno.i_size;
+    }
+
+    if (BYTE_ZONE(this.sm.request.offset + this.sm.request.len) <
+                                        this.myno.i_nzones) {
+        this.state = WRITING_FILE;
+        this.reading = FALSE;
+        this.pulling = FALSE;
+        this.done = FALSE;
+        this.result = EOK;
+        if (this.sm.request.len) {
+            fill();
+        } else {
+            drain();
+        }
+    } else {
+       /* Not enough space available to hold the complete message.
+        * Inform the caller.
+        */
+        send_reply(EXFULL);
+    }
+}
+
+/* Zero the zones of a truncated log, then open it. */
+PRIVATE void zero_log(void)
+{
+    if (this.to_zero) {
+        uchar_t n = MIN(this.to_zero, 255);
+        sae_FILL_SSD(this.block.ssd, this.sect, n, sd_datum.buf);
+        this.sect += n;
+        this.to_zero -= n;
+    } else {
+        open_log();
+        begin_write();
+    }
+}
+
+/* The tail sector of a log is in sd_datum.buf. Data appended since the
+ * last commit runs on from i_size to the last nonzero byte, and into the
+ * next sector if this one is full.
+ */
+PRIVATE void recover(void)
+{
+    off_t base = (off_t)(this.sect - ZONE_SECTORS(this.myno.i_zone))
+                                                   << BLOCK_SIZE_SHIFT;
+    ushort_t n = BLOCK_SIZE;
+
+    while (n && sd_datum.buf[n - 1] == 0)
+        n--;
+    if (base + n > this.myno.i_size) {
+        this.myno.i_size = base + n;
+        this.log.size_dirty = TRUE;
+    }
+    if (n == BLOCK_SIZE && BYTE_ZONE(this.myno.i_size) < this.myno.i_nzones) {
+        this.sect++;
+        sae_READ_SSD(this.block.ssd, this.sect, sd_datum.buf);
+    } else {
+        open_log();
+        begin_write();
+    }
+}
+
+/* Keep myno for the next append. */
+PRIVATE void open_log(void)
+{
+    this.log.inum = this.myno.i_inum;
+}
+
+/* Is the open log's inode on the card, in msg.check, as RWR left it? An
+ * unlink zeroes it, and a chmod or link gives it a new mtime.
+ */
+PRIVATE bool_t unchanged(void)
+{
+    inode_t *ip = &this.msg.check;
+
+    return ip->i_mode == this.myno.i_mode &&
+           ip->i_nlinks == this.myno.i_nlinks &&
+           ip->i_mtime == this.myno.i_mtime &&
+           ip->i_zone == this.myno.i_zone &&
+           ip->i_nzones == this.myno.i_nzones &&
+           ip->i_size == this.log.size;
+}
+
+/* Check the log's inode on the card, then write its i_size. A reply from
+ * INO brings RWR back here with its result. A log removed or changed
+ * meanwhile is closed without a write, and a write that fails is tried
+ * again later; when closing it is given up, as the next open recovers
+ * the size from the data.
+ */
+PRIVATE void commit(uchar_t result)
+{
+    if (!this.committing) {
+        this.committing = TRUE;
+        if (this.log.size_dirty) {
+            sae_GET_INODE(this.ino, this.log.inum,
+                               &this.msg.check, sd_datum.buf);
+            return;
+        }
+    } else if (this.putting) {
+        this.putting = FALSE;
+        if (result == EOK) {
+            this.log.size = this.myno.i_size;
+            this.log.size_dirty = FALSE;
+        }
+    } else if (result == EOK && unchanged()) {
+        this.putting = TRUE;
+        sae_PUT_INODE(this.ino, this.myno.i_inum, &this.myno, sd_datum.buf);
+        return;
+    } else if (result == EOK) {
+        this.closing = TRUE;
+    }
+
+    this.committing = FALSE;
+    if (this.closing) {
+        this.closing = FALSE;
+        this.log.inum = 0;
+        this.log.size_dirty = FALSE;
+    } else if (this.log.size_dirty) {
+        arm();
+    }
+    if (this.pending) {
+        this.pending = FALSE;
+        start_job();
+    }
+}
+
+PRIVATE void arm(void)
+{
+    if (!this.armed) {
+        this.armed = TRUE;
+        sae_CLK_SET_ALARM(this.clk, LOG_COMMIT_DELAY);
+    }
+}
+
+/* Make the block ready for the next fragment, once it has been
+ * written out, reading its sector first if the fragment does not replace
+ * all of the file data in it.
+ */
+PRIVATE void fill(void)
+{
+    rw_block *bp = &this.block;
+    ushort_t ofs = this.sm.request.offset & BLOCK_SIZE_MASK;
+    off_t base = this.sm.request.offset - ofs;
+
+    if (bp->busy)
+        return;
+
+    this.sect = ZONE_SECTORS(this.myno.i_zone) +
+                               BYTE_SECTOR(this.sm.request.offset);
+    this.frag = BLOCK_SIZE - ofs;
+    this.frag = MIN(this.frag, this.sm.request.len);
+    if (this.frag < BLOCK_SIZE && base < this.myno.i_size) {
+        /* SDC has an open log's tail sector still in sd_datum.buf */
+        this.reading = TRUE;
+        sae_READ_SSD(bp->ssd, this.sect, bp->buf);
+    } else {
+        /* nothing to keep, and a hole reads as zeros */
+        if (this.frag < BLOCK_SIZE)
+            memset(bp->buf, 0, BLOCK_SIZE);
+        pull();
+    }
+}
+
+PRIVATE void pull(void)
+{
+    rw_block *bp = &this.block;
+
+    this.pulling = TRUE;
+    sdc_dirty(bp->buf);
+    this.msg.memz.request.src = this.sm.request.src;
+    this.msg.memz.request.len = this.frag;
+    sae1_TWI_MTMR(this.info.twi, this.sm.request.sender_addr,
+            MEMZ_REQUEST,
+           &this.msg.memz.request, sizeof(this.msg.memz.request),
+            bp->buf + (this.sm.request.offset & BLOCK_SIZE_MASK), this.frag);
+}
+
+/* MEMZ has inserted data into the block: write it out, and move on to
+ * the next fragment once it has been written.
+ */
+PRIVATE void pulled(void)
+{
+    rw_block *bp = &this.block;
+    ushort_t n = this.frag - this.info.twi.rcnt;
+
+    this.pulling = FALSE;
+    this.sm.request.offset += n;
+    this.n_written += n;
+    if (this.myno.i_size < this.sm.request.offset) {
+        this.myno.i_size = this.sm.request.offset;
+        if (this.log.inum)
+            this.log.size_dirty = TRUE;
+    }
+    this.sm.request.src += n;
+    this.sm.request.len -= n;
+
+    /* an open log's tail sector too, so that only its i_size waits */
+    bp->busy = TRUE;
+    sae_WRITE_SSD(bp->ssd, this.sect, bp->buf);
+
+    if (n == 0) {
+        this.result = EIO;
+        drain();
+    } else if (this.sm.request.len == 0) {
+        drain();
+    } else {
+        fill();
+    }
+}
+
+/* SSD has read or written the block. */
+PRIVATE void transferred(ssd_info *ip, uchar_t result)
+{
+    rw_block *bp = &this.block;
+
+    if (result != EOK && !this.result)
+        this.result = result;
+
+    if (ip->op == READ_SECTOR) {
+        this.reading = FALSE;
+        if (this.result) {
+            drain();
+        } else {
+            pull();
+        }
+    } else {
+        bp->busy = FALSE;
+        if (this.done) {
+            drain();
+        } else if (!this.reading && !this.pulling) {
+            fill();
+        }
+    }
+}
+
+/* Once the block has been written, update the inode and reply. An open
+ * log's inode waits for the commit.
+ */
+PRIVATE void drain(void)
+{
+    this.done = TRUE;
+    if (this.reading || this.pulling)
+        return;
+    if (this.block.busy)
+        return;
+    if (this.log.size_dirty)
+        arm();
+    if (this.result) {
+        send_reply(this.result);
+    } else if (this.log.inum) {
+        send_reply(EOK);
+    } else {
+        this.state = WRITING_INODE;
+        /* sd_datum is not used again until the next GET */
+        sae_UPDATE_INODE(this.ino, this.myno.i_inum,
+                       &this.myno, sd_datum.buf);
+    }
+}
+
 PRIVATE void get_request(void)
 {
     this.state = ENSLAVED;
@@ -235,6 +599,7 @@ PRIVATE void get_request(void)
 PRIVATE void send_reply(uchar_t result)
 {
     off_t fpos = this.sm.request.offset;
+    ulong_t ticks = get_uptime_ticks() - this.started;
     this.state = SENDING_REPLY;
     hostid_t reply_address = this.sm.request.sender_addr;
     this.sm.reply.sender_addr = HOST_ADDRESS;
@@ -242,6 +607,7 @@ PRIVATE void send_reply(uchar_t result)
     /* inform the client of the current file position */
     this.sm.reply.fpos = fpos;
     this.sm.reply.nbytes = this.n_written;
+    this.sm.reply.millis = (ticks >> 8) * 1000 + FRAC_TO_MILLIS(ticks & 0xff);
     sae2_TWI_MT(this.info.twi, reply_address, RWR_REPLY, this.sm.reply);
 }
 
@@ -54,12 +54,13 @@ typedef struct {
     off_t fpos;
     ushort_t nbytes;
     uchar_t result;
+    ulong_t millis;        /* time taken on the file server */
 } rwr_reply;
 
 typedef union {
     rwr_request request;
     rwr_reply reply;
-} rwr_msg;                         /* 15 bytes */
+} rwr_msg;                         /* 17 bytes */
 
 #else /* _MAIN_ */
 
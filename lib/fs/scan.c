@@ -36,6 +36,12 @@
  * if not found. If the headp->inum is valid, the headp->dirent_idx represents
  * the index within the directory.
  *
+ * The dirents of an I_INDEXED directory's first zone are found through
+ * its hash sector: only those sectors with a dirent of the same name hash
+ * are read. A few recent matches are remembered, keyed by directory and
+ * name hash, and are checked against the dirent itself before use, so
+ * that a stale one costs a read but is never wrong.
+ *
  * This task always uses sd_admin.buf.
  */
 
@@ -52,16 +58,31 @@
 #define SELF SCAN
 #define this scan
 
+#define NR_DENTRIES 8
+
 typedef enum {
     IDLE = 0,
-    READING_SECTOR
+    READING_SECTOR,
+    READING_CACHED,
+    READING_HASH_SECTOR,
+    READING_CANDIDATE
 } __attribute__ ((packed)) state_t;
 
+typedef struct {
+    inum_t dir;               /* directory inode number, 0 if free */
+    ushort_t idx;             /* dirent index */
+    uchar_t hash;             /* name_hash() of the dirent name */
+} dentry_t;
+
 typedef struct {
     state_t state;
+    uchar_t hash;
     scan_info *headp;
     ushort_t n_items;
     ushort_t cur_sector;
+    ushort_t candidates;      /* bit per sector of the first zone */
+    uchar_t next;             /* the dentry to be replaced */
+    dentry_t dentry[NR_DENTRIES];
     union {
         ssd_info ssd;
     } info;
@@ -73,6 +94,11 @@ static scan_t this;
 /* I can .. */
 PRIVATE void start_job(void);
 PRIVATE void resume(void);
+PRIVATE void start_search(void);
+PRIVATE void next_candidate(void);
+PRIVATE uchar_t match(ushort_t first, ushort_t limit);
+PRIVATE dentry_t *find_dentry(void);
+PRIVATE void found(ushort_t idx);
 
 PUBLIC uchar_t receive_scan(message *m_ptr)
 {
@@ -116,13 +142,37 @@ PUBLIC uchar_t receive_scan(message *m_ptr)
 
 PRIVATE void start_job(void)
 {
-    /* Fetch the sector containing the first zone. */
-    this.state = READING_SECTOR;
+    dentry_t *dp;
+
     this.n_items = DIRENT_ITEMS(this.headp->ip->i_size);
     this.headp->inum = INVALID_INODE_NR;
     this.headp->dirent_idx = 0;
+    this.hash = name_hash(this.headp->namep);
+
+    if ((dp = find_dentry()) != NULL) {
+        /* Fetch the sector of the remembered match. */
+        this.state = READING_CACHED;
+        this.cur_sector = ZONE_SECTORS(this.headp->ip->i_zone) +
+                                                   DIRENT_SECTOR(dp->idx);
+        sae_READ_SSD(this.info.ssd, this.cur_sector, sd_admin.buf);
+    } else {
+        start_search();
+    }
+}
+
+PRIVATE void start_search(void)
+{
     this.cur_sector = ZONE_SECTORS(this.headp->ip->i_zone);
-    sae_READ_SSD(this.info.ssd, this.cur_sector, sd_admin.buf);
+    if (this.headp->ip->i_mode & I_INDEXED) {
+        /* Fetch the hash sector. */
+        this.state = READING_HASH_SECTOR;
+        sae_READ_SSD(this.info.ssd, this.cur_sector + DIR_HASH_SECTOR,
+                                                      sd_admin.buf);
+    } else {
+        /* Fetch the sector containing the first zone. */
+        this.state = READING_SECTOR;
+        sae_READ_SSD(this.info.ssd, this.cur_sector, sd_admin.buf);
+    }
 }
 
 PRIVATE void resume(void)
@@ -131,24 +181,59 @@ PRIVATE void resume(void)
     case IDLE:
         break;
 
+    case READING_CACHED:
+        {
+            dentry_t *dp = find_dentry();
+            dir_struct *sp = (dir_struct *)sd_admin.buf +
+                                    (dp->idx & DIRENT_PER_BLOCK_MASK);
+            if (dp->idx < this.n_items && sp->d_inum &&
+                    strncmp(this.headp->namep, sp->d_name, NAME_SIZE) == 0) {
+                this.headp->inum = sp->d_inum;
+                this.headp->dirent_idx = dp->idx;
+                this.state = IDLE;
+                send_REPLY_RESULT(SELF, EOK);
+            } else {
+                /* it has been unlinked or replaced */
+                dp->dir = INVALID_INODE_NR;
+                start_search();
+            }
+        }
+        break;
+
+    case READING_HASH_SECTOR:
+        {
+            ushort_t limit = MIN(DIR_HASH_ITEMS, this.n_items);
+            this.candidates = 0;
+            for (ushort_t i = 0; i < limit; i++) {
+                if (sd_admin.buf[i] == this.hash)
+                    this.candidates |= 1 << DIRENT_SECTOR(i);
+            }
+            next_candidate();
+        }
+        break;
+
+    case READING_CANDIDATE:
+        {
+            ushort_t first = (this.cur_sector -
+                  ZONE_SECTORS(this.headp->ip->i_zone)) << DIRENT_PER_BLOCK_SHIFT;
+            ushort_t rest = this.n_items - first;
+            if (!match(first, MIN(DIRENT_PER_BLOCK, rest)))
+                next_candidate();
+        }
+        break;
+
     case READING_SECTOR:
         {
-            dir_struct *dp = (dir_struct *)sd_admin.buf;
+            ushort_t first = this.headp->dirent_idx;
             ushort_t limit = MIN(DIRENT_PER_BLOCK, this.n_items);
             if (this.n_items < DIRENT_PER_BLOCK) {
                 this.n_items = 0;
             } else {
                 this.n_items -= DIRENT_PER_BLOCK;
             }
-            for (ushort_t i = 0; i < limit; i++, this.headp->dirent_idx++) {
-                if (dp[i].d_inum && strncmp(this.headp->namep, dp[i].d_name,
-                                                            NAME_SIZE) == 0) {
-                    this.headp->inum = dp[i].d_inum;
-                    this.state = IDLE;
-                    send_REPLY_RESULT(SELF, EOK);
-                    return;
-                }
-            }
+            this.headp->dirent_idx += limit;
+            if (match(first, limit))
+                return;
             if (this.n_items) {
                 this.cur_sector++;
                 sae_READ_SSD(this.info.ssd, this.cur_sector, sd_admin.buf);
@@ -161,4 +246,73 @@ PRIVATE void resume(void)
     }
 }
 
+/* Read the next sector of the first zone that has a dirent with the hash,
+ * then go on to any further zones one sector at a time.
+ */
+PRIVATE void next_candidate(void)
+{
+    uchar_t s;
+
+    if (this.candidates) {
+        for (s = 0; (this.candidates & (1 << s)) == 0; s++)
+            ;
+        this.candidates &= ~(1 << s);
+        this.state = READING_CANDIDATE;
+        this.cur_sector = ZONE_SECTORS(this.headp->ip->i_zone) + s;
+        sae_READ_SSD(this.info.ssd, this.cur_sector, sd_admin.buf);
+    } else if (this.n_items > ZONE_SECTORS(DIRENT_PER_BLOCK)) {
+        this.state = READING_SECTOR;
+        this.n_items -= ZONE_SECTORS(DIRENT_PER_BLOCK);
+        this.headp->dirent_idx = ZONE_SECTORS(DIRENT_PER_BLOCK);
+        this.cur_sector = ZONE_SECTORS(this.headp->ip->i_zone + 1);
+        sae_READ_SSD(this.info.ssd, this.cur_sector, sd_admin.buf);
+    } else {
+        this.state = IDLE;
+        send_REPLY_RESULT(SELF, EOK);
+    }
+}
+
+/* Compare limit dirents in sd_admin.buf, the first of which has the index
+ * first, and reply if one matches.
+ */
+PRIVATE uchar_t match(ushort_t first, ushort_t limit)
+{
+    dir_struct *dp = (dir_struct *)sd_admin.buf;
+
+    for (ushort_t i = 0; i < limit; i++) {
+        if (dp[i].d_inum && strncmp(this.headp->namep, dp[i].d_name,
+                                                    NAME_SIZE) == 0) {
+            this.headp->inum = dp[i].d_inum;
+            found(first + i);
+            this.state = IDLE;
+            send_REPLY_RESULT(SELF, EOK);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+PRIVATE dentry_t *find_dentry(void)
+{
+    for (dentry_t *dp = this.dentry; dp < this.dentry + NR_DENTRIES; dp++) {
+        if (dp->dir == this.headp->ip->i_inum && dp->hash == this.hash)
+            return dp;
+    }
+    return NULL;
+}
+
+PRIVATE void found(ushort_t idx)
+{
+    dentry_t *dp;
+
+    this.headp->dirent_idx = idx;
+    if ((dp = find_dentry()) == NULL) {
+        dp = this.dentry + this.next;
+        this.next = (this.next + 1) % NR_DENTRIES;
+    }
+    dp->dir = this.headp->ip->i_inum;
+    dp->hash = this.hash;
+    dp->idx = idx;
+}
+
 /* end code */
@@ -31,8 +31,25 @@
 
 /* Owner of two 512 byte buffers, each with a sector address and flags.
  * Common global functions are also defined here.
+ *
+ * The buffers are tagged, write-through. SSD tags a buffer with the sector
+ * that it last read into it or wrote from it, and a later READ of that
+ * sector into either buffer is answered at once without the card. There
+ * is no replacement policy: a buffer holds what its client last put there.
+ * A buffer that is being read into, or written from, is untagged until the
+ * transfer completes, and so is every other copy of a sector that is to be
+ * written. A client that changes a buffer other than on its way
+ * to a WRITE must mark it dirty with sdc_dirty().
+ *
+ * With SDC_BLOCKS defined in [app]/host.h, that many further 512 byte
+ * blocks make it an LRU block cache; they hold copies of the most recently
+ * used sectors, which a READ into either buffer is copied from. The least
+ * recently used block is replaced, unless it holds a sector pinned with
+ * sdc_pin(). No AVR host has the SRAM for one; posix exercises them.
  */
 
+#include <string.h>
+
 #include "sys/defs.h"
 #include "sys/msg.h"
 #include "fs/sfa.h"
@@ -42,29 +59,289 @@
 #include "fs/ssd.h"
 #include "fs/sdc.h"
 
+#ifndef SDC_BLOCKS
+#define SDC_BLOCKS 0       /* blocks in addition to sd_admin and sd_datum */
+#endif
+
+#define NR_BLOCKS (2 + SDC_BLOCKS)
+#define NR_PINS   ((SDC_BLOCKS + 1) / 2)
+
+typedef struct {
+    uchar_t *buf;
+    ulong_t sector;        /* the physical sector that buf holds */
+#if SDC_BLOCKS
+    ushort_t used;         /* the stamp of the last use */
+#endif
+    unsigned valid : 1;    /* buf matches the sector on the card */
+    unsigned pinned : 1;   /* never replaced */
+} sd_block;
+
+typedef struct {
+#if SDC_BLOCKS
+    ushort_t clock;        /* the stamp of the next use */
+#endif
+    ulong_t hits;
+    ulong_t misses;
+    sd_block block[NR_BLOCKS];
+#if SDC_BLOCKS
+    sd_buffer extra[SDC_BLOCKS];
+    ulong_t pins[NR_PINS]; /* physical sectors to pin, or 0 */
+#endif
+} sdc_t;
+
 /* I have .. */
 sd_buffer sd_admin;
 sd_buffer sd_datum;
 sd_metadata sd_meta;
 
+static sdc_t sdc = {
+    .block = {
+        [0] = { .buf = sd_admin.buf },
+        [1] = { .buf = sd_datum.buf }
+    }
+};
+
 /* I can .. */
+PRIVATE sd_block *find_buffer(void *buf);
+PRIVATE sd_block *find_sector(ulong_t sector);
+#if SDC_BLOCKS
+PRIVATE void touch(sd_block *bp);
+PRIVATE void fill(sd_block *from);
+#else
+#define touch(bp)
+#endif
+PRIVATE ulong_t get_long(uchar_t *cp);
+
+/* Called by SSD as it accepts a JOB.
+ * Return TRUE if a READ has been satisfied from the cache, when the job
+ * is to be replied to at once, else FALSE.
+ */
+PUBLIC uchar_t sdc_lookup(struct _ssd_info *ip)
+{
+    sd_block *to = find_buffer(ip->buf);
+
+    if (ip->op == READ_SECTOR && ip->count == 1) {
+        sd_block *from = find_sector(ip->phys_sector);
+        if (from) {
+            sdc.hits++;
+            touch(from);
+            if (from != to) {
+                memcpy(ip->buf, from->buf, BLOCK_SIZE);
+                if (to) {
+                    to->sector = ip->phys_sector;
+                    to->valid = TRUE;
+                    touch(to);
+                }
+            }
+            return TRUE;
+        }
+        sdc.misses++;
+    } else if (ip->op != READ_SECTOR) {
+        /* A READ of these sectors must not be answered from another copy
+         * while the write is queued or in flight.
+         */
+        for (sd_block *bp = sdc.block; bp < sdc.block + NR_BLOCKS; bp++) {
+            if (bp->valid && bp->sector - ip->phys_sector < ip->count)
+                bp->valid = FALSE;
+        }
+    }
+
+    /* its content is in transit */
+    if (to)
+        to->valid = FALSE;
+    return FALSE;
+}
+
+/* Called by SSD as it completes a JOB. */
+PUBLIC void sdc_update(struct _ssd_info *ip, uchar_t result)
+{
+    sd_block *to = find_buffer(ip->buf);
+
+    /* the buffer matches each of the sectors */
+    uchar_t uniform = (result == EOK &&
+                       (ip->count == 1 || ip->op == FILL_SECTOR));
+
+    if (ip->op != READ_SECTOR) {
+        /* write through: other copies of the sectors are now stale */
+        for (sd_block *bp = sdc.block; bp < sdc.block + NR_BLOCKS; bp++) {
+            if (bp != to && bp->valid &&
+                            bp->sector - ip->phys_sector < ip->count) {
+#if SDC_BLOCKS
+                if (bp >= sdc.block + 2 && uniform) {
+                    memcpy(bp->buf, ip->buf, BLOCK_SIZE);
+                    continue;
+                }
+#endif
+                bp->valid = FALSE;
+            }
+        }
+    }
+
+    if (to && uniform) {
+        to->sector = ip->phys_sector;
+        to->valid = TRUE;
+        touch(to);
+#if SDC_BLOCKS
+        fill(to);
+#endif
+    } else if (to) {
+        to->valid = FALSE;
+    }
+}
+
+/* The buffer is to be changed other than by a READ, so it no longer
+ * matches the sector it holds.
+ */
+PUBLIC void sdc_dirty(void *buf)
+{
+    sd_block *bp = find_buffer(buf);
+
+    if (bp)
+        bp->valid = FALSE;
+}
+
+/* Forget every sector, e.g. after a media change. */
+PUBLIC void sdc_invalidate(void)
+{
+    for (sd_block *bp = sdc.block; bp < sdc.block + NR_BLOCKS; bp++) {
+        bp->valid = FALSE;
+        bp->pinned = FALSE;
+    }
+#if SDC_BLOCKS
+    memset(sdc.pins, 0, sizeof(sdc.pins));
+#endif
+}
+
+/* Keep the sector, relative to the partition, in a block once it has
+ * been read, e.g. a bitmap sector. At most half of the SDC_BLOCKS, rounded
+ * up, may be pinned.
+ */
+PUBLIC uchar_t sdc_pin(__attribute__ ((unused)) ushort_t sector)
+{
+#if SDC_BLOCKS
+    ulong_t phys = sd_meta.firstSector + sector;
+
+    for (uchar_t i = 0; i < NR_PINS; i++) {
+        if (sdc.pins[i] == phys) {
+            return EOK;
+        } else if (sdc.pins[i] == 0) {
+            sdc.pins[i] = phys;
+            for (sd_block *bp = sdc.block + 2; bp < sdc.block + NR_BLOCKS;
+                                                                    bp++) {
+                if (bp->valid && bp->sector == phys)
+                    bp->pinned = TRUE;
+            }
+            return EOK;
+        }
+    }
+    return ENOSPC;
+#else
+    return ENOSYS;
+#endif
+}
+
+PUBLIC ulong_t sdc_hits(void)
+{
+    return sdc.hits;
+}
+
+PUBLIC ulong_t sdc_misses(void)
+{
+    return sdc.misses;
+}
+
+PUBLIC void sdc_clear_stats(void)
+{
+    sdc.hits = 0;
+    sdc.misses = 0;
+}
+
+PRIVATE sd_block *find_buffer(void *buf)
+{
+    for (sd_block *bp = sdc.block; bp < sdc.block + 2; bp++) {
+        if (bp->buf == buf)
+            return bp;
+    }
+    return NULL;
+}
+
+PRIVATE sd_block *find_sector(ulong_t sector)
+{
+    for (sd_block *bp = sdc.block; bp < sdc.block + NR_BLOCKS; bp++) {
+        if (bp->valid && bp->sector == sector)
+            return bp;
+    }
+    return NULL;
+}
+
+#if SDC_BLOCKS
+PRIVATE void touch(sd_block *bp)
+{
+    bp->used = sdc.clock++;
+}
+
+/* Copy the sector just read or written into a block of its own, unless
+ * one already holds it, replacing the least recently used.
+ */
+PRIVATE void fill(sd_block *from)
+{
+    sd_block *victim = NULL;
+
+    for (sd_block *bp = sdc.block + 2; bp < sdc.block + NR_BLOCKS; bp++) {
+        if (!bp->buf)
+            bp->buf = sdc.extra[bp - sdc.block - 2].buf;
+
+        if (bp->valid && bp->sector == from->sector) {
+            touch(bp);
+            return;
+        } else if (!bp->valid) {
+            if (!victim || victim->valid)
+                victim = bp;
+        } else if (!bp->pinned && (!victim || (victim->valid &&
+                  (ushort_t)(sdc.clock - bp->used) >
+                  (ushort_t)(sdc.clock - victim->used)))) {
+            victim = bp;
+        }
+    }
+
+    if (victim) {
+        memcpy(victim->buf, from->buf, BLOCK_SIZE);
+        victim->sector = from->sector;
+        victim->valid = TRUE;
+        victim->pinned = FALSE;
+        for (uchar_t i = 0; i < NR_PINS; i++) {
+            if (sdc.pins[i] == from->sector)
+                victim->pinned = TRUE;
+        }
+        touch(victim);
+    }
+}
+#endif
+
+/* A little endian long from the mbr sector. */
+PRIVATE ulong_t get_long(uchar_t *cp)
+{
+    return (ulong_t)cp[0] | (ulong_t)cp[1] << 8 |
+           (ulong_t)cp[2] << 16 | (ulong_t)cp[3] << 24;
+}
+
 PUBLIC uchar_t read_partition_table(void)
 {
-    mbr_t *mbr = (mbr_t *)sd_admin.buf;
+    uchar_t *mbr = sd_admin.buf;
 
-    if (mbr->mbrSig0 == 0x55 && mbr->mbrSig1 == 0xAA) {
-        part_t *part = mbr->part;
+    if (mbr[MBR_SIG_OFFSET] == 0x55 && mbr[MBR_SIG_OFFSET + 1] == 0xAA) {
+        uchar_t *part = mbr + MBR_PART_OFFSET;
         int i;
-        for (i = 0; 1 < 4; i++, part++) {
-            if (part->type == LFS_PARTITION_TYPE)
+        for (i = 0; i < 4; i++, part += PART_ENTRY_SIZE) {
+            if (part[PART_TYPE_OFFSET] == LFS_PARTITION_TYPE)
                 break;
         }
 
         if (i == 4) {
             return ENODEV;
         } else {
-            sd_meta.firstSector = part->firstSector;
-            sd_meta.totalSectors = part->totalSectors;
+            sd_meta.firstSector = get_long(part + PART_FIRST_OFFSET);
+            sd_meta.totalSectors = get_long(part + PART_TOTAL_OFFSET);
         }
     } else {
         return ENXIO;
@@ -72,4 +349,16 @@ PUBLIC uchar_t read_partition_table(void)
     return EOK;
 }
 
+/* The hash of a dirent name, as far as NAME_SIZE or the terminator,
+ * for the hash sector of an I_INDEXED directory.
+ */
+PUBLIC uchar_t name_hash(char *name)
+{
+    uchar_t h = 0;
+
+    for (uchar_t i = 0; i < NAME_SIZE && name[i]; i++)
+        h = (h << 3 | h >> 5) ^ name[i];
+    return h;
+}
+
 /* end code */
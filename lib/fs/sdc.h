@@ -48,6 +48,21 @@ extern sd_buffer sd_admin; /* reading processes */
 extern sd_buffer sd_datum; /* writing processes */
 extern sd_metadata sd_meta;
 
+struct _ssd_info;
+
 PUBLIC uchar_t read_partition_table(void);
+PUBLIC uchar_t name_hash(char *name);
+
+/* the block cache, called by SSD */
+PUBLIC uchar_t sdc_lookup(struct _ssd_info *ip);
+PUBLIC void sdc_update(struct _ssd_info *ip, uchar_t result);
+
+/* for the agents */
+PUBLIC void sdc_dirty(void *buf);
+PUBLIC void sdc_invalidate(void);
+PUBLIC uchar_t sdc_pin(ushort_t sector);
+PUBLIC ulong_t sdc_hits(void);
+PUBLIC ulong_t sdc_misses(void);
+PUBLIC void sdc_clear_stats(void);
 
 #endif /* _SDC_H_ */
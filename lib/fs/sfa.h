@@ -71,6 +71,12 @@
 /* derive the byte offset of a dirent index */
 #define DIRENT_OFFSET(n)        ((n) << DIRENT_SIZE_SHIFT)
 
+/* An I_INDEXED directory keeps a name_hash() byte for each dirent of its
+ * first zone in the last sector of that zone, which holds no dirents.
+ */
+#define DIR_HASH_SECTOR         ((1 << ZONE_SHIFT) - 1)
+#define DIR_HASH_ITEMS          (DIR_HASH_SECTOR << DIRENT_PER_BLOCK_SHIFT)
+
 #define ZONE_SHIFT              4
 #define ZONE_SIZE               (BLOCK_SIZE << ZONE_SHIFT)
 #define ZONE_BYTES_SHIFT        (BLOCK_SIZE_SHIFT + ZONE_SHIFT) /* 13 */
@@ -133,11 +139,18 @@ typedef ushort_t         inum_t;
 #define DIRENT_SIZE      sizeof(dir_struct)
 
 /* inode i_mode bits */
-#define I_TYPE           0xF0 /* this field gives inode type */
+#define I_TYPE           0xE0 /* this field gives inode type */
 #define I_REGULAR        0x80 /* regular file, not dir or special */
 #define I_BLOCK_SPECIAL  0x60 /* block special file */
 #define I_DIRECTORY      0x40 /* file is a directory */
 #define I_CHAR_SPECIAL   0x20 /* character special file */
+/* I_INDEXED and I_LOG share the one spare bit of i_mode. A directory is
+ * never a log and a regular file never has a hash sector, and each test
+ * of the bit is made of an inode whose type is known, so the two cannot
+ * be mistaken for one another.
+ */
+#define I_INDEXED        0x10 /* directory has a name hash sector */
+#define I_LOG            0x10 /* regular file is appended to as a log */
 #define ALL_MODES        0x0F /* all bits for trwx */
 #define I_STICKY_BIT     0x08 /* set sticky bit */
 #define RWX_MODES        0x07 /* mode bits for RWX only */
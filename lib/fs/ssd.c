@@ -37,10 +37,12 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <time.h>
 
 #include "sys/defs.h"
 #include "sys/msg.h"
 #include "sys/clk.h"
+#include "sys/utc.h"
 #include "fs/sdc.h"
 #include "fs/ssd.h"
 
@@ -59,11 +61,15 @@
 #define CMD0 0
 #define CMD8 8
 #define CMD17 17
+#define ACMD23 23
 #define CMD24 24
+#define CMD25 25
 #define ACMD41 41
 #define CMD55 55
 #define CMD58 58
 #define START_BLOCK_TOKEN 0xfe
+#define START_MULTIPLE_TOKEN 0xfc /* CMD25 [SD p.172] */
+#define STOP_TRAN_TOKEN 0xfd
 #define DATA_ERROR_TOKEN_MASK 0xf0
 
 /* R1 Response Format [SD p.169] */
@@ -90,6 +96,22 @@
 #define SPI_SS   _BV(PORTB2)
 #define SPI_CD   _BV(PORTB1)      /* Card Detect: 0 = present, 1 = absent. */
 
+/* SPI clock rates [AT p.177]
+ * The card is identified at no more than 400 kHz [SD p.149], and the data
+ * is transferred at the fastest rate that works, falling back one step
+ * at a time after CRC errors or timeouts, down to the original 1 MHz.
+ */
+typedef enum {
+    SPI_DIV2 = 0,      /* 4 MHz: SPR1=0 SPR0=0 SPI2X=1 */
+    SPI_DIV4,          /* 2 MHz: SPR1=0 SPR0=0 SPI2X=0 */
+    SPI_DIV8,          /* 1 MHz: SPR1=0 SPR0=1 SPI2X=1 */
+    SPI_DIV32          /* 250 kHz: SPR1=1 SPR0=0 SPI2X=1 */
+} __attribute__ ((packed)) speed_t;
+
+#define IDENT_SPEED SPI_DIV32
+#define FASTEST_SPEED SPI_DIV2
+#define SLOWEST_SPEED SPI_DIV8
+
 typedef enum {
     UNSET = 0,
     INITIALIZING,
@@ -110,6 +132,8 @@ typedef enum {
     IN_WRITE_DATA,
     IN_WRITE_CRC,
     AWAITING_DATA_RESPONSE,
+    IN_STOP_TOKEN,
+    IN_STUFF_BYTE,
     BUSY,
     DONE
 } __attribute__ ((packed)) state_t;
@@ -120,6 +144,9 @@ typedef struct {
     init_status_t init_status : 2;
     unsigned read_token_expected : 1;
     unsigned write_token_available : 1;
+    unsigned multiple : 1;    /* CMD25 of a FILL_SECTOR job */
+    unsigned stopping : 1;    /* STOP_TRAN_TOKEN sent */
+    speed_t speed : 2;        /* the data transfer rate */
     ssd_info *headp;
     uchar_t checksum[2];
     uchar_t cmd_buf[6];
@@ -134,6 +161,11 @@ typedef struct {
     ushort_t dst_cnt;
     uchar_t flags; /* R1 Response Format [SD p.169] */
     uchar_t Ncr;
+    uchar_t blocks;           /* blocks remaining after this one */
+    uchar_t result;           /* of a multiple block transfer */
+    ulong_t started;          /* uptime ticks at the start of the job */
+    ulong_t busy;             /* uptime ticks spent in jobs */
+    ulong_t sectors;          /* transferred to or from the card */
     union {
         clk_info clk;
     } info;
@@ -156,7 +188,11 @@ PRIVATE void do_cmd55(void);
 PRIVATE void do_cmd58(void);
 PRIVATE void do_read_block(void);
 PRIVATE void do_write_block(void);
+PRIVATE void do_acmd23(void);
+PRIVATE void do_write_multiple(void);
 PRIVATE void do_cmd_common(void);
+PRIVATE void set_speed(speed_t speed);
+PRIVATE void fall_back(uchar_t result);
 
 /* initialize the SPI */
 PUBLIC void config_ssd(void)
@@ -180,10 +216,10 @@ PUBLIC void config_ssd(void)
      * DORD=0                  MSB first
      * MSTR=1                  Master
      * CPOL=0 CPHA=0           Mode 0
-     * SPR1=0 SPR0=1 SPI2X=1   Clock Rate = F_CPU / 8 == 1 MHz
+     * SPR1=1 SPR0=0 SPI2X=1   Clock Rate = F_CPU / 32 == 250 kHz
      */
-    SPCR = _BV(SPIE) | _BV(SPE) | _BV(MSTR) | _BV(SPR0);
-    SPSR |= _BV(SPI2X);
+    SPCR = _BV(SPIE) | _BV(SPE) | _BV(MSTR);
+    set_speed(IDENT_SPEED);
 }
 
 PUBLIC uchar_t receive_ssd(message *m_ptr)
@@ -191,6 +227,8 @@ PUBLIC uchar_t receive_ssd(message *m_ptr)
     switch (m_ptr->opcode) {
     case MEDIA_CHANGE:
         this.init_status = UNSET;
+        this.speed = FASTEST_SPEED;
+        sdc_invalidate();
         break;
 
     case REPLY_RESULT:
@@ -198,6 +236,23 @@ PUBLIC uchar_t receive_ssd(message *m_ptr)
         if (this.init_status == INITIALIZING) {
             resume();
         } else if (this.headp) {
+            if (m_ptr->RESULT == EOK && this.headp->count > 1 &&
+                              this.headp->op == FILL_SECTOR && !this.multiple) {
+                /* CMD55 and ACMD23 come before CMD25 */
+                if ((this.cmd_buf[0] & ~TRANSMISSION_BIT) == CMD55)
+                    do_acmd23();
+                else
+                    do_write_multiple();
+                break;
+            }
+            this.blocks = 0;
+            this.stopping = FALSE;
+            this.busy += get_uptime_ticks() - this.started;
+            if (m_ptr->RESULT == EOK)
+                this.sectors += this.headp->count;
+            else
+                fall_back(m_ptr->RESULT);
+            sdc_update(this.headp, m_ptr->RESULT);
             send_REPLY_INFO(this.headp->replyTo, m_ptr->RESULT, this.headp);
             if ((this.headp = this.headp->nextp) != NULL)
                 start_job();
@@ -220,7 +275,10 @@ PUBLIC uchar_t receive_ssd(message *m_ptr)
             ssd_info *ip = m_ptr->INFO;
             ip->nextp = NULL;
             ip->replyTo = m_ptr->sender;
-            if (!this.headp) {
+            if (sdc_lookup(ip)) {
+                /* the sector is in the cache */
+                send_REPLY_INFO(ip->replyTo, EOK, ip);
+            } else if (!this.headp) {
                 this.headp = ip;
                 start_job();
             } else {
@@ -247,6 +305,11 @@ PRIVATE void start_job(void)
         return;
     }
 
+    /* nothing is left over from a multiple block job that failed */
+    this.multiple = FALSE;
+    this.stopping = FALSE;
+    this.blocks = 0;
+    this.started = get_uptime_ticks();
     switch (this.headp->op) {
     case READ_SECTOR:
         do_read_block();
@@ -254,6 +317,12 @@ PRIVATE void start_job(void)
     case WRITE_SECTOR:
         do_write_block();
         break;
+    case FILL_SECTOR:
+        if (this.headp->count > 1)
+            do_cmd55();  /* then ACMD23, then CMD25 */
+        else
+            do_write_block();
+        break;
     }
 }
 
@@ -299,6 +368,7 @@ PRIVATE void resume(void)
                 /* Test the Card Capacity Status bit (CCS) [p.112] */ 
                 this.sdhc = (this.response_buf[0] & 0x40) ? TRUE : FALSE;
             this.init_status = INITIALIZED;
+            set_speed(this.speed);
             /* Send an irregular reply to the main loop to start
              * any pending job. Initialization is an irregular operation,
              * and warrents some special provision.
@@ -319,6 +389,7 @@ PRIVATE void do_pre_init(void)
      * resume() can identify this cmd.
      */
     this.init_status = INITIALIZING;
+    set_speed(IDENT_SPEED);
     this.cmd_buf[0] = PRE_INIT;
     this.cmd_cnt = 10;
     this.state = IN_PRE_INIT;    
@@ -387,13 +458,44 @@ PRIVATE void do_read_block(void)
     do_cmd_common();
 }
 
+/* ACMD23: SET_WR_BLK_ERASE_COUNT [SD p.167]
+ * Set the number of write blocks to be pre-erased before writing, for a
+ * faster CMD25.
+ */
+PRIVATE void do_acmd23(void)
+{
+    this.cmd_buf[0] = ACMD23 | TRANSMISSION_BIT;
+    this.cmd_buf[1] = 0x00;
+    this.cmd_buf[2] = 0x00;
+    this.cmd_buf[3] = 0x00;
+    this.cmd_buf[4] = this.headp->count;
+    this.cmd_buf[5] = 0xFF;
+    this.src = 0;
+    this.src_cnt = 0;
+    this.dst = 0;
+    this.dst_cnt = 0;
+    this.read_token_expected = FALSE;
+    this.write_token_available = FALSE;
+    do_cmd_common();
+}
+
+/* CMD25: WRITE_MULTIPLE_BLOCK [SD p.164]
+ * Continuously writes blocks of data until a STOP_TRAN token is sent.
+ */
+PRIVATE void do_write_multiple(void)
+{
+    this.multiple = TRUE;
+    this.blocks = this.headp->count - 1;
+    do_write_block();
+}
+
 /* CMD24: WRITE_BLOCK [SD p.164]
  * Writes a block of the size selected by the SET_BLOCKLEN command.
  * n.b. SDHC have fixed size blocklen of 512 bytes.
  */
 PRIVATE void do_write_block(void)
 {
-    this.cmd_buf[0] = CMD24 | TRANSMISSION_BIT;
+    this.cmd_buf[0] = (this.multiple ? CMD25 : CMD24) | TRANSMISSION_BIT;
     this.cmd_buf[1] = (this.headp->phys_sector >> 24);
     this.cmd_buf[2] = (this.headp->phys_sector >> 16);
     this.cmd_buf[3] = (this.headp->phys_sector >> 8);
@@ -480,12 +582,50 @@ PRIVATE void do_cmd_common(void)
     this.flags = 0;
     this.crc = this.checksum;
     this.crc_cnt = 2;
+    this.stopping = FALSE;
+    this.result = EOK;
     this.state = IN_COMMAND;
     select_card();
     this.cmd_cnt--;
     SPDR = *this.cmd++;
 }
 
+/* Select the SPI clock rate [AT p.177] */
+PRIVATE void set_speed(speed_t speed)
+{
+    SPCR &= ~(_BV(SPR1) | _BV(SPR0));
+    SPSR &= ~_BV(SPI2X);
+
+    switch (speed) {
+    case SPI_DIV2:
+        SPSR |= _BV(SPI2X);
+        break;
+    case SPI_DIV4:
+        break;
+    case SPI_DIV8:
+        SPCR |= _BV(SPR0);
+        SPSR |= _BV(SPI2X);
+        break;
+    case SPI_DIV32:
+        SPCR |= _BV(SPR1);
+        SPSR |= _BV(SPI2X);
+        break;
+    }
+}
+
+/* A CRC error or a timeout may be the clock rate is too fast for the
+ * card or its wiring, so the next job goes one step slower.
+ */
+PRIVATE void fall_back(uchar_t result)
+{
+    if (result == EFAULT || result == ENODEV) {
+        if (this.speed < SLOWEST_SPEED) {
+            this.speed++;
+            set_speed(this.speed);
+        }
+    }
+}
+
 /* -----------------------------------------------------
    Handle an SPI Serial Transfer Complete interrupt.
    This appears as <__vector_17>: in the .lst file.
@@ -520,7 +660,8 @@ ISR(SPI_STC_vect)
         if ((data & 0x80) == 0) { /* R1 Response has been received */
             this.flags = data;
             if (this.write_token_available) {
-                SPDR = START_BLOCK_TOKEN;
+                SPDR = this.multiple ? START_MULTIPLE_TOKEN :
+                                       START_BLOCK_TOKEN;
                 this.state = IN_WRITE_DATA;
             } else if (this.dst_cnt) {
                 if (this.read_token_expected)
@@ -533,6 +674,7 @@ ISR(SPI_STC_vect)
                 SPDR = FF_BYTE;
             }
         } else if (this.Ncr-- == 0) {         /* timed out */
+            this.blocks = 0;
             send_REPLY_RESULT(SELF, ENODEV);
         } else {            /* try again, up to MAX_NCR attempts */
             SPDR = FF_BYTE;
@@ -566,9 +708,12 @@ ISR(SPI_STC_vect)
 
     case IN_READ_CRC:
         *this.crc++ = SPDR;
-        SPDR = FF_BYTE;
-        if (--this.crc_cnt == 0)
+        if (--this.crc_cnt) {
+            SPDR = FF_BYTE;
+        } else {
             this.state = DONE;
+            SPDR = FF_BYTE;
+        }
         break;
 
     case IN_WRITE_DATA:
@@ -600,38 +745,96 @@ ISR(SPI_STC_vect)
                 break;
 
             case DATA_CRC_ERROR:
-                send_REPLY_RESULT(SELF, EFAULT);
+                this.result = EFAULT;
                 break;
 
             case DATA_WRITE_ERROR:
-                send_REPLY_RESULT(SELF, EACCES);
+                this.result = EACCES;
                 break;
             }
+
+            if (this.result != EOK) {
+                this.blocks = 0;
+                if (this.multiple) {
+                    this.state = IN_STOP_TOKEN;
+                    SPDR = STOP_TRAN_TOKEN;
+                } else {
+                    send_REPLY_RESULT(SELF, this.result);
+                }
+            }
         } else {
             SPDR = FF_BYTE;
         }
         break;
 
+    case IN_STOP_TOKEN:
+        /* the card is busy from the byte after the next [SD p.173] */
+        this.stopping = TRUE;
+        this.state = IN_STUFF_BYTE;
+        SPDR = FF_BYTE;
+        break;
+
+    case IN_STUFF_BYTE:
+        this.state = BUSY;
+        SPDR = FF_BYTE;
+        break;
+
     case BUSY:
         data = SPDR;
-        if (data)
+        if (data == 0) {
+            SPDR = FF_BYTE;
+        } else if (this.blocks && !this.stopping) {
+            /* the next block of a CMD25, from the same buffer */
+            this.blocks--;
+            this.src = this.headp->buf;
+            this.src_cnt = BLOCK_SIZE;
+            this.state = IN_WRITE_DATA;
+            SPDR = START_MULTIPLE_TOKEN;
+        } else if (this.multiple && !this.stopping) {
+            this.state = IN_STOP_TOKEN;
+            SPDR = STOP_TRAN_TOKEN;
+        } else {
             this.state = DONE;
-        SPDR = FF_BYTE;
+            SPDR = FF_BYTE;
+        }
         break;
 
     case DONE:
-        send_REPLY_RESULT(SELF, EOK);
+        send_REPLY_RESULT(SELF, this.result);
         break;
     }
 }
 
+/* transfer statistics, for FSD */
+PUBLIC ulong_t ssd_sectors(void)
+{
+    return this.sectors;
+}
+
+PUBLIC ulong_t ssd_millis(void)
+{
+    return (this.busy >> 8) * 1000 + FRAC_TO_MILLIS(this.busy & 0xff);
+}
+
+PUBLIC uchar_t ssd_divider(void)
+{
+    return 2 << this.speed;
+}
+
+PUBLIC void ssd_clear_stats(void)
+{
+    this.sectors = 0;
+    this.busy = 0;
+}
+
 /* convenience function */
 
 PUBLIC void send_SSD_JOB(ProcNumber sender, ssd_info *cp, uchar_t op,
-                                              ushort_t sector, void *bp)
+                               ushort_t sector, uchar_t count, void *bp)
 {
     cp->op = op;
     cp->phys_sector = sd_meta.firstSector + sector;
+    cp->count = count;
     cp->buf = bp;
     send_m3(sender, SELF, JOB, cp);
 }
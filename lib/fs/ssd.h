@@ -38,17 +38,23 @@
  * The client provides an info pointer
  * to the SSD in READ_BLOCK and WRITE_BLOCK messages.
  * All blocks are 512 bytes.
+ *
+ * READ_SECTOR and WRITE_SECTOR move one sector. A FILL_SECTOR job of
+ * count sectors uses a multiple block write of the one 512 byte buffer
+ * to each of them.
  */
 
 #define READ_SECTOR  0x01
 #define WRITE_SECTOR 0x02
+#define FILL_SECTOR  0x03
 
 typedef struct _ssd_info {
     struct _ssd_info *nextp;
     ProcNumber replyTo;
     uchar_t *buf;        /* pointer to the 512 byte buffer */
     ulong_t phys_sector; /* disk sector number to be read/written */
-    uchar_t op;          /* read=1, write=2 */
+    uchar_t op;          /* read=1, write=2, fill=3 */
+    uchar_t count;       /* number of sectors, 1 unless FILL_SECTOR */
 } ssd_info;
 
 /* convenience function */
@@ -57,14 +63,22 @@ PUBLIC void send_SSD_JOB (
     ssd_info *cp,
     uchar_t op,
     ushort_t sector,
+    uchar_t count,
     void *bp
 );
 
 /* convenience macros insert SELF in the sender arg. */
 
-#define sae_SSD_JOB(a,b,c,d)     send_SSD_JOB(SELF, &(a),(b),(c),(d))
-#define sae_READ_SSD(a,b,c)      send_SSD_JOB(SELF, &(a),READ_SECTOR,(b),(c))
-#define sae_WRITE_SSD(a,b,c)     send_SSD_JOB(SELF, &(a),WRITE_SECTOR,(b),(c))
+#define sae_SSD_JOB(a,b,c,d)    send_SSD_JOB(SELF, &(a),(b),(c),1,(d))
+#define sae_READ_SSD(a,b,c)     send_SSD_JOB(SELF, &(a),READ_SECTOR,(b),1,(c))
+#define sae_WRITE_SSD(a,b,c)    send_SSD_JOB(SELF, &(a),WRITE_SECTOR,(b),1,(c))
+#define sae_FILL_SSD(a,b,n,c)   send_SSD_JOB(SELF, &(a),FILL_SECTOR,(b),(n),(c))
+
+/* transfer statistics */
+PUBLIC ulong_t ssd_sectors(void);
+PUBLIC ulong_t ssd_millis(void);
+PUBLIC uchar_t ssd_divider(void);
+PUBLIC void ssd_clear_stats(void);
 
 #else /* _MAIN_ */
 
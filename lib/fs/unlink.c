@@ -231,6 +231,15 @@ PRIVATE void resume(void)
             }
             if (this->tot_dirent) {
                 this->sector_nr++;
+                if ((this->myno.i_mode & I_INDEXED) && this->sector_nr ==
+                        ZONE_SECTORS(this->myno.i_zone) + DIR_HASH_SECTOR) {
+                    /* the hash sector holds no dirents */
+                    this->sector_nr++;
+                    this->tot_dirent -= MIN(this->tot_dirent,
+                                                     DIRENT_PER_BLOCK);
+                }
+            }
+            if (this->tot_dirent) {
                 sae_READ_SSD(this->info.ssd, this->sector_nr, sd_admin.buf);
             } else if (this->n_dirent < this->myno.i_nlinks) {
                 this->myno.i_nlinks--;
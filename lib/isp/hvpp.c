@@ -48,6 +48,7 @@
 #include <avr/interrupt.h>
 #include <avr/wdt.h>
 #include <util/delay.h>
+#include <util/crc16.h>
 
 #include "sys/defs.h"
 #include "sys/ioctl.h"
@@ -578,6 +579,7 @@ PRIVATE void proc_record(void)
          * read data from ssss to eeee.
          * ff = 0 == display 
          *      1 == blank check
+         *      2 == CRC-16 (XMODEM) of ssss to eeee inclusive
          */
         this.ofs_address = this.r.read_data.start_high << 8
                               | this.r.read_data.start_low;
@@ -632,6 +634,28 @@ PRIVATE void proc_record(void)
                 }
                 break;
 
+            case IHEX_CRC_CHECK:
+                {
+                    ushort_t crc = 0;
+                    /* As for the blank check, the whole 32k takes longer
+                     * than the watchdog will allow.
+                     */
+                    wdt_disable();
+                    do {
+                        fetch_buffer();
+                        for ( ;this.pindex < this.n_bytes; this.pindex++)
+                            crc = _crc_xmodem_update(crc,
+                                                 this.readbuf[this.pindex]);
+                    } while (this.ofs_address + this.pindex <= this.end_loc);
+                    this.state = FINISHED;
+                    this.lindex = 0;
+                    puthex(crc >> 8);
+                    puthex(crc & 0xFF);
+                    bputc('\n');
+                    sae_SER(this.info.ser, this.linebuf, this.lindex);
+                }
+                break;
+
             default:
                 err = EINVAL;
                 break;
@@ -44,6 +44,7 @@
 #include <stdlib.h>
 #include <avr/io.h>
 #include <avr/pgmspace.h>
+#include <util/crc16.h>
 
 #include "sys/defs.h"
 #include "sys/ioctl.h"
@@ -93,6 +94,7 @@ typedef enum {
     IN_EEPROM_WRITE_DELAY,
     PRINTING_PROGRAM_MEMORY,
     CHECKING_PROGRAM_MEMORY,
+    SUMMING_PROGRAM_MEMORY,
     PRINTING_MISC_DATA,
     ABORTING,
     FINISHED,
@@ -121,6 +123,7 @@ typedef struct {
     uchar_t pindex;         /* iterative loop hex record start point */
     uchar_t subfunction;
     uchar_t selection;
+    ushort_t crc;           /* of the memory read so far */
     uchar_t *bp;            /* page buffer pointer */
     union {
         icsd_info icsd;
@@ -398,6 +401,25 @@ PRIVATE void resume(void)
         }
         break;
 
+    case SUMMING_PROGRAM_MEMORY:
+        /* We arrive here after fetching a buffer. Only the CRC of the
+         * range is printed, for avp to compare with its own.
+         */
+        for ( ; this->pindex < this->n_bytes; this->pindex++)
+            this->crc = _crc_xmodem_update(this->crc,
+                                           this->pagebuf[this->pindex]);
+        if (this->start_loc + this->pindex <= this->end_loc) {
+            fetch_buffer();
+        } else {
+            this->state = FINISHED;
+            this->lindex = 0;
+            puthex(this->crc >> 8);
+            puthex(this->crc & 0xFF);
+            bputc('\n');
+            sae_SER(this->info.ser, this->linebuf, this->lindex);
+        }
+        break;
+
     case PRINTING_MISC_DATA:
         /* The READ_MISC_DATA operation has completed.
          * Print a hex record corresponding to the character in the third byte.
@@ -592,6 +614,7 @@ PRIVATE void proc_record(void)
          * read data from ssss to eeee.
          * ff = 0 == display 
          *      1 == blank check
+         *      2 == CRC-16 (XMODEM) of ssss to eeee inclusive
          */
         this->start_loc = this->r.read_data.start_high << 8
                               | this->r.read_data.start_low;
@@ -605,6 +628,9 @@ PRIVATE void proc_record(void)
                 this->state = PRINTING_PROGRAM_MEMORY;
             } else if (this->r.read_data.subfunction == IHEX_BLANK_CHECK) {
                 this->state = CHECKING_PROGRAM_MEMORY;
+            } else if (this->r.read_data.subfunction == IHEX_CRC_CHECK) {
+                this->state = SUMMING_PROGRAM_MEMORY;
+                this->crc = 0;
             }
             fetch_buffer();
         }
@@ -64,6 +64,7 @@
 
 #define IHEX_DISPLAY_DATA                    0 /* subfunction */
 #define IHEX_BLANK_CHECK                     1 /* subfunction */
+#define IHEX_CRC_CHECK                       2 /* subfunction */
 
 #define IHEX_ERASE_MEMORY                    3 /* subfunction */
 #define IHEX_EEPROM_MEMORY                   1 /* selection */
@@ -142,4 +143,40 @@ typedef struct {
 
 #define RECORD_LEN 21 /* binary input buffer */
 
+/* Binary page frames, an alternative to the hex records for the upload.
+ *
+ *   FRAME_STX type addr_high addr_low len data[len] crc_high crc_low
+ *
+ * The CRC is the CRC-16/XMODEM (poly 0x1021, initial 0) of type to data.
+ * A flash frame holds a whole SPM page at a page aligned address, an
+ * eeprom frame up to a page of bytes at any address, and the end frame
+ * no data. ISP answers each frame slot that it frees with a '.', and the
+ * end frame with a '$' once the target has been started.
+ *
+ * A query frame holds a page count in data[0]. ISP answers it with the
+ * target's CRC of each page from the address, as four hex digits, eight
+ * to a line, so that only the pages that differ need be sent.
+ */
+#define FRAME_STX                         0x02
+
+#define FRAME_FLASH                          0 /* type */
+#define FRAME_EEPROM                         1 /* type */
+#define FRAME_END                            2 /* type */
+#define FRAME_QUERY                          3 /* type */
+
+#define FRAME_CRCS_PER_LINE                  8
+
+#define FRAME_HEADER_LEN                     4 /* type to len */
+#define FRAME_CRC_LEN                        2
+
+#ifdef SPM_PAGESIZE
+typedef struct {
+    uchar_t type;
+    uchar_t addr_high;
+    uchar_t addr_low;
+    uchar_t len;
+    uchar_t data[SPM_PAGESIZE + FRAME_CRC_LEN]; /* the CRC follows data */
+} frame_t;
+#endif
+
 #endif /* _IHEX_H_ */
@@ -32,6 +32,25 @@
 /* In-system programmer. Handle incoming characters as an
  * INTEL hex file and act as proxy for a remote twiboot device.
  *
+ * The upload may instead come as binary page frames (see isp/ihex.h),
+ * which are received into ISP_FRAMES slots while the page before them
+ * is loaded into the target and read back. Each freed slot is answered
+ * with a '.', so avril keeps that many frames and one page in flight.
+ * A query frame is answered with twiboot's CRC of each page asked for.
+ *
+ * A job may name several targets, which are given the same image: each
+ * page is loaded into and verified on every target in turn. Every
+ * target's version is fetched before the upload, and one that does not
+ * answer, or is not a TWIBOOT, is printed as '?' and left out. With
+ * frames, a target whose readback fails or that stops answering is
+ * dropped and the rest carry on, and a '+', an 'R' or an 'N' for each
+ * target comes before the final '$'.
+ *
+ * A written page is verified by twiboot's CRC of it, two bytes over TWI
+ * rather than the page, and is read back in full only if that differs.
+ * A target older than PAGE_CRC_VERSION, or that NACKs the CRC request,
+ * is read back instead.
+ *
  * See also:-
  * willow/twiboot/twiboot.c
  * Atmel App Note AVR061: STK500 Communication Protocol [doc2525.pdf].
@@ -44,6 +63,7 @@
 #include <stdlib.h>
 #include <avr/io.h>
 #include <avr/pgmspace.h>
+#include <util/crc16.h>
 
 #include "sys/defs.h"
 #include "sys/ioctl.h"
@@ -67,6 +87,10 @@
 #define PROGRAM_PAGE_NUMBER_MASK 0x7F80
 #define PROGRAM_PAGE_OFFSET_MASK 0x007F
 
+#ifndef ISP_FRAMES
+#define ISP_FRAMES 1        /* page frames received while one is loaded */
+#endif
+
 #define TWENTY_MILLISECONDS    20
 #define READBACK_PAUSE         TWENTY_MILLISECONDS
 
@@ -77,12 +101,17 @@ typedef enum {
     FETCHING_CHIPINFO,
     PRINTING_CHIPINFO,
     REDIRECTING_TO_SELF,
+    PROMPTING,
     READY,
     LOADING_PROGRAM_MEMORY_PAGE,
     LOADING_EEPROM_PAGE,
     PAUSING_BEFORE_READBACK,
+    VERIFYING_PAGE,
     READING_BACK,
     PRINTING_PROGRAM_MEMORY,
+    QUERYING_CRCS,
+    PRINTING_CRCS,
+    STARTING_APPLICATION,
     ABORTING,
     FINISHED
 } __attribute__ ((packed)) state_t;
@@ -101,6 +130,20 @@ typedef struct {
     unsigned dirty : 1;     /* TRUE if pagebuf has been written */
     unsigned seen_eof : 1;  /* TRUE from EOF record to POWER_OFF */
     unsigned in_eeprom : 1; /* FALSE for flash, TRUE for eeprom data */
+    unsigned framed : 1;    /* TRUE once a binary frame has been seen */
+    unsigned crediting : 1; /* a '.' for a freed frame is being sent */
+    uchar_t failed;         /* prompt for a frame error, to be printed */
+    uchar_t credits;        /* '.' owed for freed frames */
+    uchar_t f_in;           /* the frame being received */
+    uchar_t f_out;          /* the next frame to be loaded */
+    uchar_t f_full;         /* frames received and not yet loaded */
+    uchar_t tix;            /* the target being loaded, of headp->target */
+    uchar_t bad;            /* a bit for each target that has been dropped */
+    uchar_t gone;           /* a bit for each of those that did not answer */
+    uchar_t no_crc;         /* a bit for each target without page CRCs */
+    uchar_t q_pages;        /* of the query, for each target */
+    ushort_t q_addr;
+    ushort_t fcount;        /* bytes of the frame received, 0 between */
     isp_info *headp;
     ushort_t page_address;
     ushort_t hcount;        /* incoming hex char count */
@@ -123,9 +166,11 @@ typedef struct {
         ser_info ser;
         clk_info clk;
     } info;
+    ser_info credit;        /* apart from info, which loads pages */
     uchar_t linebuf[LINE_LEN];
     cbuf_t  cbuf;
     uchar_t readbuf[SPM_PAGESIZE];
+    frame_t frame[ISP_FRAMES];
 } isp_t;
 
 /* I have .. */
@@ -137,11 +182,25 @@ PRIVATE void resume(void);
 PRIVATE void consume(CharProc vp);
 PRIVATE void parse(void);
 PRIVATE void proc_record(void);
+PRIVATE void frame_byte(uchar_t ch);
+PRIVATE void next_frame(void);
+PRIVATE void release_frame(void);
+PRIVATE void fail(uchar_t c);
+PRIVATE void send_credit(void);
+PRIVATE void fetch_crcs(void);
+PRIVATE void print_crcs(void);
+PRIVATE uchar_t first_target(void);
+PRIVATE uchar_t next_target(void);
+PRIVATE uchar_t drop_target(void);
+PRIVATE void print_results(void);
 PRIVATE void fetch_version(void);
 PRIVATE void fetch_chipinfo(void);
 PRIVATE void start_application(void);
 PRIVATE void load_program_memory_page(void);
+PRIVATE void load_eeprom_page(void);
 PRIVATE void fetch_buffer(void);
+PRIVATE void fetch_page_crc(void);
+PRIVATE void page_done(void);
 PRIVATE void print_data_record(void);
 PRIVATE void print_eof_record(void);
 PRIVATE void bputc(uchar_t c);
@@ -154,14 +213,26 @@ PUBLIC uchar_t receive_isp(message *m_ptr)
 {
     switch (m_ptr->opcode) {
     case NOT_EMPTY:
-        consume(m_ptr->VPTR);
+        if (this) {
+            consume(m_ptr->VPTR);
+        }
         break;
 
     case ALARM:
     case REPLY_INFO:
     case REPLY_RESULT:
-        if (this->state && m_ptr->RESULT == EOK) {
+        if (m_ptr->opcode == REPLY_INFO && m_ptr->INFO == &this->credit) {
+            this->crediting = FALSE;
+            send_credit();
+        } else if (this->state && m_ptr->RESULT == EOK) {
+            resume();
+        } else if (this->state == VERIFYING_PAGE) {
+            /* a twiboot without page CRCs: read back instead */
+            this->no_crc |= _BV(this->tix);
+            this->state = PAUSING_BEFORE_READBACK;
             resume();
+        } else if (m_ptr->opcode == REPLY_INFO && drop_target()) {
+            /* carry on with the other targets */
         } else {
             this->state = IDLE;
             if (this->headp) {
@@ -206,6 +277,14 @@ PUBLIC uchar_t receive_isp(message *m_ptr)
 
 PRIVATE void start_job(void)
 {
+    this->framed = FALSE;
+    this->failed = 0;
+    this->fcount = 0;
+    this->f_in = this->f_out = this->f_full = 0;
+    this->tix = 0;
+    this->bad = 0;
+    this->gone = 0;
+    this->no_crc = 0;
     this->state = FETCHING_VERSION;
     fetch_version();
 }
@@ -224,6 +303,18 @@ PRIVATE void resume(void)
         for (uchar_t i = 0; i < VERSION_LEN && *s > 0; i++)
             bputc(*s++);
         bputc('\n');
+        if (memcmp_P(this->readbuf, PSTR("TWIBOOT"), 7)) {
+            /* not a bootloader, so no chip info either */
+            this->bad |= _BV(this->tix);
+            this->gone |= _BV(this->tix);
+            this->state = PRINTING_CHIPINFO;
+            bputc('?');
+            bputc('\n');
+        } else if (memcmp_P(this->readbuf, PSTR(PAGE_CRC_VERSION),
+                                    sizeof(PAGE_CRC_VERSION) - 1) < 0) {
+            /* no page CRCs to ask for */
+            this->no_crc |= _BV(this->tix);
+        }
         sae_SER(this->info.ser, this->linebuf, this->lindex);
         break;
 
@@ -242,15 +333,30 @@ PRIVATE void resume(void)
         break;
 
     case PRINTING_CHIPINFO:
-        this->state = REDIRECTING_TO_SELF;
-        send_SET_IOCTL(SER, SIOC_CONSUMER, SELF);
+        if (next_target()) {
+            /* each target's version and chip info in turn */
+            this->state = FETCHING_VERSION;
+            fetch_version();
+        } else if (first_target()) {
+            this->state = REDIRECTING_TO_SELF;
+            send_SET_IOCTL(SER, SIOC_CONSUMER, SELF);
+        } else {
+            this->state = ABORTING;
+            print_prompt('N');
+        }
         break;
 
     case REDIRECTING_TO_SELF:
-        this->state = READY;
+        this->state = PROMPTING;
         print_prompt('.');
         break;
 
+    case PROMPTING:
+        /* a frame may have come in before the prompt was sent */
+        this->state = READY;
+        next_frame();
+        break;
+
     case READY:
         break;
 
@@ -260,32 +366,62 @@ PRIVATE void resume(void)
         break;
 
     case PAUSING_BEFORE_READBACK:
-        this->state = READING_BACK;
-        this->start_loc = this->page_address;
-        fetch_buffer();
+        if (this->no_crc & _BV(this->tix)) {
+            this->state = READING_BACK;
+            this->start_loc = this->page_address;
+            fetch_buffer();
+        } else {
+            this->state = VERIFYING_PAGE;
+            fetch_page_crc();
+        }
         break;
 
-    case LOADING_EEPROM_PAGE:
-        print_prompt('.');
+    case VERIFYING_PAGE:
+        {
+            ushort_t crc = 0;
+            for (ushort_t i = 0; i < sizeof(this->cbuf.page); i++)
+                crc = _crc_xmodem_update(crc, this->cbuf.page[i]);
+
+            if ((this->readbuf[0] << 8 | this->readbuf[1]) == crc) {
+                page_done();
+            } else {
+                /* find out for sure */
+                this->state = READING_BACK;
+                this->start_loc = this->page_address;
+                fetch_buffer();
+            }
+        }
         break;
 
-    case READING_BACK:
-        if (memcmp(this->cbuf.page, this->readbuf, sizeof(this->cbuf.page))) {
+    case LOADING_EEPROM_PAGE:
+        if (next_target()) {
+            load_eeprom_page();
+            break;
+        } else if (!first_target()) {
             this->state = ABORTING;
-            print_prompt('R');
+            print_prompt('N');
             break;
         }
-        this->state = READY;
-        this->dirty = FALSE;
-        memset(this->cbuf.page, '\0', sizeof(this->cbuf.page));
-        if (this->bcount) {
-            parse();
-        } else if (this->seen_eof) {
-            this->seen_eof = FALSE;
+        if (this->framed) {
+            this->state = READY;
+            next_frame();
         } else {
             print_prompt('.');
         }
         break;
+
+    case READING_BACK:
+        if (memcmp(this->cbuf.page, this->readbuf, sizeof(this->cbuf.page))) {
+            if (!this->framed) {
+                this->state = ABORTING;
+                print_prompt('R');
+                break;
+            }
+            /* drop the target and carry on with the rest */
+            this->bad |= _BV(this->tix);
+        }
+        page_done();
+        break;
     
     case PRINTING_PROGRAM_MEMORY:
         /* We arrive here both after fetching a buffer and after printing
@@ -304,11 +440,50 @@ PRIVATE void resume(void)
         }
 
         break;
+
+    case QUERYING_CRCS:
+        this->state = PRINTING_CRCS;
+        print_crcs();
+        break;
+
+    case PRINTING_CRCS:
+        if (this->pindex < this->n_bytes) {
+            print_crcs();
+        } else if (this->end_loc) {
+            fetch_crcs();
+        } else if (++this->tix < this->headp->ntargets) {
+            /* the same pages of the next target, dropped or not */
+            this->start_loc = this->q_addr;
+            this->end_loc = this->q_pages;
+            fetch_crcs();
+        } else if (first_target()) {
+            this->state = READY;
+            this->pindex = 0;
+            next_frame();
+        } else {
+            this->state = ABORTING;
+            print_prompt('N');
+        }
+        break;
+
+    case STARTING_APPLICATION:
+        if (next_target()) {
+            start_application();
+        } else if (this->framed) {
+            this->state = FINISHED;
+            print_results();
+        } else {
+            this->state = FINISHED;
+            resume();
+        }
+        break;
     
     case ABORTING:
     case FINISHED:
         this->state = IDLE;
         this->seen_eof = FALSE;
+        /* any '.' already with SER is answered before the '$' */
+        this->credits = 0;
         print_prompt('$');
         break;
     }
@@ -316,7 +491,7 @@ PRIVATE void resume(void)
 
 PRIVATE void fetch_version(void)
 {
-    sae1_TWI_MR(this->info.twi, this->headp->target,
+    sae1_TWI_MR(this->info.twi, this->headp->target[this->tix],
               CMD_READ_VERSION, this->readbuf, VERSION_LEN);
 }
 
@@ -325,15 +500,15 @@ PRIVATE void fetch_chipinfo(void)
     this->cbuf.cmd[0] = MEMTYPE_CHIPINFO;
     this->cbuf.cmd[1] = 0;
     this->cbuf.cmd[2] = 0;
-    sae1_TWI_MTMR(this->info.twi, this->headp->target, CMD_ACCESS_MEMORY,
-                 this->cbuf.cmd, sizeof(this->cbuf.cmd),
-                 this->readbuf, CHIPINFO_LEN);
+    sae1_TWI_MTMR(this->info.twi, this->headp->target[this->tix],
+                  CMD_ACCESS_MEMORY, this->cbuf.cmd, sizeof(this->cbuf.cmd),
+                  this->readbuf, CHIPINFO_LEN);
 }
 
 PRIVATE void start_application(void)
 {
     this->cbuf.cmd[0] = BOOTTYPE_APPLICATION;
-    sae1_TWI_MT(this->info.twi, this->headp->target,
+    sae1_TWI_MT(this->info.twi, this->headp->target[this->tix],
               CMD_SWITCH_APPLICATION, this->cbuf.cmd, 1);
 }
 
@@ -343,21 +518,57 @@ PRIVATE void load_program_memory_page(void)
     this->cbuf.cmd[0] = MEMTYPE_FLASH;
     this->cbuf.cmd[1] = this->page_address >> 8 & 0xFF;
     this->cbuf.cmd[2] = this->page_address & 0xFF;
-    sae2_TWI_MT(this->info.twi, this->headp->target,
+    sae2_TWI_MT(this->info.twi, this->headp->target[this->tix],
               CMD_ACCESS_MEMORY, this->cbuf);
 }
 
+/* The data is already in cbuf.page. */
 PRIVATE void load_eeprom_page(void)
 {
     this->state = LOADING_EEPROM_PAGE;
-    memcpy(this->cbuf.page, this->r.data.buf, this->r.data.datalen);   
     this->cbuf.cmd[0] = MEMTYPE_EEPROM;
     this->cbuf.cmd[1] = this->r.data.offset_high;
     this->cbuf.cmd[2] = this->r.data.offset_low;
-    sae1_TWI_MT(this->info.twi, this->headp->target,
+    sae1_TWI_MT(this->info.twi, this->headp->target[this->tix],
               CMD_ACCESS_MEMORY, &this->cbuf, this->r.data.datalen +3);
 }
 
+/* twiboot's CRC of the page just written, into readbuf. */
+PRIVATE void fetch_page_crc(void)
+{
+    this->cbuf.cmd[0] = MEMTYPE_PAGE_CRC;
+    this->cbuf.cmd[1] = this->page_address >> 8 & 0xFF;
+    this->cbuf.cmd[2] = this->page_address & 0xFF;
+    sae1_TWI_MTMR(this->info.twi, this->headp->target[this->tix],
+                  CMD_ACCESS_MEMORY, this->cbuf.cmd, sizeof(this->cbuf.cmd),
+                  this->readbuf, 2);
+}
+
+/* The page is in the target: load it into the next target or carry on. */
+PRIVATE void page_done(void)
+{
+    if (next_target()) {
+        load_program_memory_page();
+    } else if (this->bad == _BV(this->headp->ntargets) - 1) {
+        this->state = ABORTING;
+        print_prompt(this->gone == this->bad ? 'N' : 'R');
+    } else {
+        first_target();
+        this->state = READY;
+        this->dirty = FALSE;
+        memset(this->cbuf.page, '\0', sizeof(this->cbuf.page));
+        if (this->framed) {
+            next_frame();
+        } else if (this->bcount) {
+            parse();
+        } else if (this->seen_eof) {
+            this->seen_eof = FALSE;
+        } else {
+            print_prompt('.');
+        }
+    }
+}
+
 PRIVATE void fetch_buffer(void)
 {
     this->start_loc += this->pindex;
@@ -368,8 +579,8 @@ PRIVATE void fetch_buffer(void)
     this->cbuf.cmd[0] = MEMTYPE_FLASH;
     this->cbuf.cmd[1] = this->start_loc >> 8 & 0xFF;
     this->cbuf.cmd[2] = this->start_loc & 0xFF;
-    sae2_TWI_MTMR(this->info.twi, this->headp->target, CMD_ACCESS_MEMORY,
-                  this->cbuf.cmd, this->readbuf);
+    sae2_TWI_MTMR(this->info.twi, this->headp->target[this->tix],
+                  CMD_ACCESS_MEMORY, this->cbuf.cmd, this->readbuf);
 }
 
 PRIVATE void consume(CharProc vp)
@@ -378,7 +589,32 @@ PRIVATE void consume(CharProc vp)
 
     while ((vp) (&ch) == EOK) {
 
+        if (this->state == ABORTING || this->failed) {
+            /* discard the rest of the upload */
+            continue;
+        } else if (this->fcount) {
+            frame_byte(ch);
+            continue;
+        }
+
         switch (ch) {
+        case FRAME_STX:
+            if (this->hcount) {
+                fail('Z');
+            } else if (this->f_full == ISP_FRAMES) {
+                /* more frames than were credited */
+                fail('W');
+            } else {
+                this->fcount = 1;
+                if (!this->framed) {
+                    /* the first slot was credited by the ready prompt */
+                    this->framed = TRUE;
+                    this->credits += ISP_FRAMES - 1;
+                    send_credit();
+                }
+            }
+            break;
+
         case '\n': /* 0x0a */
             if (this->in_record) {
                 this->in_record = FALSE;
@@ -423,6 +659,270 @@ PRIVATE void consume(CharProc vp)
     }
 }
 
+/* Collect a byte of a binary frame. A complete frame with a good CRC is
+ * queued to be loaded as soon as the target is free.
+ */
+PRIVATE void frame_byte(uchar_t ch)
+{
+    frame_t *fp = &this->frame[this->f_in];
+    ushort_t n = this->fcount++ - 1;
+
+    ((uchar_t *)fp)[n] = ch;
+    if (n + 1 == FRAME_HEADER_LEN && fp->len > SPM_PAGESIZE) {
+        this->fcount = 0;
+        fail('Z');
+    } else if (n + 1 == FRAME_HEADER_LEN + fp->len + FRAME_CRC_LEN) {
+        ushort_t crc = 0;
+        this->fcount = 0;
+        for (uchar_t *bp = (uchar_t *)fp; bp < fp->data + fp->len; bp++)
+            crc = _crc_xmodem_update(crc, *bp);
+        if (crc != (fp->data[fp->len] << 8 | fp->data[fp->len + 1])) {
+            fail('X');
+        } else {
+            if (++this->f_in == ISP_FRAMES)
+                this->f_in = 0;
+            this->f_full++;
+            if (this->state == READY)
+                next_frame();
+        }
+    }
+}
+
+/* The target is free: load the oldest frame received into it. */
+PRIVATE void next_frame(void)
+{
+    frame_t *fp = &this->frame[this->f_out];
+
+    if (this->failed) {
+        this->state = ABORTING;
+        print_prompt(this->failed);
+        return;
+    } else if (this->f_full == 0) {
+        return;
+    }
+
+    switch (fp->type) {
+    case FRAME_FLASH:
+        this->page_address = fp->addr_high << 8 | fp->addr_low;
+        if (this->page_address & PROGRAM_PAGE_OFFSET_MASK) {
+            this->state = ABORTING;
+            print_prompt('Z');
+            break;
+        }
+        memset(this->cbuf.page, 0xFF, sizeof(this->cbuf.page));
+        memcpy(this->cbuf.page, fp->data, fp->len);
+        release_frame();
+        load_program_memory_page();
+        break;
+
+    case FRAME_EEPROM:
+        memcpy(this->cbuf.page, fp->data, fp->len);
+        this->r.data.datalen = fp->len;
+        this->r.data.offset_high = fp->addr_high;
+        this->r.data.offset_low = fp->addr_low;
+        release_frame();
+        load_eeprom_page();
+        break;
+
+    case FRAME_QUERY:
+        /* start_loc is the next page, end_loc the pages still to do */
+        this->q_addr = fp->addr_high << 8 | fp->addr_low;
+        this->q_pages = fp->len ? fp->data[0] : 0;
+        this->start_loc = this->q_addr;
+        this->end_loc = this->q_pages;
+        release_frame();
+        this->state = PRINTING_CRCS;
+        this->pindex = this->n_bytes = 0;
+        resume();
+        break;
+
+    case FRAME_END:
+        this->f_full--;
+        this->state = STARTING_APPLICATION;
+        start_application();
+        break;
+
+    default:
+        this->state = ABORTING;
+        print_prompt('Z');
+        break;
+    }
+}
+
+/* The frame has been copied out, so avril may send another. */
+PRIVATE void release_frame(void)
+{
+    if (++this->f_out == ISP_FRAMES)
+        this->f_out = 0;
+    this->f_full--;
+    this->credits++;
+    send_credit();
+}
+
+/* A frame error is reported once the target is free. */
+PRIVATE void fail(uchar_t c)
+{
+    this->failed = c;
+    if (this->state == READY)
+        next_frame();
+}
+
+PRIVATE void send_credit(void)
+{
+    static const uchar_t dot = '.';
+
+    if (this->credits && !this->crediting) {
+        this->credits--;
+        this->crediting = TRUE;
+        sae_SER(this->credit, (void *)&dot, 1);
+    }
+}
+
+/* Read the CRCs of as many pages as readbuf holds from twiboot. Those
+ * of a target that is dropped or has no page CRCs are not asked for.
+ */
+PRIVATE void fetch_crcs(void)
+{
+    uchar_t n = MIN(this->end_loc, SPM_PAGESIZE / 2);
+
+    this->state = QUERYING_CRCS;
+    this->pindex = 0;
+    this->n_bytes = n * 2;
+    this->cbuf.cmd[0] = MEMTYPE_PAGE_CRC;
+    this->cbuf.cmd[1] = this->start_loc >> 8 & 0xFF;
+    this->cbuf.cmd[2] = this->start_loc & 0xFF;
+    this->start_loc += (ulong_t)n * SPM_PAGESIZE;
+    this->end_loc -= n;
+    if ((this->bad | this->no_crc) & _BV(this->tix)) {
+        this->state = PRINTING_CRCS;
+        print_crcs();
+    } else {
+        sae1_TWI_MTMR(this->info.twi, this->headp->target[this->tix],
+                      CMD_ACCESS_MEMORY, this->cbuf.cmd,
+                      sizeof(this->cbuf.cmd), this->readbuf, this->n_bytes);
+    }
+}
+
+/* Print a line of CRCs from readbuf, or of "--" for each byte of those
+ * that were not asked for, which match no page.
+ */
+PRIVATE void print_crcs(void)
+{
+    uchar_t none = (this->bad | this->no_crc) & _BV(this->tix);
+
+    this->lindex = 0;
+    for (uchar_t i = 0; i < FRAME_CRCS_PER_LINE * 2 &&
+                               this->pindex < this->n_bytes; i++) {
+        if (none) {
+            bputc('-');
+            bputc('-');
+            this->pindex++;
+        } else {
+            puthex(this->readbuf[this->pindex++]);
+        }
+    }
+    bputc('\n');
+    sae_SER(this->info.ser, this->linebuf, this->lindex);
+}
+
+/* Begin a page, or whatever, with the first target still being loaded. */
+PRIVATE uchar_t first_target(void)
+{
+    for (this->tix = 0; this->tix < this->headp->ntargets; this->tix++) {
+        if ((this->bad & _BV(this->tix)) == 0)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/* Move on to the next target still being loaded, if there is one. */
+PRIVATE uchar_t next_target(void)
+{
+    uchar_t tix = this->tix;
+
+    while (++tix < this->headp->ntargets) {
+        if ((this->bad & _BV(tix)) == 0) {
+            this->tix = tix;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* The TWI transfer to the current target failed, as when its bootloader
+ * switch is open. Drop the target, as for a failed readback, and carry
+ * on with the others in the state's own way.
+ *
+ * @return TRUE if the job carries on, FALSE if it is to be abandoned.
+ */
+PRIVATE uchar_t drop_target(void)
+{
+    switch (this->state) {
+    case FETCHING_VERSION:
+    case FETCHING_CHIPINFO:
+        /* a '?' for its version, if need be, and its chip info */
+        this->lindex = 0;
+        if (this->state == FETCHING_VERSION) {
+            bputc('?');
+            bputc('\n');
+        }
+        bputc('?');
+        bputc('\n');
+        break;
+
+    case QUERYING_CRCS:
+        /* no page CRCs, as from an older twiboot: send every page */
+        this->no_crc |= _BV(this->tix);
+        this->start_loc -= (ulong_t)this->n_bytes / 2 * SPM_PAGESIZE;
+        this->end_loc += this->n_bytes / 2;
+        fetch_crcs();
+        return TRUE;
+
+    case LOADING_PROGRAM_MEMORY_PAGE:
+    case READING_BACK:
+    case LOADING_EEPROM_PAGE:
+    case STARTING_APPLICATION:
+        if (this->framed)
+            break;
+        /* FALLTHRU */
+    default:
+        /* a hex upload or a memory read stops at the first failure */
+        return FALSE;
+    }
+
+    this->bad |= _BV(this->tix);
+    this->gone |= _BV(this->tix);
+
+    switch (this->state) {
+    case FETCHING_VERSION:
+    case FETCHING_CHIPINFO:
+        this->state = PRINTING_CHIPINFO;
+        sae_SER(this->info.ser, this->linebuf, this->lindex);
+        break;
+
+    case LOADING_EEPROM_PAGE:
+    case STARTING_APPLICATION:
+        resume();
+        break;
+
+    default:
+        page_done();
+        break;
+    }
+    return TRUE;
+}
+
+/* A '+' for each target that was loaded, an 'R' for each whose readback
+ * failed and an 'N' for each that stopped answering.
+ */
+PRIVATE void print_results(void)
+{
+    this->lindex = 0;
+    for (uchar_t i = 0; i < this->headp->ntargets; i++)
+        bputc((this->gone & _BV(i)) ? 'N' : (this->bad & _BV(i)) ? 'R' : '+');
+    sae_SER(this->info.ser, this->linebuf, this->lindex);
+}
+
 /* Assume the input buffer to contain a valid Intel hex format record. */
 PRIVATE void parse(void)
 {
@@ -449,6 +949,7 @@ PRIVATE void proc_record(void)
          *
          */
         if (this->in_eeprom) {
+            memcpy(this->cbuf.page, this->r.data.buf, this->r.data.datalen);
             load_eeprom_page();
         } else {
             addr = this->r.data.offset_high << 8 | this->r.data.offset_low;
@@ -477,7 +978,7 @@ PRIVATE void proc_record(void)
             /* pagebuf residual data */
             load_program_memory_page();
         } else {
-            this->state = FINISHED;
+            this->state = STARTING_APPLICATION;
             start_application();
         }
         break;
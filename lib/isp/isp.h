@@ -34,10 +34,13 @@
 
 #ifndef _MAIN_
 
+#define ISP_TARGETS 8       /* programmed with the same image at once */
+
 typedef struct _isp_info {
     struct _isp_info *nextp;
     ProcNumber replyTo;
-    uchar_t target;         /* i2c address */
+    uchar_t ntargets;
+    uchar_t target[ISP_TARGETS];  /* i2c addresses */
 } isp_info;
 
 #else /* _MAIN_ */
@@ -74,4 +74,8 @@
 #define KEY_REQUEST          176
 #define KEY_REPLY            177
 
+#define FIRST_SERVICE        VOLTAGE_NOTIFY
+#define LAST_SERVICE         KEY_REPLY
+#define SERVICE_SPAN         (LAST_SERVICE - FIRST_SERVICE + 1)
+
 #endif /* _SERVICES_H_ */
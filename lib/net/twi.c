@@ -53,6 +53,13 @@
  * sent as the mcmd. If no match is found within the pool the transaction is
  * terminated and the remote master generates an EACCES (13) error.
  *
+ * The pool is a circular list of the registered twi_infos, referred to by
+ * its tail, the tail's nextp being the head, so a listener is appended
+ * without a search. With TWI_SERVICE_INDEX the pool is a list per Service
+ * number, FIRST_SERVICE to LAST_SERVICE, and the SR address+first-byte
+ * decision only considers the listeners for the received service, however
+ * many are registered. The job queue also keeps a tail pointer.
+ *
  *
  * Master mode is an active transitory condition caused by an internal
  * JOB request message being received, where the mode includes MT or MR.
@@ -81,6 +88,28 @@
  * limited to MAX_NACK_RETRIES, before either ENODEV where the host was
  * unavailable or EACCES where the service was unavailable is returned to
  * the client.
+ *
+ * Both NACK retries and arbitration retries back off exponentially with
+ * jitter, so that contending masters fall out of step. The nth retry waits
+ * for 2^(n-1) milliseconds plus a random part of as much again, the
+ * exponent being limited to BACKOFF_LIMIT. The random sequence is seeded
+ * with HOST_ADDRESS, so each host has its own. A job that loses
+ * arbitration MAX_TRANSMIT_ATTEMPTS times, after about 8 seconds, is
+ * returned with EAGAIN. A bus that stays busy is still retried every
+ * TRANSMIT_DELAY, and after MAX_TRANSMIT_ATTEMPTS of those, 5 seconds,
+ * the job is returned with EHOSTDOWN.
+ *
+ * The master clocks the bus at TWI_FREQ, which is standard mode (100kHz)
+ * unless host.h selects fast mode (400kHz). The destinations listed in
+ * TWI_SM_DESTS or TWI_FM_DESTS in host.h are clocked at that mode instead,
+ * as a slow peripheral or a long bus may require, and a job may override
+ * either with the TWI_SM or TWI_FM flag. TWBR is loaded before each START. A slave follows whatever clock the
+ * remote master provides.
+ *
+ * With TWI_TRACE, each transaction is recorded in the twi_trace ring, with
+ * its first and last status, destination, command and byte count and the
+ * TRACE_TIMER ticks at its first and last interrupt. The ring is read with
+ * the cli dump command and decoded by hal/twitrace.
  */
 
 #include <string.h>
@@ -111,8 +140,20 @@
 #define DISCONTINUE_COMMAND    BASIC_COMMAND
 #define DISCONNECT_COMMAND     _BV(TWINT)
 
-/* set the bus clock frequency for master mode transactions */
-#define TWI_FREQ               100000  /* normal speed */
+/* bus clock frequencies for master mode transactions [UM10204 p.10] */
+#define STANDARD_MODE          100000
+#define FAST_MODE              400000
+
+#ifndef TWI_FREQ
+#define TWI_FREQ               STANDARD_MODE
+#endif
+
+/* The bit rate register value for a frequency, rounded up so that the
+ * clock is never faster than the frequency. [p.222]
+ *    8MHz:     32 (100kHz),  2 (400kHz)
+ *   11.06MHz:  48 (98.7kHz), 6 (395kHz)
+ */
+#define BIT_RATE(f)            ((F_CPU + 2*(f) - 1) / (2*(f)) - 8)
 
 /* Identify the sda pins. Use it for PORTC and DDRC */
 #define SDA_PIN                PINC4
@@ -130,8 +171,11 @@
 #define ONE_HUNDRED_MILLISECONDS 100
 
 #define TRANSMIT_DELAY           ONE_HUNDRED_MILLISECONDS
-#define RETRY_DELAY              ONE_HUNDRED_MILLISECONDS
-#define ARBITRATION_DELAY        ONE_HUNDRED_MILLISECONDS
+
+/* The longest backoff is 2^BACKOFF_LIMIT milliseconds, less one.
+ * 10 NACK retries wait for 0.77s on average, the 7 of 100ms they replace.
+ */
+#define BACKOFF_LIMIT            8
 
 /* _delay_us() constants */
 #define TWO_HUNDRED_NANOSECONDS  0.2
@@ -142,10 +186,101 @@
 #define WRITE_MODE               0
 #define READ_MODE                1
 
-#define MAX_NACK_RETRIES         7
+#define MAX_NACK_RETRIES         10
 
-/* bus busy */
-#define MAX_TRANSMIT_ATTEMPTS    50 /* 50 x 100ms = 5s */
+/* bus busy, or arbitration lost */
+/* A busy bus is retried every TRANSMIT_DELAY, for 5s in all. A lost
+ * arbitration backs off, and its 49 retries take from 5.5s to 11s,
+ * 8.2s on average.
+ */
+#define MAX_TRANSMIT_ATTEMPTS    50
+
+#ifndef TWI_SERVICE_INDEX
+#define TWI_SERVICE_INDEX        0  /* 1 for a listener list per Service */
+#endif
+
+#if TWI_SERVICE_INDEX
+#define POOL_SPAN                SERVICE_SPAN
+#define POOL_SLOT(num)           ((num) - FIRST_SERVICE)
+#else
+#define POOL_SPAN                1
+#define POOL_SLOT(num)           0
+#endif
+
+#if TWI_STATS
+#ifndef TWI_STATS_DESTS
+#define TWI_STATS_DESTS          8  /* destinations with a histogram */
+#endif
+#endif
+
+#if TWI_TRACE
+#ifndef TWI_TRACE_SIZE
+#define TWI_TRACE_SIZE           16 /* transactions held in the ring */
+#endif
+
+/* No timer is free on every host: TIMER0 is most hosts' CLK_TIMER,
+ * TIMER1 is fido's, goat's, sumo's and STW's, and TIMER2 runs oslo's UTC.
+ */
+#ifndef TRACE_TIMER
+#error "TWI_TRACE requires a TRACE_TIMER that is free on this host in host.h"
+#endif
+
+#ifndef CLK_TIMER
+#define CLK_TIMER TIMER0
+#endif
+
+#if (TRACE_TIMER == CLK_TIMER)
+#error "TWI_TRACE requires a TRACE_TIMER other than CLK_TIMER in host.h"
+#endif
+
+#if PROFILE
+#ifndef STW_TIMER
+#define STW_TIMER TIMER1
+#endif
+
+#if (TRACE_TIMER == STW_TIMER)
+#error "TWI_TRACE requires a TRACE_TIMER other than STW_TIMER in host.h"
+#endif
+#endif
+
+/* TRACE_TIMER runs at clkIO/64 [p.117,143,165] */
+#if (TRACE_TIMER == TIMER0)
+# define TRACE_SHIFT 8
+# define TRACE_TCNT TCNT0
+# define TRACE_TCCRB TCCR0B
+# define TRACE_TIMSK TIMSK0
+# define TRACE_TOIE TOIE0
+# define TRACE_TIFR TIFR0
+# define TRACE_TOV TOV0
+# define TRACE_PRTIM PRTIM0
+# define TRACE_DIVIDE_64 (_BV(CS01) | _BV(CS00))
+# define TRACE_OVF_vect TIMER0_OVF_vect
+#elif (TRACE_TIMER == TIMER1)
+# define TRACE_SHIFT 16
+# define TRACE_TCNT TCNT1
+# define TRACE_TCCRB TCCR1B
+# define TRACE_TIMSK TIMSK1
+# define TRACE_TOIE TOIE1
+# define TRACE_TIFR TIFR1
+# define TRACE_TOV TOV1
+# define TRACE_PRTIM PRTIM1
+# define TRACE_DIVIDE_64 (_BV(CS11) | _BV(CS10))
+# define TRACE_OVF_vect TIMER1_OVF_vect
+#elif (TRACE_TIMER == TIMER2)
+# define TRACE_SHIFT 8
+# define TRACE_TCNT TCNT2
+# define TRACE_TCCRB TCCR2B
+# define TRACE_TIMSK TIMSK2
+# define TRACE_TOIE TOIE2
+# define TRACE_TIFR TIFR2
+# define TRACE_TOV TOV2
+# define TRACE_PRTIM PRTIM2
+# define TRACE_DIVIDE_64 _BV(CS22)
+# define TRACE_OVF_vect TIMER2_OVF_vect
+#endif
+
+#define TRACE_MAGIC              'T'
+#endif
 
 /* four byte command */
 #define FBC    (sizeof(Service) + sizeof(ProcNumber) + sizeof(jobref_t))
@@ -166,29 +301,89 @@ typedef enum {
     SLAVING
 } __attribute__ ((packed)) state_t;
 
+#if TWI_TRACE
+/* hal/twitrace.c decodes this layout, so keep them in step */
+typedef struct {
+    ulong_t start;         /* TRACE_TIMER ticks at the first interrupt */
+    ushort_t duration;     /* ticks from the first to the last interrupt */
+    uchar_t first;         /* the status that began the transaction */
+    uchar_t last;          /* the status of its last interrupt */
+    hostid_t addr;         /* dest_addr as master, else 0 */
+    Service cmd;           /* mcmd as master, scmd as slave */
+    uchar_t count;         /* bytes transferred, stopping at 255 */
+} twi_event;
+
+typedef struct {
+    uchar_t magic;         /* TRACE_MAGIC */
+    uchar_t size;          /* TWI_TRACE_SIZE */
+    uchar_t next;          /* the entry to be written next */
+    uchar_t wrapped;       /* TRUE once the ring has been filled */
+    ulong_t rate;          /* ticks per second */
+    twi_event ring[TWI_TRACE_SIZE];
+} twi_trace_t;
+#endif
+
 typedef struct {
     state_t state;
     unsigned alarm_pending : 1;
     twi_info *headp;
-    twi_info *pool;
+    twi_info *tailp;
+    twi_info *pool[POOL_SPAN];  /* tail of the listeners */
+    uchar_t listeners;
     twi_info *slavep;
     uchar_t *tptr;
     ushort_t tcnt;
     uchar_t gc_tally;
     clk_info clk;
     uchar_t nack_retries;
+    uchar_t arbitration_losses;
     uchar_t transmit_attempts;
+    ushort_t seed;         /* of the backoff jitter */
     uchar_t fbc_buf[FBC];
     uchar_t fbc_count;
+    ulong_t bytes[2];      /* transferred as TWI_MASTER and TWI_SLAVE */
+#if TWI_STATS
+    uchar_t dests;
+    twi_histogram hist[TWI_STATS_DESTS];
+#endif
+#if TWI_TRACE
+    ulong_t epoch;         /* TRACE_TIMER overflows */
+    ulong_t mark;          /* bytes[] total at the start of the transaction */
+    uchar_t last_status;
+#endif
 } twi_t;
 
 /* I have .. */
 static twi_t this;
+#if TWI_TRACE
+static twi_trace_t twi_trace;
+#endif
+#ifdef TWI_SM_DESTS
+static const hostid_t __flash sm_dests[] = { TWI_SM_DESTS };
+#endif
+#ifdef TWI_FM_DESTS
+static const hostid_t __flash fm_dests[] = { TWI_FM_DESTS };
+#endif
 
 /* I can .. */
 PRIVATE void start_job(void);
 PRIVATE uchar_t cancel_job(twi_info *ip);
 PRIVATE twi_info *scan_pool(Service num);
+PRIVATE uchar_t pool_add(twi_info *ip);
+PRIVATE uchar_t pool_remove(twi_info *ip);
+PRIVATE twi_info *match_listener(uchar_t flags);
+PRIVATE uchar_t bit_rate(twi_info *ip);
+#if defined(TWI_SM_DESTS) || defined(TWI_FM_DESTS)
+PRIVATE bool_t is_listed(const hostid_t __flash *dp, uchar_t n, hostid_t addr);
+#endif
+PRIVATE ushort_t backoff(uchar_t n);
+PRIVATE void retire(twi_info *ip);
+#if TWI_TRACE
+PRIVATE void trace(uchar_t status);
+#endif
+#if TWI_STATS
+PRIVATE uchar_t bin(uchar_t n);
+#endif
 
 PRIVATE void tw_bus_error(void);
 PRIVATE void tw_start(void);
@@ -228,10 +423,24 @@ PUBLIC void config_twi(void)
      *
      * For 11.0592 MHz clock:-
      * 47 = (11059200 / 100538 - 16) / 2
+     *
+     * For 400kHz:-
+     * 2 = (8000000 / 400000 - 16) / 2
+     * 6 = (11059200 / 394971 - 16) / 2
      */
     TWSR = PRESCALE_ONE;
-    TWBR = (F_CPU / TWI_FREQ - 16) / 2;
+    TWBR = BIT_RATE(TWI_FREQ);
     TWAR = HOST_ADDRESS;
+    this.seed = (HOST_ADDRESS << 8) | HOST_ADDRESS;
+
+#if TWI_TRACE
+    twi_trace.magic = TRACE_MAGIC;
+    twi_trace.size = TWI_TRACE_SIZE;
+    twi_trace.rate = F_CPU / 64;
+    PRR &= ~_BV(TRACE_PRTIM);
+    TRACE_TIMSK |= _BV(TRACE_TOIE);
+    TRACE_TCCRB = TRACE_DIVIDE_64;  /* normal mode 0 */
+#endif
 }
 
 PUBLIC uchar_t receive_twi(message *m_ptr)
@@ -244,6 +453,9 @@ PUBLIC uchar_t receive_twi(message *m_ptr)
         break;
 
     case MASTER_COMPLETE:
+      {
+        twi_info *jp = this.headp;
+
         switch (m_ptr->RESULT) {
         case EOK:
             /* Remove the info from the job queue.
@@ -251,27 +463,13 @@ PUBLIC uchar_t receive_twi(message *m_ptr)
              * then it is appended to the slave list, else notify the
              * caller that the job has completed.
              */
-            this.nack_retries = 0;
             if (this.headp->mode & TWI_SR) {
                 twi_info *ip = this.headp;
                 this.headp = this.headp->nextp;
-                ip->nextp = NULL;
-
-                if (!this.pool) {
-                    this.pool = ip;
-                } else {
-                    twi_info *tp;
-                    for (tp = this.pool; tp->nextp; tp = tp->nextp) {
-                        ;
-                    }
-                    tp->nextp = ip;
-                }
 
-                if (ip->mode & TWI_GC) {
-                    this.gc_tally++;
-                    TWAR |= _BV(TWGCE);
+                if (pool_add(ip) != EOK) {
+                    send_REPLY_INFO(ip->replyTo, EINVAL, ip);
                 }
-
             } else {
                 send_REPLY_INFO(this.headp->replyTo, m_ptr->RESULT, this.headp);
                 this.headp = this.headp->nextp;
@@ -283,19 +481,25 @@ PUBLIC uchar_t receive_twi(message *m_ptr)
             if (this.nack_retries++ < MAX_NACK_RETRIES) {
                 if (this.alarm_pending == FALSE) {
                     this.alarm_pending = TRUE;
-                    sae_CLK_SET_ALARM(this.clk, RETRY_DELAY);
+                    sae_CLK_SET_ALARM(this.clk, backoff(this.nack_retries));
                 }
             } else {
-                this.nack_retries = 0;
+                this.nack_retries--;
                 send_REPLY_INFO(this.headp->replyTo, m_ptr->RESULT, this.headp);
                 this.headp = this.headp->nextp;
             }
             break;
 
         case EAGAIN: /* TW_MT_ARB_LOST: try again */
-            if (this.alarm_pending == FALSE) {
-                this.alarm_pending = TRUE;
-                sae_CLK_SET_ALARM(this.clk, ARBITRATION_DELAY); 
+            if (++this.arbitration_losses < MAX_TRANSMIT_ATTEMPTS) {
+                if (this.alarm_pending == FALSE) {
+                    this.alarm_pending = TRUE;
+                    sae_CLK_SET_ALARM(this.clk,
+                                      backoff(this.arbitration_losses));
+                }
+            } else {
+                send_REPLY_INFO(this.headp->replyTo, m_ptr->RESULT, this.headp);
+                this.headp = this.headp->nextp;
             }
             break;
 
@@ -304,13 +508,16 @@ PUBLIC uchar_t receive_twi(message *m_ptr)
             this.headp = this.headp->nextp;
             break;
         }
+        if (this.headp != jp)
+            retire(jp);
         this.state = IDLE;
 
         if (this.alarm_pending == FALSE && this.headp) {
             start_job();
         } else {
-            TWCR = this.pool ? CONTINUE_COMMAND : DISCONTINUE_COMMAND;
+            TWCR = this.listeners ? CONTINUE_COMMAND : DISCONTINUE_COMMAND;
         }
+      }
         break;
 
     case SLAVE_COMPLETE:
@@ -319,18 +526,7 @@ PUBLIC uchar_t receive_twi(message *m_ptr)
             if (this.slavep->mode & TWI_GC && --this.gc_tally == 0) {
                 TWAR &= ~_BV(TWGCE);
             }
-            if (this.pool == this.slavep) {
-                /* It's at the head of the list. */
-                this.pool = this.slavep->nextp;
-            } else {
-                for (twi_info *ip = this.pool; ip; ip = ip->nextp) {
-                    if (ip->nextp == this.slavep) {
-                        ip->nextp = this.slavep->nextp;
-                        break;
-                    }
-                }
-            }
-
+            pool_remove(this.slavep);
             send_REPLY_INFO(this.slavep->replyTo, m_ptr->RESULT, this.slavep);
             this.slavep = NULL;
         }
@@ -340,7 +536,7 @@ PUBLIC uchar_t receive_twi(message *m_ptr)
         if (this.alarm_pending == FALSE && this.headp) {
             start_job();
         } else {
-            TWCR = this.pool ? CONTINUE_COMMAND : DISCONTINUE_COMMAND;
+            TWCR = this.listeners ? CONTINUE_COMMAND : DISCONTINUE_COMMAND;
         }
         break;
 
@@ -351,32 +547,17 @@ PUBLIC uchar_t receive_twi(message *m_ptr)
             ip->nextp = NULL;
             if (ip->mode & TWI_MT) {
                 if (!this.headp) {
-                    this.headp = ip;
+                    this.headp = this.tailp = ip;
                     start_job();
                 } else {
-                    twi_info *tp;
-                    for (tp = this.headp; tp->nextp; tp = tp->nextp)
-                        ;
-                    tp->nextp = ip;
+                    this.tailp->nextp = ip;
+                    this.tailp = ip;
                 }
             } else if (ip->mode & TWI_SR) {
-                if (!this.pool) {
-                    this.pool = ip;
-                } else {
-                    twi_info *tp;
-                    for (tp = this.pool; tp->nextp; tp = tp->nextp) {
-                        ;
-                    }
-                    tp->nextp = ip;
-                }
-
-                if (ip->mode & TWI_GC) {
-                    this.gc_tally++;
-                    TWAR |= _BV(TWGCE);
-                }
-
-                if (this.state == IDLE) {
-                    TWCR = this.pool ? CONTINUE_COMMAND : DISCONTINUE_COMMAND;
+                if (pool_add(ip) != EOK) {
+                    send_REPLY_INFO(ip->replyTo, EINVAL, ip);
+                } else if (this.state == IDLE) {
+                    TWCR = CONTINUE_COMMAND;
                 }
             } else {
                 /* where there is neither MT nor SR phase */
@@ -457,7 +638,7 @@ PRIVATE void start_job(void)
                 if ((PINC & TWI_PINS) != TWI_PINS) {
                     /* acknowledge the slave address whilst we wait. */
                     this.state = IDLE;
-                    TWCR = this.pool ? CONTINUE_COMMAND : DISCONTINUE_COMMAND;
+                    TWCR = this.listeners ? CONTINUE_COMMAND : DISCONTINUE_COMMAND;
                     sei();
                     if (++this.transmit_attempts == MAX_TRANSMIT_ATTEMPTS) {
                         this.transmit_attempts = 0;
@@ -470,6 +651,7 @@ PRIVATE void start_job(void)
                 }
             }
             /* proceed */
+            TWBR = bit_rate(this.headp);
             TWCR = START_COMMAND;
             sei();
             this.transmit_attempts = 0;
@@ -497,48 +679,227 @@ PRIVATE uchar_t cancel_job(twi_info *ip)
                 return EBUSY;
             } else {
                 this.headp = ip->nextp;
+                this.nack_retries = this.arbitration_losses = 0;
                 return EOK;
             }
         } else {
             for (twi_info *tp = this.headp; tp->nextp; tp = tp->nextp) {
                 if (tp->nextp == ip) {
                     tp->nextp = ip->nextp;
+                    if (this.tailp == ip)
+                        this.tailp = tp;
                     return EOK;
                 }
             }
         }
     }
 
-    if (this.pool && (ip->mode & TWI_SR)) {
+    if (this.listeners && (ip->mode & TWI_SR)) {
         if (this.slavep == ip) {
             return EBUSY;
         } else {
-            if (this.pool == ip) {
-                this.pool = ip->nextp;
-                return EOK;
-            } else {
-                for (twi_info *tp = this.pool; tp->nextp; tp = tp->nextp) {
-                    if (tp->nextp == ip) {
-                        tp->nextp = ip->nextp;
-                        return EOK;
-                    }
-                }
-            }
+            return pool_remove(ip);
         }
     }
     return ESRCH;
 }
 
+/* The bit rate register value for a job: its own speed class, else that
+ * of its destination, else the host's.
+ */
+PRIVATE uchar_t bit_rate(twi_info *ip)
+{
+    if (ip->mode & TWI_FM)
+        return BIT_RATE(FAST_MODE);
+    else if (ip->mode & TWI_SM)
+        return BIT_RATE(STANDARD_MODE);
+#ifdef TWI_SM_DESTS
+    else if (is_listed(sm_dests, sizeof(sm_dests), ip->dest_addr))
+        return BIT_RATE(STANDARD_MODE);
+#endif
+#ifdef TWI_FM_DESTS
+    else if (is_listed(fm_dests, sizeof(fm_dests), ip->dest_addr))
+        return BIT_RATE(FAST_MODE);
+#endif
+    else
+        return BIT_RATE(TWI_FREQ);
+}
+
+#if defined(TWI_SM_DESTS) || defined(TWI_FM_DESTS)
+/* Whether addr is among the n destinations at dp. */
+PRIVATE bool_t is_listed(const hostid_t __flash *dp, uchar_t n, hostid_t addr)
+{
+    for (; n; n--, dp++) {
+        if (*dp == addr)
+            return TRUE;
+    }
+    return FALSE;
+}
+#endif
+
+/* A delay in milliseconds for the nth retry, 1 <= n.
+ * 2^(n-1) plus a random part of as much again, from a 16-bit xorshift.
+ */
+PRIVATE ushort_t backoff(uchar_t n)
+{
+    ushort_t half = 1 << (MIN(n, BACKOFF_LIMIT) - 1);
+
+    this.seed ^= this.seed << 7;
+    this.seed ^= this.seed >> 9;
+    this.seed ^= this.seed << 8;
+    return half + (this.seed & (half - 1));
+}
+
+#if TWI_STATS
+/* The histogram bin for n: 0, 1, 2-3, 4-7 or 8 and more. */
+PRIVATE uchar_t bin(uchar_t n)
+{
+    uchar_t b = 0;
+
+    for (; n && b < TWI_BINS - 1; n >>= 1)
+        b++;
+    return b;
+}
+#endif
+
+/* The job has left the queue, so count its retries and start afresh. */
+PRIVATE void retire(twi_info *ip)
+{
+#if TWI_STATS
+    if (ip->dest_addr != HOST_ADDRESS) {
+        twi_histogram *hp = this.hist;
+        for (uchar_t i = 0; i < this.dests; i++, hp++) {
+            if (hp->dest_addr == ip->dest_addr)
+                break;
+        }
+        if (hp < this.hist + TWI_STATS_DESTS) {
+            if (hp == this.hist + this.dests) {
+                hp->dest_addr = ip->dest_addr;
+                this.dests++;
+            }
+            /* each counter stops at 255 */
+            uchar_t *cp = &hp->retries[bin(this.nack_retries)];
+            if (*cp != 0xFF)
+                (*cp)++;
+            cp = &hp->losses[bin(this.arbitration_losses)];
+            if (*cp != 0xFF)
+                (*cp)++;
+        }
+    }
+#endif
+    this.nack_retries = this.arbitration_losses = 0;
+}
+
+/* Return the first listener registered for the service, else NULL. */
 PRIVATE twi_info *scan_pool(Service num)
 {
-    twi_info *ip = this.pool; 
-    for (; ip; ip = ip->nextp) {
-        if (ip->scmd == num)
-            return ip;
+    if (num < FIRST_SERVICE || num > LAST_SERVICE)
+        return NULL;
+
+    twi_info *tailp = this.pool[POOL_SLOT(num)];
+    if (tailp) {
+        twi_info *ip = tailp;
+        do {
+            ip = ip->nextp;
+            if (ip->scmd == num)
+                return ip;
+        } while (ip != tailp);
     }
     return NULL;
 }
 
+/* Append the listener to the list for its service.
+ *
+ * @return EOK if it has been added.
+ *         EINVAL if its scmd is not a Service number.
+ */
+PRIVATE uchar_t pool_add(twi_info *ip)
+{
+    if (ip->scmd < FIRST_SERVICE || ip->scmd > LAST_SERVICE)
+        return EINVAL;
+
+    twi_info **tailpp = &this.pool[POOL_SLOT(ip->scmd)];
+    if (*tailpp) {
+        ip->nextp = (*tailpp)->nextp;
+        (*tailpp)->nextp = ip;
+    } else {
+        ip->nextp = ip;
+    }
+    *tailpp = ip;
+    this.listeners++;
+
+    if (ip->mode & TWI_GC) {
+        this.gc_tally++;
+        TWAR |= _BV(TWGCE);
+    }
+    return EOK;
+}
+
+/* Unlink the listener from the list for its service.
+ *
+ * @return EOK if it has been found and released.
+ *         ESRCH if it is not found.
+ */
+PRIVATE uchar_t pool_remove(twi_info *ip)
+{
+    if (ip->scmd < FIRST_SERVICE || ip->scmd > LAST_SERVICE)
+        return ESRCH;
+
+    twi_info **tailpp = &this.pool[POOL_SLOT(ip->scmd)];
+    if (*tailpp) {
+        twi_info *tp = *tailpp;
+        do {
+            if (tp->nextp == ip) {
+                if (ip->nextp == ip) {
+                    *tailpp = NULL;
+                } else {
+                    tp->nextp = ip->nextp;
+                    if (*tailpp == ip)
+                        *tailpp = tp;
+                }
+                this.listeners--;
+                return EOK;
+            }
+            tp = tp->nextp;
+        } while (tp != *tailpp);
+    }
+    return ESRCH;
+}
+
+/* Find the listener for the four byte command in fbc_buf, preferring one
+ * that expects this sender and jobref over one that accepts ANY.
+ * flags is TWI_GC for a general call, else 0.
+ */
+PRIVATE twi_info *match_listener(uchar_t flags)
+{
+    Service num = this.fbc_buf[0];
+
+    if (num < FIRST_SERVICE || num > LAST_SERVICE)
+        return NULL;
+
+    twi_info *tailp = this.pool[POOL_SLOT(num)];
+    twi_info *anyp = NULL;
+
+    if (tailp) {
+        twi_info *ip = tailp;
+        do {
+            ip = ip->nextp;
+            if (ip->scmd == num && (ip->mode & flags) == flags) {
+                if (memcmp(ip->rptr, this.fbc_buf +1, FBC -1) == 0) {
+                    /* a specific listener */
+                    return ip;
+                } else if (!anyp && ip->rptr[0] == ANY) {
+                    anyp = ip;
+                }
+            }
+        } while (ip != tailp);
+    }
+    if (anyp) {
+        memcpy(anyp->rptr, this.fbc_buf +1, FBC -1);
+    }
+    return anyp;
+}
+
 /* -----------------------------------------------------
    Handle a TWI interrupt.
    This appears as <__vector_24>: in the .lst file.
@@ -576,11 +937,81 @@ ISR(TWI_vect)
         [_IV(TW_ST_LAST_DATA)]          = tw_st_last_data,
         [_IV(TW_NO_INFO)]               = tw_no_info
     };
+#if TWI_TRACE
+    uchar_t status = TW_STATUS;
+#endif
     PTF_void f_ptr = (PTF_void) pgm_read_word_near(functab_ + _IV(TW_STATUS));
     if (f_ptr)
         (f_ptr) ();
+#if TWI_TRACE
+    trace(status);
+#endif
 }
 
+#if TWI_TRACE
+/* -----------------------------------------------------
+   Handle a TRACE_TIMER Overflow interrupt.
+   -----------------------------------------------------*/
+ISR(TRACE_OVF_vect)
+{
+    this.epoch++;
+}
+
+/* Record the status in the transaction to which it belongs.
+ * A START or an own address begins a transaction, other than the SLA+R
+ * that follows an SR phase in a combined transaction.
+ */
+PRIVATE void trace(uchar_t status)
+{
+    ulong_t now = (this.epoch << TRACE_SHIFT) + TRACE_TCNT;
+    if (TRACE_TIFR & _BV(TRACE_TOV)) {
+        /* TCNT has wrapped since the epoch was counted, so read it again */
+        now = ((this.epoch + 1) << TRACE_SHIFT) + TRACE_TCNT;
+    }
+    ulong_t total = this.bytes[TWI_MASTER] + this.bytes[TWI_SLAVE];
+
+    switch (status) {
+    case TW_ST_SLA_ACK:
+    case TW_ST_ARB_LOST_SLA_ACK:
+        if (this.last_status == TW_SR_STOP)
+            break;
+        /* fall through */
+    case TW_START:
+    case TW_SR_SLA_ACK:
+    case TW_SR_ARB_LOST_SLA_ACK:
+    case TW_SR_GCALL_ACK:
+    case TW_SR_ARB_LOST_GCALL_ACK:
+        {
+            twi_event *ep = &twi_trace.ring[twi_trace.next];
+            if (++twi_trace.next == TWI_TRACE_SIZE) {
+                twi_trace.next = 0;
+                twi_trace.wrapped = TRUE;
+            }
+            ep->start = now;
+            ep->first = status;
+            if (status == TW_START) {
+                ep->addr = this.headp->dest_addr;
+                ep->cmd = this.headp->mcmd;
+            } else {
+                ep->addr = 0;
+                ep->cmd = 0;
+            }
+            this.mark = total;
+        }
+        break;
+    }
+
+    twi_event *ep = &twi_trace.ring[(twi_trace.next ? twi_trace.next :
+                                                   TWI_TRACE_SIZE) - 1];
+    ep->duration = MIN(now - ep->start, 0xFFFF);
+    ep->last = status;
+    ep->count = MIN(total - this.mark, 0xFF);
+    if (!ep->cmd && this.slavep)
+        ep->cmd = this.slavep->scmd;
+    this.last_status = status;
+}
+#endif
+
 PRIVATE void tw_bus_error(void)
 {
     /* A: illegal start or stop condition [0x00] */
@@ -623,6 +1054,7 @@ PRIVATE void tw_mt_sla_ack(void)
     TWDR = this.headp->mcmd;
     _delay_us(DATA_SETUP_TIME);
     TWCR = CONTINUE_COMMAND;
+    this.bytes[TWI_MASTER]++;
 }
 
 PRIVATE void tw_mt_sla_nack(void)
@@ -645,6 +1077,7 @@ PRIVATE void tw_mt_data_ack(void)
         TWDR = *this.tptr++;
         _delay_us(DATA_SETUP_TIME);
         TWCR = CONTINUE_COMMAND;
+        this.bytes[TWI_MASTER]++;
     } else {
         /* The slave (subroutine U:) cannot differentiate
          * between STOP and REPEATED START
@@ -702,6 +1135,7 @@ PRIVATE void tw_mr_data_ack(void)
         this.headp->rcnt--;
         *this.headp->rptr++ = TWDR;
         TWCR = CONTINUE_COMMAND;
+        this.bytes[TWI_MASTER]++;
     } else {
         TWCR = DISCONTINUE_COMMAND;
     }
@@ -713,6 +1147,7 @@ PRIVATE void tw_mr_data_nack(void)
     if (this.headp->rcnt) {
         this.headp->rcnt--;
         *this.headp->rptr++ = TWDR;
+        this.bytes[TWI_MASTER]++;
     }
     /* slave empty */
     /* this.headp->rcnt indicates by how much the request falls short. */
@@ -776,32 +1211,13 @@ PRIVATE void tw_sr_data_ack(void)
         if (this.fbc_count < FBC) {
             this.fbc_buf[this.fbc_count++] = TWDR;
             TWCR = CONTINUE_COMMAND;
+            this.bytes[TWI_SLAVE]++;
             if (this.fbc_count < FBC)
                 return;
             /* Find a slave that matches the received four byte command. */
-            /* search for a specific listener */
-            for (twi_info *ip = this.pool; ip; ip = ip->nextp) {
-                if (ip->scmd == this.fbc_buf[0] &&
-                       memcmp(ip->rptr, this.fbc_buf +1, FBC -1) == 0) {
-                    ip->rptr += FBC -1;
-                    ip->rcnt -= FBC -1;
-                    this.slavep = ip;
-                    TWCR = CONTINUE_COMMAND;
-                    break;
-                }
-            }
-            if (!this.slavep) {
-                /* search for ANY listener */
-                for (twi_info *ip = this.pool; ip; ip = ip->nextp) {
-                    if (ip->scmd == this.fbc_buf[0] && ip->rptr[0] == ANY) {
-                        memcpy(ip->rptr, this.fbc_buf +1, FBC -1);
-                        ip->rptr += FBC -1;
-                        ip->rcnt -= FBC -1;
-                        this.slavep = ip;
-                        TWCR = CONTINUE_COMMAND;
-                        break;
-                    }
-                }
+            if ((this.slavep = match_listener(0)) != NULL) {
+                this.slavep->rptr += FBC -1;
+                this.slavep->rcnt -= FBC -1;
             }
         }
         this.fbc_count = 0;
@@ -819,6 +1235,7 @@ PRIVATE void tw_sr_data_ack(void)
             this.slavep->rcnt--;
             *this.slavep->rptr++ = TWDR;
             TWCR = this.slavep->rcnt ? CONTINUE_COMMAND : DISCONTINUE_COMMAND;
+            this.bytes[TWI_SLAVE]++;
         } else {
             TWCR = DISCONTINUE_COMMAND;
             send_SLAVE_COMPLETE(EBADE); /* Invalid exchange: 52 */
@@ -840,33 +1257,13 @@ PRIVATE void tw_sr_gcall_data_ack(void)
         if (this.fbc_count < FBC) {
             this.fbc_buf[this.fbc_count++] = TWDR;
             TWCR = CONTINUE_COMMAND;
+            this.bytes[TWI_SLAVE]++;
             if (this.fbc_count < FBC)
                 return;
-            /* Find a slave that matches the received four byte command. */
-            /* search for a specific GC listener */
-            for (twi_info *ip = this.pool; ip; ip = ip->nextp) {
-                if ((ip->mode & TWI_GC) && ip->scmd == this.fbc_buf[0] &&
-                       memcmp(ip->rptr, this.fbc_buf +1, FBC -1) == 0) {
-                    ip->rptr += FBC -1;
-                    ip->rcnt -= FBC -1;
-                    this.slavep = ip;
-                    TWCR = CONTINUE_COMMAND;
-                    break;
-                }
-            }
-            if (!this.slavep) {
-                /* search for ANY GC listener */
-                for (twi_info *ip = this.pool; ip; ip = ip->nextp) {
-                    if ((ip->mode & TWI_GC) && ip->scmd == this.fbc_buf[0] &&
-                           ip->rptr[0] == ANY) {
-                        memcpy(ip->rptr, this.fbc_buf +1, FBC -1);
-                        ip->rptr += FBC -1;
-                        ip->rcnt -= FBC -1;
-                        this.slavep = ip;
-                        TWCR = CONTINUE_COMMAND;
-                        break;
-                    }
-                }
+            /* Find a GC slave that matches the received four byte command. */
+            if ((this.slavep = match_listener(TWI_GC)) != NULL) {
+                this.slavep->rptr += FBC -1;
+                this.slavep->rcnt -= FBC -1;
             }
         }
         this.fbc_count = 0;
@@ -883,6 +1280,7 @@ PRIVATE void tw_sr_gcall_data_ack(void)
             this.slavep->rcnt--;
             *this.slavep->rptr++ = TWDR;
             TWCR = this.slavep->rcnt ? CONTINUE_COMMAND : DISCONTINUE_COMMAND;
+            this.bytes[TWI_SLAVE]++;
         } else {
             TWCR = DISCONTINUE_COMMAND;
             send_SLAVE_COMPLETE(EBADE); /* Invalid exchange: 52 */
@@ -952,6 +1350,7 @@ PRIVATE void tw_st_data_ack(void)
     this.slavep->tcnt--;
     _delay_us(DATA_SETUP_TIME);
     TWCR = this.slavep->tcnt ? CONTINUE_COMMAND : DISCONTINUE_COMMAND;
+    this.bytes[TWI_SLAVE]++;
 }
 
 PRIVATE void tw_st_data_nack(void)
@@ -983,7 +1382,46 @@ PRIVATE void tw_no_info(void)
 
 /* These functions are an alternative to the send_JOB() macro in
  * msg.h and assume that send_m3() is used to convey JOB requests.
+ * A client may add TWI_SM or TWI_FM to cp->mode after the call, as TWI
+ * does not examine the job until the client has returned.
+ */
+
+/* The number of bytes transferred in the role since the last clear. */
+PUBLIC ulong_t twi_bytes(uchar_t role)
+{
+    uchar_t sreg = SREG;
+    cli();
+    ulong_t n = this.bytes[role];
+    SREG = sreg;
+    return n;
+}
+
+PUBLIC void twi_clear_bytes(void)
+{
+    uchar_t sreg = SREG;
+    cli();
+    this.bytes[TWI_MASTER] = this.bytes[TWI_SLAVE] = 0;
+    SREG = sreg;
+}
+
+#if TWI_STATS
+/* Copy the ith destination's histograms.
+ * @return EOK, or ESRCH beyond the destinations seen so far.
  */
+PUBLIC uchar_t twi_histograms(uchar_t i, twi_histogram *hp)
+{
+    if (i >= this.dests)
+        return ESRCH;
+    *hp = this.hist[i];
+    return EOK;
+}
+
+PUBLIC void twi_clear_histograms(void)
+{
+    memset(this.hist, 0, sizeof(this.hist));
+    this.dests = 0;
+}
+#endif
 
 PUBLIC void send_TWI_MT(ProcNumber sender, twi_info *cp, hostid_t dest_addr,
                               uchar_t mcmd, void *tptr, ushort_t tcnt)
@@ -46,9 +46,24 @@ typedef void (*Callback) (void *ptr);
 
 /* flags */
 #define TWI_GC 0x10           /* respond to general call */
+#define TWI_SM 0x20           /* master at standard mode, 100kHz */
+#define TWI_FM 0x40           /* master at fast mode, 400kHz */
+
+/* twi_bytes() roles */
+#define TWI_MASTER 0
+#define TWI_SLAVE  1
 
 typedef uchar_t Service;
 
+/* retry histogram bins of 0, 1, 2-3, 4-7 and 8 or more */
+#define TWI_BINS 5
+
+typedef struct {
+    hostid_t dest_addr;
+    uchar_t retries[TWI_BINS];  /* jobs by the number of NACK retries */
+    uchar_t losses[TWI_BINS];   /* jobs by the number of arbitrations lost */
+} twi_histogram;
+
 typedef struct {
     ProcNumber taskid;        /* task level addressing */
     jobref_t jobref;          /* job level addressing */
@@ -67,7 +82,7 @@ typedef struct _twi_info {
     Service scmd;             /* slave first byte */
     uchar_t *rptr;            /* receive buffer pointer */
     ushort_t rcnt;            /* receive down counter */
-    uchar_t mode;             /* mode MT|MR|SR|ST and flags GC */
+    uchar_t mode;             /* mode MT|MR|SR|ST and flags GC|SM|FM */
     Callback st_callback;     /* SR-ST changeover function */
 } twi_info;
 
@@ -144,6 +159,14 @@ PUBLIC void send_TWI_CANCEL (
     twi_info *cp
 );
 
+PUBLIC ulong_t twi_bytes(uchar_t role);
+PUBLIC void twi_clear_bytes(void);
+
+#if TWI_STATS
+PUBLIC uchar_t twi_histograms(uchar_t i, twi_histogram *hp);
+PUBLIC void twi_clear_histograms(void);
+#endif
+
 /* convenience macros insert SELF in the sender arg. */
 
 #define sae1_TWI_MT(a,b,c,d,e) \
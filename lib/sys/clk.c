@@ -44,10 +44,26 @@
  * CANCEL references the job to be cancelled. This generates a
  * REPLY_INFO with EOK if it succeeded or ESRCH if it was not found.
  *
- * Uses TIMER n in normal mode. [p.131]
+ * Uses TIMER n in normal mode. [p.131] The counter runs freely whilst
+ * there are pending alarms. The overflow interrupt turns the wheel and the
+ * compare match A interrupt is programmed for the next expiry within the
+ * current overflow period, so the cpu is woken by neither in between.
  *
- * Where two alarms expire in the same instant, sequence them over successive
- * interrupts. This avoids having an overrun in the message fifo.
+ * Pending alarms are kept in a hierarchical timer wheel. Each overflow
+ * period of the timer is a step. Level 0 has a slot for each of the next
+ * WHEEL_SIZE steps, level 1 a slot for each of the next WHEEL_SIZE runs of
+ * level 0, and anything further away waits in the far list. The slots are
+ * unsorted lists, so an alarm is inserted or cancelled without a search.
+ * Whenever level 0 comes round, the next level 1 slot is redistributed into
+ * it, and whenever level 1 comes round, so is the far list.
+ *
+ * A clk_info is pending only if the table of pending alarms holds it at its
+ * index, so that nothing is followed from a clk_info that is not. A client
+ * that sets an alarm when CLK_ALARMS are pending receives an ENOSPC ALARM.
+ *
+ * Each interrupt drains the current level 0 slot. Where more than
+ * CLK_BATCH alarms expire in the same instant, the rest are sent SPACING
+ * ticks later. This avoids having an overrun in the message fifo.
  *
  */
 
@@ -109,7 +125,11 @@
 # define PRTIMn PRTIM0
 # define TIFRn TIFR0
 # define TOVn TOV0
+# define OCRnA OCR0A
+# define OCIEnA OCIE0A
+# define OCFnA OCF0A
 # define TIMERn_OVF_vect TIMER0_OVF_vect
+# define TIMERn_COMPA_vect TIMER0_COMPA_vect
 #elif (CLK_TIMER == TIMER1)
 # define MAX_COUNT 0xFFFF
 # define TIMSKn TIMSK1
@@ -121,7 +141,11 @@
 # define PRTIMn PRTIM1
 # define TIFRn TIFR1
 # define TOVn TOV1
+# define OCRnA OCR1A
+# define OCIEnA OCIE1A
+# define OCFnA OCF1A
 # define TIMERn_OVF_vect TIMER1_OVF_vect
+# define TIMERn_COMPA_vect TIMER1_COMPA_vect
 #elif (CLK_TIMER == TIMER2)
 # define MAX_COUNT 0xFF
 # define TIMSKn TIMSK2
@@ -133,7 +157,23 @@
 # define PRTIMn PRTIM2
 # define TIFRn TIFR2
 # define TOVn TOV2
+# define OCRnA OCR2A
+# define OCIEnA OCIE2A
+# define OCFnA OCF2A
 # define TIMERn_OVF_vect TIMER2_OVF_vect
+# define TIMERn_COMPA_vect TIMER2_COMPA_vect
+#endif
+
+#ifndef CLK_WHEEL_BITS
+#define CLK_WHEEL_BITS 3    /* 8 slots at each level */
+#endif
+
+#ifndef CLK_ALARMS
+#define CLK_ALARMS 8        /* pending at once, one for each task as a rule */
+#endif
+
+#ifndef CLK_BATCH
+#define CLK_BATCH 4     /* the maximum number of ALARMs sent at once */
 #endif
 
 #define STEP_SIZE (MAX_COUNT + 1L)
@@ -141,16 +181,34 @@
 #define DENOMINATOR 4
 #define ZERO 0
 #define DIVIDE_1024 (_BV(CSn2) | _BV(CSn0))
-#define REMAINDER (MAX_COUNT - TCNTn)
 #define THRESHOLD 0x00100000               /* 1048576 */
-#define SPACING 15 /* minimum ticks between adjacent alarms */
+#define SPACING 15 /* minimum ticks between batches of alarms */
+
+#if (CLK_TIMER == TIMER1)
+# define STEP_SHIFT 16
+#else
+# define STEP_SHIFT 8
+#endif
+
+#define WHEEL_SIZE (1 << CLK_WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define LEVEL0_SHIFT STEP_SHIFT
+#define LEVEL1_SHIFT (STEP_SHIFT + CLK_WHEEL_BITS)
+#define LEVEL0_SPAN (STEP_SIZE << CLK_WHEEL_BITS)  /* ticks */
+#define LEVEL1_SPAN (LEVEL0_SPAN << CLK_WHEEL_BITS)
 
 #define is_active() bit_is_clear(PRR, PRTIMn)
 #define is_inactive() bit_is_set(PRR, PRTIMn)
 
-/* enable/disable overflow interrupt [p.118-9] */
+/* enable the overflow interrupt, or disable it and compare match A [p.118-9]
+ * arm() re-enables compare match A when it is needed.
+ */
 #define enable_interrupt() TIMSKn |= _BV(TOIEn)
-#define disable_interrupt() TIMSKn &= ~_BV(TOIEn)
+#define disable_interrupt() TIMSKn &= ~(_BV(TOIEn) | _BV(OCIEnA))
+
+/* enable/disable compare match A interrupt [p.118-9] */
+#define enable_compare() TIMSKn |= _BV(OCIEnA)
+#define disable_compare() TIMSKn &= ~_BV(OCIEnA)
 
 #define enable_timer() TCCRnB = DIVIDE_1024  /* mode 0, clkIO/1024 [p.116-7] */
 #define disable_timer() TCCRnB = 0x00        /* mode 0, stopped */
@@ -158,9 +216,19 @@
 /* maximum millisecond value that can be represented as ticks in a ulong_t. */
 #define MAX_MILLIS ((UINT32_MAX / NUMERATOR << DENOMINATOR) - THRESHOLD)
 
+/* compare two tick values that may straddle the wrap of the ulong_t */
+#define is_before(a, b) ((long)((a) - (b)) < 0)
+
+/* the table is checked before linkp is followed */
+#define is_pending(ip) ((ip)->ix < this.count && this.table[(ip)->ix] == (ip))
+
 typedef struct {
-    clk_info *headp;
-    ulong_t ticks;
+    clk_info *level0[WHEEL_SIZE];
+    clk_info *level1[WHEEL_SIZE];
+    clk_info *farp;
+    ulong_t base;           /* the tick at the start of the current step */
+    uchar_t count;          /* of pending alarms */
+    clk_info *table[CLK_ALARMS];  /* the pending alarms, in no order */
 } clk_t;
 
 /* I have .. */
@@ -169,6 +237,16 @@ static clk_t this;
 /* I can .. */
 PRIVATE void activate(void);
 PRIVATE void deactivate(void);
+PRIVATE void enter(clk_info *ip);
+PRIVATE void withdraw(clk_info *ip);
+PRIVATE void place(clk_info *ip);
+PRIVATE void link(clk_info **headp, clk_info *ip);
+PRIVATE void unlink(clk_info *ip);
+PRIVATE void cascade(clk_info **headp);
+PRIVATE void advance(void);
+PRIVATE ulong_t get_now(void);
+PRIVATE void expire(void);
+PRIVATE void arm(ulong_t now);
 
 PUBLIC uchar_t receive_clk(message *m_ptr)
 {
@@ -176,7 +254,6 @@ PUBLIC uchar_t receive_clk(message *m_ptr)
     case SET_ALARM:
         {
             clk_info *ip = m_ptr->INFO;
-            ip->nextp = NULL;
             ip->replyTo = m_ptr->sender;
 
             /* convert the user-supplied millisecond value
@@ -195,84 +272,43 @@ PUBLIC uchar_t receive_clk(message *m_ptr)
             if (is_inactive()) {
                 /* easy case: the timer is inactive with no pending alarms */
                 activate();
-                this.headp = ip;
-                if (this.headp->uval < STEP_SIZE) {
-                    /* the alarm is imminent */
-                    TCNTn = MAX_COUNT - this.headp->uval;
-                    this.ticks = this.headp->uval;
-                } else {
-                    this.ticks = STEP_SIZE;
-                }
+                enter(ip);
+            } else if (is_pending(ip)) {
+                /* setting it again moves it */
+                unlink(ip);
+            } else if (this.count < CLK_ALARMS) {
+                enter(ip);
             } else {
-                /* minimise this.ticks */
-                if (this.ticks > THRESHOLD) {
-                    ulong_t n = this.ticks - STEP_SIZE;
-                    if (n < this.headp->uval) {
-                        this.ticks -= n;
-                        for (clk_info *tp = this.headp; tp; tp = tp->nextp) {
-                            tp->uval -= n;
-                        }
-                    }
-                }
-
-                /* convert the user-supplied tick value to the expiry time */
-                ulong_t nticks = ip->uval;
-                ip->uval += this.ticks - REMAINDER;
-
-                /* insert this item into the list of pending alarms */
-                if (ip->uval < this.headp->uval) {
-                    /* insert at the front */
-                    ip->nextp = this.headp;
-                    this.headp = ip;
-                    for ( ; ip->nextp && ip->nextp->uval < ip->uval + SPACING;
-                                                       ip = ip->nextp) {
-                        ip->nextp->uval = ip->uval + SPACING;
-                    }
-                    if (this.headp->uval < this.ticks) {
-                        /* the alarm is imminent */
-                        TCNTn = MAX_COUNT - nticks; 
-                        TIFRn |= _BV(TOVn); /* clear any pending interrupt */
-                        this.ticks = this.headp->uval;
-                    }
-                } else {
-                    for (clk_info *tp = this.headp; tp; tp = tp->nextp) {
-                        if (tp->nextp == NULL || ip->uval < tp->nextp->uval) {
-                            ip->nextp = tp->nextp;
-                            tp->nextp = ip;
-                            for ( ; tp->nextp &&
-                                    tp->nextp->uval < tp->uval + SPACING;
-                                                           tp = tp->nextp) {
-                                tp->nextp->uval = tp->uval + SPACING;
-                            }
-                            break;
-                        }
-                    }
-                }
+                /* the table is full */
+                arm(get_now());
+                enable_interrupt();
+                send_ALARM(m_ptr->sender, ENOSPC, m_ptr->INFO);
+                break;
             }
+
+            /* convert the user-supplied tick value to the expiry time */
+            ulong_t now = get_now();
+            ip->uval += now;
+            place(ip);
+            arm(now);
             enable_interrupt();
         }
         break;
 
     case CANCEL:
         {
-            /* remove the clk_info from the linked list */
+            /* remove the clk_info from its slot */
             uchar_t result = ESRCH;
             disable_interrupt();
             if (is_active()) {
                 clk_info *ip = m_ptr->INFO;
-                if (ip == this.headp) {
-                    this.headp = this.headp->nextp;
+                if (is_pending(ip)) {
+                    unlink(ip);
+                    withdraw(ip);
                     result = EOK;
-                } else {
-                    for (clk_info *tp = this.headp; tp->nextp; tp = tp->nextp) {
-                        if (tp->nextp == ip) {
-                            tp->nextp = ip->nextp;
-                            result = EOK;
-                            break;
-                        }
-                    }
                 }
-                if (this.headp) {
+                if (this.count) {
+                    arm(get_now());
                     enable_interrupt();
                 } else {
                     deactivate();
@@ -297,28 +333,29 @@ PUBLIC uchar_t receive_clk(message *m_ptr)
    -----------------------------------------------------*/
 ISR(TIMERn_OVF_vect)
 {
-    while (this.headp && this.headp->uval <= this.ticks) {
-        send_ALARM(this.headp->replyTo, EOK, this.headp);
-        this.headp = this.headp->nextp;
-    }
-    if (this.headp) {
-        ulong_t nticks = this.headp->uval - this.ticks;    
-        if (nticks < STEP_SIZE) {
-            /* the alarm is imminent */
-            TCNTn = MAX_COUNT - nticks;
-            this.ticks = this.headp->uval;
-        } else {
-            this.ticks += STEP_SIZE;
-        }
-    } else {
-        deactivate();
-    }
+    this.base += STEP_SIZE;
+    advance();
+    expire();
+}
+
+/* -----------------------------------------------------
+   Handle a Timer n Compare Match A interrupt.
+   This appears as <__vector_14> TIMER0
+                or <__vector_11> TIMER1
+                or <__vector_7>  TIMER2
+  in the .lst file.
+   -----------------------------------------------------*/
+ISR(TIMERn_COMPA_vect)
+{
+    expire();
 }
 
 PRIVATE void activate(void)
 {
     PRR &= ~_BV(PRTIMn);
     TCNTn = ZERO;
+    this.base = ZERO;
+    TIFRn = _BV(TOVn) | _BV(OCFnA);  /* set the bits to clear them */
     enable_timer();
 }
 
@@ -327,7 +364,156 @@ PRIVATE void deactivate(void)
     disable_timer();
     disable_interrupt();
     PRR |= _BV(PRTIMn);
-    this.ticks = ZERO;
+    this.base = ZERO;
+}
+
+/* The current tick, allowing for an overflow that is yet to be serviced. */
+PRIVATE ulong_t get_now(void)
+{
+    ulong_t now = this.base + TCNTn;
+
+    if (TIFRn & _BV(TOVn)) {
+        /* TCNTn has wrapped since base was advanced, so read it again */
+        now = this.base + STEP_SIZE + TCNTn;
+    }
+    return now;
+}
+
+/* Send whatever has expired in the current step. */
+PRIVATE void expire(void)
+{
+    ulong_t now = get_now();
+    uchar_t batch = CLK_BATCH;
+    clk_info *np;
+
+    for (clk_info *ip = this.level0[(this.base >> LEVEL0_SHIFT) & WHEEL_MASK];
+                                                  ip && batch; ip = np) {
+        np = ip->nextp;
+        if (!is_before(now, ip->uval)) {
+            batch--;
+            unlink(ip);
+            withdraw(ip);
+            send_ALARM(ip->replyTo, EOK, ip);
+        }
+    }
+
+    if (this.count) {
+        arm(now);
+    } else {
+        deactivate();
+    }
+}
+
+/* Program the compare match for the next expiry in the current step. */
+PRIVATE void arm(ulong_t now)
+{
+    ulong_t next = this.base + STEP_SIZE;
+
+    for (clk_info *ip = this.level0[(this.base >> LEVEL0_SHIFT) & WHEEL_MASK];
+                                                         ip; ip = ip->nextp) {
+        if (!is_before(now, ip->uval)) {
+            /* held back from the last batch */
+            next = now + SPACING;
+            break;
+        } else if (is_before(ip->uval, next)) {
+            next = ip->uval;
+        }
+    }
+
+    if (is_before(next, this.base + STEP_SIZE)) {
+        /* The flag is set on the count after the match [p.104],
+         * and the match cannot be set behind the counter.
+         */
+        ulong_t count = MAX(next - this.base - 1, now - this.base + 1);
+        if (count <= MAX_COUNT) {
+            OCRnA = count;
+            TIFRn = _BV(OCFnA);
+            enable_compare();
+            return;
+        }
+    }
+    /* the overflow comes first */
+    disable_compare();
+}
+
+/* Enter the alarm in the table of pending alarms. There is room. */
+PRIVATE void enter(clk_info *ip)
+{
+    ip->ix = this.count;
+    this.table[this.count++] = ip;
+}
+
+/* Take the pending alarm out of the table, moving the last into its place. */
+PRIVATE void withdraw(clk_info *ip)
+{
+    clk_info *lp = this.table[--this.count];
+
+    lp->ix = ip->ix;
+    this.table[lp->ix] = lp;
+}
+
+/* Put the alarm into the slot for its expiry time. */
+PRIVATE void place(clk_info *ip)
+{
+    if ((ip->uval - this.base) >> LEVEL0_SHIFT < WHEEL_SIZE) {
+        link(&this.level0[(ip->uval >> LEVEL0_SHIFT) & WHEEL_MASK], ip);
+    } else if ((ip->uval - (this.base & ~(LEVEL0_SPAN - 1))) >> LEVEL1_SHIFT <
+                                                                WHEEL_SIZE) {
+        link(&this.level1[(ip->uval >> LEVEL1_SHIFT) & WHEEL_MASK], ip);
+    } else {
+        link(&this.farp, ip);
+    }
+}
+
+PRIVATE void link(clk_info **headp, clk_info *ip)
+{
+    ip->nextp = *headp;
+    if (ip->nextp)
+        ip->nextp->linkp = &ip->nextp;
+    ip->linkp = headp;
+    *headp = ip;
+}
+
+/* Take a pending alarm out of its slot. */
+PRIVATE void unlink(clk_info *ip)
+{
+    *ip->linkp = ip->nextp;
+    if (ip->nextp)
+        ip->nextp->linkp = ip->linkp;
+}
+
+/* Redistribute a list of alarms from the current position of the wheel. */
+PRIVATE void cascade(clk_info **headp)
+{
+    clk_info *ip = *headp;
+    clk_info *np;
+
+    /* detach the list first, as the far list may get some of it back */
+    *headp = NULL;
+    for ( ; ip; ip = np) {
+        np = ip->nextp;
+        place(ip);
+    }
+}
+
+/* Turn the wheel on to the step that began at this.base. */
+PRIVATE void advance(void)
+{
+    clk_info **slotp = &this.level0[((this.base - STEP_SIZE) >> LEVEL0_SHIFT) &
+                                                              WHEEL_MASK];
+
+    /* alarms held back from the previous step are now due */
+    clk_info *ip;
+    while ((ip = *slotp)) {
+        unlink(ip);
+        link(&this.level0[(this.base >> LEVEL0_SHIFT) & WHEEL_MASK], ip);
+    }
+
+    if ((this.base & (LEVEL0_SPAN - 1)) == 0) {
+        if ((this.base & (LEVEL1_SPAN - 1)) == 0)
+            cascade(&this.farp);
+        cascade(&this.level1[(this.base >> LEVEL1_SHIFT) & WHEEL_MASK]);
+    }
 }
 
 /* convenience functions */
@@ -37,13 +37,17 @@
 /* A clk_info structure is declared by each task that wants an alarm call.
  * The uval serves a dual purpose in that the client first initializes it to a
  * millisecond value and then the CLK overwrites this with the corresponding
- * number of ticks relative to the current clk.ticks.
+ * expiry time in ticks. The linkp refers to whatever points to it in the
+ * timer wheel, and ix is its place in CLK's table of pending alarms, so
+ * that it can be removed without a search.
  */
 
 typedef struct _clk_info {
     struct _clk_info *nextp;
+    struct _clk_info **linkp;
     ProcNumber replyTo;
     ulong_t uval;             /* millisecond value */
+    uchar_t ix;
 } clk_info;
 
 /* convenience functions */
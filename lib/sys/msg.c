@@ -31,6 +31,25 @@
 
 /* Message fifo.
  *
+ * There are three lanes. The urgent lane carries the completions that are
+ * sent from interrupt handlers, so that a MASTER_COMPLETE or an EOC is
+ * not held up behind a burst of NOT_EMPTY from SER. An urgent message
+ * that finds its own lane full is put into the normal lane instead.
+ *
+ * Messages from URGENT_SENDER, if it is defined in host.h, are urgent
+ * irrespective of their opcode.
+ *
+ * The spill lane, if MSG_SPILL_SIZE is defined in host.h, only receives an
+ * ALARM or a REPLY_INFO that finds the normal lane full. Either would
+ * otherwise be lost and leave its client waiting for ever.
+ *
+ * Each message is numbered as it is inserted, and extract_msg() takes the
+ * oldest of the lane heads. The head of the urgent lane goes first only
+ * if no older message to the same receiver is waiting in another lane,
+ * so each task still receives its messages in the order they were sent.
+ *
+ * A message that cannot be inserted anywhere is counted before it is
+ * discarded, and by opcode and by receiver with MSG_OVERFLOW_COUNTS.
  */
 
 #include <string.h>
@@ -47,16 +66,49 @@
 /* no SELF */
 #define this msg
 
+#ifndef MSG_FIFO_SIZE
 #define MSG_FIFO_SIZE  8
+#endif
+#ifndef MSG_URGENT_FIFO_SIZE
+#define MSG_URGENT_FIFO_SIZE  4
+#endif
+#ifndef MSG_SPILL_SIZE
+#define MSG_SPILL_SIZE  0       /* 2 keeps an ALARM or a REPLY_INFO */
+#endif
+#ifndef MSG_OVERFLOW_COUNTS
+#define MSG_OVERFLOW_COUNTS  0  /* 1 counts overflows by opcode and task */
+#endif
 #define WATCHDOG_TIMEOUT WDTO_8S          /* 8 second watchdog */
 
+#define TOTAL_SIZE (MSG_URGENT_FIFO_SIZE + MSG_SPILL_SIZE + MSG_FIFO_SIZE)
+
+#define LANE_SIZE(n) ((n) == URGENT_LANE ? MSG_URGENT_FIFO_SIZE : \
+                      (n) == SPILL_LANE ? MSG_SPILL_SIZE : MSG_FIFO_SIZE)
+
+#define LANE_BASE(n) ((n) == URGENT_LANE ? 0 : \
+                      (n) == SPILL_LANE ? MSG_URGENT_FIFO_SIZE : \
+                                  MSG_URGENT_FIFO_SIZE + MSG_SPILL_SIZE)
+
 typedef struct {
-    message mbuf[MSG_FIFO_SIZE];
     uchar_t in;
     uchar_t out;
     uchar_t pending;
     uchar_t depth;
+} lane_t;
+
+typedef struct {
+    message mbuf[TOTAL_SIZE];
+    uchar_t seq[TOTAL_SIZE];
+    uchar_t next_seq;
+    lane_t lane[NR_LANES];
+    uchar_t depth;
     ulong_t rcvd;
+    ulong_t wakeups;
+    ushort_t overflows;
+#if MSG_OVERFLOW_COUNTS
+    uchar_t overflow_op[NR_OPCODES];
+    uchar_t overflow_task[NR_TASKS];
+#endif
 } msg_t;
 
 /* I have .. */
@@ -65,6 +117,11 @@ PUBLIC uchar_t lost_msgs;
 
 /* I can .. */
 PRIVATE void insert_msg(message *m_ptr);
+PRIVATE bool_t put_msg(uchar_t n, message *m_ptr);
+PRIVATE uchar_t next_lane(void);
+PRIVATE bool_t is_waiting(ProcNumber receiver, uchar_t seq);
+PRIVATE bool_t is_urgent(message *m_ptr);
+PRIVATE bool_t is_spillable(message *m_ptr);
 PRIVATE void wdti_enable (const uint8_t value);
 
 PUBLIC void config_msg(void)
@@ -83,11 +140,14 @@ PUBLIC void extract_msg(message *m_ptr)
     cli();
     for (;;) {
         wdt_reset();
-        if (this.pending) {
-            memcpy(m_ptr, this.mbuf + this.out, sizeof(message));
-            if (++this.out >= MSG_FIFO_SIZE)
-                this.out = 0;
-            this.pending--;
+        uchar_t n = next_lane();
+        if (n < NR_LANES) {
+            lane_t *lp = &this.lane[n];
+            memcpy(m_ptr, this.mbuf + LANE_BASE(n) + lp->out,
+                                                  sizeof(message));
+            if (++lp->out >= LANE_SIZE(n))
+                lp->out = 0;
+            lp->pending--;
             sei();
             this.rcvd++;
             return;
@@ -99,6 +159,7 @@ PUBLIC void extract_msg(message *m_ptr)
         sleep_cpu();
         sleep_disable();
         cli();
+        this.wakeups++;
         wdti_enable(WATCHDOG_TIMEOUT);
     }
 }
@@ -108,17 +169,132 @@ PRIVATE void insert_msg(message *m_ptr)
 {
     uchar_t cSREG = SREG;
     cli();
-    if (this.pending < MSG_FIFO_SIZE) {
-        memcpy(this.mbuf + this.in, m_ptr, sizeof(message));
-        if (++this.in >= MSG_FIFO_SIZE)
-            this.in = 0;
-        this.pending++;
-        if (this.depth < this.pending)
-            this.depth = this.pending;
+    if (!(is_urgent(m_ptr) && put_msg(URGENT_LANE, m_ptr)) &&
+                 !put_msg(NORMAL_LANE, m_ptr) &&
+                 !(is_spillable(m_ptr) && put_msg(SPILL_LANE, m_ptr))) {
+        /* nowhere to put it */
+        if (this.overflows < UINT16_MAX)
+            this.overflows++;
+#if MSG_OVERFLOW_COUNTS
+        if (m_ptr->opcode < NR_OPCODES &&
+                              this.overflow_op[m_ptr->opcode] < UINT8_MAX)
+            this.overflow_op[m_ptr->opcode]++;
+        if (m_ptr->receiver < NR_TASKS &&
+                          this.overflow_task[m_ptr->receiver] < UINT8_MAX)
+            this.overflow_task[m_ptr->receiver]++;
+#endif
     }
     SREG = cSREG;
 }
 
+/* Append the message to lane n, if there is room. Interrupts are off. */
+PRIVATE bool_t put_msg(uchar_t n, message *m_ptr)
+{
+    lane_t *lp = &this.lane[n];
+
+    if (lp->pending >= LANE_SIZE(n))
+        return FALSE;
+
+    memcpy(this.mbuf + LANE_BASE(n) + lp->in, m_ptr, sizeof(message));
+    this.seq[LANE_BASE(n) + lp->in] = this.next_seq++;
+    if (++lp->in >= LANE_SIZE(n))
+        lp->in = 0;
+    lp->pending++;
+    if (lp->depth < lp->pending)
+        lp->depth = lp->pending;
+
+    uchar_t total = 0;
+    for (uchar_t i = 0; i < NR_LANES; i++)
+        total += this.lane[i].pending;
+    if (this.depth < total)
+        this.depth = total;
+    return TRUE;
+}
+
+/* The lane to take the next message from, or NR_LANES if all are empty.
+ * This is the lane whose head is oldest, unless the head of the urgent
+ * lane can overtake it. Interrupts are off.
+ */
+PRIVATE uchar_t next_lane(void)
+{
+    uchar_t best = NR_LANES;
+    uchar_t best_seq = 0;
+
+    for (uchar_t n = 0; n < NR_LANES; n++) {
+        lane_t *lp = &this.lane[n];
+        if (lp->pending) {
+            uchar_t seq = this.seq[LANE_BASE(n) + lp->out];
+            if (best == NR_LANES || (signed char)(seq - best_seq) < 0) {
+                best = n;
+                best_seq = seq;
+            }
+        }
+    }
+
+    lane_t *lp = &this.lane[URGENT_LANE];
+    if (best != URGENT_LANE && lp->pending) {
+        uchar_t i = LANE_BASE(URGENT_LANE) + lp->out;
+        if (!is_waiting(this.mbuf[i].receiver, this.seq[i]))
+            best = URGENT_LANE;
+    }
+    return best;
+}
+
+/* Whether a message older than seq is waiting for receiver in the spill
+ * or the normal lane. No more than TOTAL_SIZE messages are ever numbered
+ * apart, so the difference of two numbers orders them.
+ */
+PRIVATE bool_t is_waiting(ProcNumber receiver, uchar_t seq)
+{
+    for (uchar_t n = 0; n < NR_LANES; n++) {
+        if (n == URGENT_LANE)
+            continue;
+        lane_t *lp = &this.lane[n];
+        uchar_t k = lp->out;
+        for (uchar_t j = 0; j < lp->pending; j++) {
+            uchar_t i = LANE_BASE(n) + k;
+            if (this.mbuf[i].receiver == receiver &&
+                                   (signed char)(this.seq[i] - seq) < 0)
+                return TRUE;
+            if (++k >= LANE_SIZE(n))
+                k = 0;
+        }
+    }
+    return FALSE;
+}
+
+/* Completions sent from an interrupt handler take the urgent lane, as do
+ * all messages from URGENT_SENDER. next_lane() keeps them behind older
+ * messages to the same receiver, so they overtake only other tasks' mail.
+ */
+PRIVATE bool_t is_urgent(message *m_ptr)
+{
+#ifdef URGENT_SENDER
+    if (m_ptr->sender == URGENT_SENDER)
+        return TRUE;
+#endif
+    switch (m_ptr->opcode) {
+    case MASTER_COMPLETE:
+    case SLAVE_COMPLETE:
+    case NOT_BUSY:
+    case EOC:
+        return TRUE;
+
+    default:
+        return FALSE;
+    }
+}
+
+/* Replies that a client is waiting for may use the spill lane. */
+PRIVATE bool_t is_spillable(message *m_ptr)
+{
+#if MSG_SPILL_SIZE
+    return m_ptr->opcode == ALARM || m_ptr->opcode == REPLY_INFO;
+#else
+    return FALSE;
+#endif
+}
+
 /* send_m1(sender,receiver,opcode)
  *   -------------------------------------------------------------------------
  *   | sender |receiver| opcode |   --   |   --   |   --   |   --   |   --   |
@@ -216,15 +392,27 @@ PUBLIC uchar_t msg_depth(void)
     return this.depth;
 }
 
+/* get the depth of one lane */
+PUBLIC uchar_t msg_lane_depth(uchar_t lane)
+{
+    return lane < NR_LANES ? this.lane[lane].depth : 0;
+}
+
 /* get the count of messages received */
 PUBLIC ulong_t msg_count(void)
 {
     return this.rcvd;
 }
 
+/* get the number of times the cpu has been woken from sleep */
+PUBLIC ulong_t msg_wakeups(void)
+{
+    return this.wakeups;
+}
+
 PUBLIC uchar_t msg_slots_available(void)
 {
-    return MSG_FIFO_SIZE - this.pending;
+    return MSG_FIFO_SIZE - this.lane[NORMAL_LANE].pending;
 }
 
 PUBLIC ulong_t msg_lost(void)
@@ -232,6 +420,30 @@ PUBLIC ulong_t msg_lost(void)
     return lost_msgs;
 }
 
+/* get the number of messages discarded because the fifo was full */
+PUBLIC ushort_t msg_overflows(void)
+{
+    return this.overflows;
+}
+
+PUBLIC uchar_t msg_overflows_by_opcode(MsgNumber opcode)
+{
+#if MSG_OVERFLOW_COUNTS
+    return opcode < NR_OPCODES ? this.overflow_op[opcode] : 0;
+#else
+    return 0;
+#endif
+}
+
+PUBLIC uchar_t msg_overflows_by_task(ProcNumber receiver)
+{
+#if MSG_OVERFLOW_COUNTS
+    return receiver < NR_TASKS ? this.overflow_task[receiver] : 0;
+#else
+    return 0;
+#endif
+}
+
 /* An alternative to the macro in <avr/wdt.h>
  * that also enables the Watchdog interrupt.
  */
@@ -93,6 +93,12 @@ typedef struct {
  
 typedef uchar_t (*MsgProc) (message *msg);
 
+/* the fifo lanes */
+#define URGENT_LANE 0
+#define SPILL_LANE  1
+#define NORMAL_LANE 2
+#define NR_LANES    3
+
 /* [Minix p.445] */
 
 #define m3_m3p1 m_u.m_m3.m3p1
@@ -153,8 +159,13 @@ PUBLIC void send_m5(ProcNumber sender, ProcNumber receiver, MsgNumber opcode,
                                                 uchar_t mtype, ulong_t lcount);
 
 PUBLIC uchar_t msg_depth(void);
+PUBLIC uchar_t msg_lane_depth(uchar_t lane);
 PUBLIC ulong_t msg_count(void);
+PUBLIC ulong_t msg_wakeups(void);
 PUBLIC ulong_t msg_lost(void);
 PUBLIC uchar_t msg_slots_available(void);
+PUBLIC ushort_t msg_overflows(void);
+PUBLIC uchar_t msg_overflows_by_opcode(MsgNumber opcode);
+PUBLIC uchar_t msg_overflows_by_task(ProcNumber receiver);
 
 #endif /* _MSG_H_ */
@@ -0,0 +1,137 @@
+/* sys/prof.c */
+
+/* Copyright (c) 2024 Peter Welch
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+   * Neither the name of the copyright holders nor the names of
+     contributors may be used to endorse or promote products derived
+     from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* A dispatch profiler.
+ *
+ * Enabled by
+ *   #define PROFILE 1
+ * in [app]/host.h, with prof.o and stw.o added to LIB_OBJS in the Makefile.
+ *
+ * Each call from the main loop to a task's receive function is timed with
+ * the free-running STW stopwatch. The number of calls, total cycles and
+ * longest call are accumulated for each ProcNumber, and the longest call
+ * for each opcode. SYSCON returns them with OP_PROFILE.
+ *
+ * The cycles spent in interrupt service routines during a call are
+ * charged to the task that was running at the time.
+ */
+
+#include <string.h>
+#include <avr/io.h>
+
+#include "sys/defs.h"
+#include "sys/msg.h"
+#include "sys/stw.h"
+#include "sys/prof.h"
+
+/* I am .. */
+#define this prof
+
+#ifndef CLK_TIMER
+#define CLK_TIMER TIMER0
+#endif
+
+#ifndef STW_TIMER
+#define STW_TIMER TIMER1
+#endif
+
+#if (STW_TIMER == CLK_TIMER)
+#error "PROFILE requires a STW_TIMER other than CLK_TIMER in host.h"
+#endif
+
+#if (STW_TIMER == TIMER1)
+# define STW_SHIFT 16
+#else
+# define STW_SHIFT 8
+#endif
+
+typedef struct {
+    prof_entry task[NR_TASKS];
+    ushort_t opcode_max[NR_OPCODES];
+} prof_t;
+
+/* I have .. */
+static prof_t this;
+
+/* I can .. */
+PRIVATE ulong_t now(void);
+
+PUBLIC void config_prof(void)
+{
+    stw_start();
+}
+
+/* Call the task, charging it with the cycles that it took. */
+PUBLIC uchar_t prof_dispatch(MsgProc fp, message *m_ptr)
+{
+    ulong_t start = now();
+    uchar_t result = (fp) (m_ptr);
+    ulong_t elapsed = now() - start;
+    ushort_t clipped = (elapsed > UINT16_MAX) ? UINT16_MAX : elapsed;
+
+    prof_entry *ep = &this.task[m_ptr->receiver];
+    ep->calls++;
+    ep->cycles += elapsed;
+    if (ep->max < clipped)
+        ep->max = clipped;
+    if (m_ptr->opcode < NR_OPCODES && this.opcode_max[m_ptr->opcode] < clipped)
+        this.opcode_max[m_ptr->opcode] = clipped;
+    return result;
+}
+
+PUBLIC void prof_clear(void)
+{
+    memset(&this, 0, sizeof(this));
+}
+
+PUBLIC void prof_task(ProcNumber n, prof_entry *ep)
+{
+    if (n < NR_TASKS)
+        *ep = this.task[n];
+    else
+        memset(ep, 0, sizeof(prof_entry));
+}
+
+PUBLIC ushort_t prof_opcode_max(MsgNumber n)
+{
+    return (n < NR_OPCODES) ? this.opcode_max[n] : 0;
+}
+
+/* the stopwatch as a single count of cycles */
+PRIVATE ulong_t now(void)
+{
+    stw_t sw;
+
+    stw_read(&sw);
+    return (sw.lcnt << STW_SHIFT) + sw.ccnt;
+}
+
+/* end code */
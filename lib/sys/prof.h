@@ -0,0 +1,59 @@
+/* sys/prof.h */
+
+/* Copyright (c) 2024 Peter Welch
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+   * Neither the name of the copyright holders nor the names of
+     contributors may be used to endorse or promote products derived
+     from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef _PROF_H_
+#define _PROF_H_
+
+/* One counter set for each ProcNumber. */
+typedef struct {
+    ushort_t calls;           /* dispatches, wrapping at 65536 */
+    ushort_t max;             /* longest dispatch, saturating at 65535 */
+    ulong_t cycles;           /* total cycles */
+} prof_entry;
+
+#if PROFILE
+
+PUBLIC void config_prof(void);
+PUBLIC uchar_t prof_dispatch(MsgProc fp, message *m_ptr);
+PUBLIC void prof_clear(void);
+PUBLIC void prof_task(ProcNumber n, prof_entry *ep);
+PUBLIC ushort_t prof_opcode_max(MsgNumber n);
+
+/* used by [app]/main.c to call a task */
+#define DISPATCH(fp, m_ptr)     prof_dispatch((fp), (m_ptr))
+
+#else
+
+#define DISPATCH(fp, m_ptr)     (fp) (m_ptr)
+
+#endif /* PROFILE */
+
+#endif /* _PROF_H_ */
@@ -115,12 +115,18 @@ PUBLIC void stw_stop(void)
 
 PUBLIC void stw_read(stw_t *ip)
 {
+    uchar_t cSREG = SREG;
+    cli();
     uchar_t cTCCRnB = TCCRnB;
     TCCRnB = 0;
     this.ccnt = TCNTn;
     ip->lcnt = this.lcnt;
+    /* An overflow that has not yet been serviced belongs to this reading. */
+    if (TIFRn & _BV(TOVn))
+        ip->lcnt++;
     ip->ccnt = this.ccnt;
     TCCRnB = cTCCRnB;
+    SREG = cSREG;
     ip->running = this.running;
 }
 
@@ -36,6 +36,11 @@
  *    OP_CYCLES
  *    OP_RESTART
  *    OP_BOOTTIME
+ *    OP_OVERFLOW
+ *    OP_PROFILE
+ *    OP_WAKEUPS
+ *    OP_THROUGHPUT
+ *    OP_RETRIES
  */
 
 #include <time.h>
@@ -43,6 +48,7 @@
 
 #include "sys/defs.h"
 #include "sys/msg.h"
+#include "sys/prof.h"
 #include "net/twi.h"
 #include "net/i2c.h"
 #include "sys/rv3028c7.h"
@@ -124,6 +130,7 @@ PRIVATE void exec_command(void)
         this.sm.reply.p.cycles.depth = msg_depth();
         this.sm.reply.p.cycles.count = msg_count();
         this.sm.reply.p.cycles.lost = msg_lost();
+        this.sm.reply.p.cycles.urgent_depth = msg_lane_depth(URGENT_LANE);
         send_reply(EOK);
         break;
 
@@ -139,6 +146,98 @@ PRIVATE void exec_command(void)
         send_reply(EOK);
         break;
 
+    case OP_WAKEUPS:
+        this.sm.reply.p.wakeups.boottime = this.boottime;
+        this.sm.reply.p.wakeups.wakeups = msg_wakeups();
+        send_reply(EOK);
+        break;
+
+    case OP_THROUGHPUT:
+        {
+            /* the request and the reply share the same buffer */
+            uchar_t clear = this.sm.request.p.throughput.clear;
+            this.sm.reply.p.throughput.master = twi_bytes(TWI_MASTER);
+            this.sm.reply.p.throughput.slave = twi_bytes(TWI_SLAVE);
+            if (clear)
+                twi_clear_bytes();
+            send_reply(EOK);
+        }
+        break;
+
+#if TWI_STATS
+    case OP_RETRIES:
+        {
+            /* the request and the reply share the same buffer */
+            uchar_t first = this.sm.request.p.retries.first;
+            if (this.sm.request.p.retries.clear)
+                twi_clear_histograms();
+            this.sm.reply.p.retries.first = first;
+            this.sm.reply.p.retries.limit = 0;
+            for (uchar_t i = 0; i < RETRIES_SPAN; i++) {
+                twi_histogram *hp = &this.sm.reply.p.retries.hist[i];
+                if (twi_histograms(first + i, hp) == EOK) {
+                    this.sm.reply.p.retries.limit = first + i + 1;
+                } else {
+                    hp->dest_addr = 0;
+                }
+            }
+            send_reply(EOK);
+        }
+        break;
+#endif
+
+    case OP_OVERFLOW:
+        {
+            /* the request and the reply share the same buffer */
+            uchar_t table = this.sm.request.p.overflow.table;
+            uchar_t first = this.sm.request.p.overflow.first;
+            uchar_t limit = (table == OVERFLOW_BY_TASK) ? NR_TASKS :
+                                                         NR_OPCODES;
+            this.sm.reply.p.overflow.total = msg_overflows();
+            this.sm.reply.p.overflow.first = first;
+            this.sm.reply.p.overflow.limit = limit;
+            for (uchar_t i = 0; i < OVERFLOW_SPAN; i++, first++) {
+                if (first >= limit)
+                    this.sm.reply.p.overflow.count[i] = 0;
+                else if (table == OVERFLOW_BY_TASK)
+                    this.sm.reply.p.overflow.count[i] =
+                                    msg_overflows_by_task(first);
+                else
+                    this.sm.reply.p.overflow.count[i] =
+                                    msg_overflows_by_opcode(first);
+            }
+            send_reply(EOK);
+        }
+        break;
+
+#if PROFILE
+    case OP_PROFILE:
+        {
+            /* the request and the reply share the same buffer */
+            uchar_t table = this.sm.request.p.profile.table;
+            uchar_t first = this.sm.request.p.profile.first;
+            uchar_t limit = (table == PROFILE_BY_OPCODE) ? NR_OPCODES :
+                                                          NR_TASKS;
+            if (table == PROFILE_CLEAR)
+                prof_clear();
+            this.sm.reply.p.profile.first = first;
+            this.sm.reply.p.profile.limit = limit;
+            for (uchar_t i = 0; i < PROFILE_SPAN; i++, first++) {
+                if (table == PROFILE_BY_OPCODE) {
+                    this.sm.reply.p.profile.u.max[i] = prof_opcode_max(first);
+                } else {
+                    prof_entry e;
+                    prof_task(first, &e);
+                    this.sm.reply.p.profile.u.task[i].calls = e.calls;
+                    this.sm.reply.p.profile.u.task[i].max = e.max;
+                    this.sm.reply.p.profile.u.task[i].cycles = e.cycles;
+                }
+            }
+            send_reply(EOK);
+        }
+        break;
+#endif
+
     default:
         send_reply(ENOSYS);
         break;
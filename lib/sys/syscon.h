@@ -34,11 +34,36 @@
 
 #ifndef _MAIN_
 
+#include "net/twi.h"
+
 /* SYSCON REQUEST opcodes */
 #define OP_REBOOT    1 
 #define OP_CYCLES    2
 #define OP_RESTART   3
 #define OP_BOOTTIME  4
+#define OP_OVERFLOW  5
+#define OP_PROFILE   6
+#define OP_WAKEUPS   7
+#define OP_THROUGHPUT 8
+#define OP_RETRIES   9
+
+/* OP_OVERFLOW tables */
+#define OVERFLOW_BY_OPCODE 0
+#define OVERFLOW_BY_TASK   1
+
+/* the number of overflow counters returned in one reply */
+#define OVERFLOW_SPAN 8
+
+/* OP_PROFILE tables */
+#define PROFILE_BY_TASK   0
+#define PROFILE_BY_OPCODE 1
+#define PROFILE_CLEAR     2
+
+/* the number of profile entries returned in one reply */
+#define PROFILE_SPAN 4
+
+/* the number of TWI destination histograms returned in one reply */
+#define RETRIES_SPAN 2
 
 typedef struct {
     hostid_t host;
@@ -48,18 +73,76 @@ typedef struct {
     hostid_t host;
 } restart_request;
 
+typedef struct {
+    uchar_t table;      /* OVERFLOW_BY_OPCODE or OVERFLOW_BY_TASK */
+    uchar_t first;      /* the opcode or task number of count[0] */
+} overflow_request;
+
+typedef struct {
+    uchar_t table;      /* PROFILE_BY_TASK, PROFILE_BY_OPCODE or PROFILE_CLEAR */
+    uchar_t first;      /* the task or opcode number of the first entry */
+} profile_request;
+
+typedef struct {
+    uchar_t clear;      /* TRUE to zero the counters after reading them */
+} throughput_request;
+
+typedef struct {
+    uchar_t first;      /* the destination of the first histogram */
+    uchar_t clear;      /* TRUE to zero the histograms */
+} retries_request;
+
 /* replies */
 
 typedef struct {
     uchar_t depth;
     uchar_t lost;
     ulong_t count;
+    uchar_t urgent_depth;
 } cycles_reply;
 
 typedef struct {
     time_t boottime;
 } lastreset_reply;
 
+typedef struct {
+    time_t boottime;
+    ulong_t wakeups;    /* times the cpu has been woken from sleep */
+} wakeups_reply;
+
+typedef struct {
+    ulong_t master;     /* bytes transferred as a TWI master */
+    ulong_t slave;      /* bytes transferred as a TWI slave */
+} throughput_reply;
+
+typedef struct {
+    ushort_t total;     /* messages discarded because the fifo was full */
+    uchar_t first;      /* the opcode or task number of count[0] */
+    uchar_t limit;      /* NR_OPCODES or NR_TASKS */
+    uchar_t count[OVERFLOW_SPAN];
+} overflow_reply;
+
+typedef struct {
+    ushort_t calls;     /* dispatches to the task */
+    ushort_t max;       /* the longest dispatch in cycles */
+    ulong_t cycles;     /* the total of all its dispatches */
+} profile_task;
+
+typedef struct {
+    uchar_t first;      /* the task or opcode number of the first entry */
+    uchar_t limit;      /* NR_TASKS or NR_OPCODES */
+    union {
+        profile_task task[PROFILE_SPAN];
+        ushort_t max[PROFILE_SPAN];  /* the longest dispatch by opcode */
+    } u;
+} profile_reply;
+
+typedef struct {
+    uchar_t first;      /* the destination of hist[0] */
+    uchar_t limit;      /* the number of destinations */
+    twi_histogram hist[RETRIES_SPAN];
+} retries_reply;
+
 typedef struct {
     ProcNumber taskid;
     jobref_t jobref;
@@ -68,6 +151,10 @@ typedef struct {
     union {
         reboot_request reboot;
         restart_request restart;
+        overflow_request overflow;
+        profile_request profile;
+        throughput_request throughput;
+        retries_request retries;
     } p;
 } syscon_request;
 
@@ -79,6 +166,11 @@ typedef struct {
     union {
         cycles_reply cycles;
         lastreset_reply lastreset;
+        wakeups_reply wakeups;
+        throughput_reply throughput;
+        retries_reply retries;
+        overflow_reply overflow;
+        profile_reply profile;
     } p;
 } syscon_reply;
 
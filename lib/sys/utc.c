@@ -147,6 +147,24 @@ PUBLIC time_t get_utc(void)
     return now;
 }
 
+/* Direct access to the uptime in 1/256 second ticks, for timing intervals.
+ * An overflow that is yet to be serviced is allowed for.
+ */
+PUBLIC ulong_t get_uptime_ticks(void)
+{
+    uchar_t cSREG = SREG;
+    cli();
+    uchar_t frac = TCNT2;
+    ulong_t secs = this.uptime;
+    if (TIFR2 & _BV(TOV2)) {
+        /* TCNT2 has wrapped since uptime was advanced */
+        frac = TCNT2;
+        secs++;
+    }
+    SREG = cSREG;
+    return secs << 8 | frac;
+}
+
 /* st_callback function.
  * This is called from the TWI driver in the interrupt context when the mode
  * switches from SR to ST, to initialize the transmit pointer and count when
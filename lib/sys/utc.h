@@ -61,6 +61,7 @@ typedef union {
 } utc_msg;                  /* 7 bytes */
 
 PUBLIC time_t get_utc(void);
+PUBLIC ulong_t get_uptime_ticks(void);
 
 #else /* _MAIN_ */
 
@@ -41,6 +41,7 @@
 
 #include "sys/defs.h"
 #include "sys/msg.h"
+#include "sys/prof.h"
 #include "sys/clk.h"
 #include "sys/ser.h"
 #include "sys/tty.h"
@@ -90,6 +91,9 @@ int main (void)
 
     config_sysinit();
     config_msg();
+#if PROFILE
+    config_prof();
+#endif
     config_ser();
     config_twi();
 
@@ -107,7 +111,7 @@ int main (void)
         extract_msg(&msg);
         if (msg.receiver && msg.receiver < NR_TASKS &&
                   (fp = (MsgProc) pgm_read_word_near(proctab + msg.receiver)))
-            if ((fp) (&msg) == ENOMSG)
+            if (DISPATCH(fp, &msg) == ENOMSG)
                 lost_msgs++;
     } 
 }
@@ -0,0 +1,63 @@
+/* posix/avr/interrupt.h */
+
+/* Copyright (c) 2024 Peter Welch
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+   * Neither the name of the copyright holders nor the names of
+     contributors may be used to endorse or promote products derived
+     from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Interrupt control for the host-native build.
+ *
+ * The global interrupt flag is bit 7 of the SREG variable. An ISR is an
+ * ordinary function that shim.c calls when it emulates the interrupt.
+ */
+
+#ifndef _POSIX_AVR_INTERRUPT_H_
+#define _POSIX_AVR_INTERRUPT_H_
+
+#include "avr/io.h"
+
+#define cli()   (SREG &= ~_BV(SREG_I))
+#define sei()   (SREG |= _BV(SREG_I))
+
+#define TIMER0_OVF_vect    posix_timer0_ovf_vect
+#define TIMER0_COMPA_vect  posix_timer0_compa_vect
+#define TIMER1_OVF_vect    posix_timer1_ovf_vect
+#define TIMER1_COMPA_vect  posix_timer1_compa_vect
+#define TIMER2_OVF_vect    posix_timer2_ovf_vect
+#define TIMER2_COMPA_vect  posix_timer2_compa_vect
+
+#define ISR(vector) void vector(void)
+
+/* weak, so that shim.c links whether or not the task has been included. */
+void TIMER0_OVF_vect(void) __attribute__ ((weak));
+void TIMER0_COMPA_vect(void) __attribute__ ((weak));
+void TIMER1_OVF_vect(void) __attribute__ ((weak));
+void TIMER1_COMPA_vect(void) __attribute__ ((weak));
+void TIMER2_OVF_vect(void) __attribute__ ((weak));
+void TIMER2_COMPA_vect(void) __attribute__ ((weak));
+
+#endif /* _POSIX_AVR_INTERRUPT_H_ */
@@ -0,0 +1,127 @@
+/* posix/avr/io.h */
+
+/* Copyright (c) 2024 Peter Welch
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+   * Neither the name of the copyright holders nor the names of
+     contributors may be used to endorse or promote products derived
+     from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* A register file for the host-native build.
+ *
+ * Only those registers and bits that are touched by the tasks compiled
+ * into the posix image are declared. They are plain variables defined in
+ * posix/shim.c, so a write to TCCR0B does nothing more than record the
+ * value for shim.c to inspect when the cpu is put to sleep.
+ */
+
+#ifndef _POSIX_AVR_IO_H_
+#define _POSIX_AVR_IO_H_
+
+#include <stdint.h>
+
+#define _BV(bit)                (1 << (bit))
+#define bit_is_set(sfr, bit)    ((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit)  (!((sfr) & _BV(bit)))
+
+#define RAMEND 0x08FF
+
+/* status register */
+extern volatile uint8_t SREG;
+#define SREG_I 7
+
+/* power reduction register [p.54] */
+extern volatile uint8_t PRR;
+#define PRADC   0
+#define PRUSART0 1
+#define PRSPI   2
+#define PRTIM1  3
+#define PRTIM0  5
+#define PRTIM2  6
+#define PRTWI   7
+
+/* watchdog [p.60] */
+extern volatile uint8_t WDTCSR;
+#define WDP0    0
+#define WDP1    1
+#define WDP2    2
+#define WDE     3
+#define WDCE    4
+#define WDP3    5
+#define WDIE    6
+#define WDIF    7
+
+/* The interrupt flags are cleared by writing a one [p.109], and the
+ * emulated interrupts are taken the moment they occur, so a flag is
+ * never seen set: each access gets a cleared scratch byte.
+ */
+extern volatile uint8_t *posix_tifr(uint8_t n);
+
+/* TIMER0 [p.102-119] */
+extern volatile uint8_t TCCR0A;
+extern volatile uint8_t TCCR0B;
+extern volatile uint8_t TCNT0;
+extern volatile uint8_t OCR0A;
+extern volatile uint8_t TIMSK0;
+#define TIFR0     (*posix_tifr(0))
+#define CS00    0
+#define CS01    1
+#define CS02    2
+#define TOIE0   0
+#define OCIE0A  1
+#define TOV0    0
+#define OCF0A   1
+
+/* TIMER1 [p.120-149] */
+extern volatile uint8_t TCCR1A;
+extern volatile uint8_t TCCR1B;
+extern volatile uint16_t TCNT1;
+extern volatile uint16_t OCR1A;
+extern volatile uint8_t TIMSK1;
+#define TIFR1     (*posix_tifr(1))
+#define CS10    0
+#define CS11    1
+#define CS12    2
+#define TOIE1   0
+#define OCIE1A  1
+#define TOV1    0
+#define OCF1A   1
+
+/* TIMER2 [p.150-168] */
+extern volatile uint8_t TCCR2A;
+extern volatile uint8_t TCCR2B;
+extern volatile uint8_t TCNT2;
+extern volatile uint8_t OCR2A;
+extern volatile uint8_t TIMSK2;
+#define TIFR2     (*posix_tifr(2))
+#define CS20    0
+#define CS21    1
+#define CS22    2
+#define TOIE2   0
+#define OCIE2A  1
+#define TOV2    0
+#define OCF2A   1
+
+#endif /* _POSIX_AVR_IO_H_ */
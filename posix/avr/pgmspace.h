@@ -0,0 +1,54 @@
+/* posix/avr/pgmspace.h */
+
+/* Copyright (c) 2024 Peter Welch
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+   * Neither the name of the copyright holders nor the names of
+     contributors may be used to endorse or promote products derived
+     from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Program memory access for the host-native build.
+ *
+ * There is only one address space, so __flash vanishes and the
+ * pgm_read_*() functions become plain dereferences of the full width.
+ */
+
+#ifndef _POSIX_AVR_PGMSPACE_H_
+#define _POSIX_AVR_PGMSPACE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define __flash
+#define PROGMEM
+#define PSTR(s)                     (s)
+
+#define pgm_read_byte_near(addr)    (*(const uint8_t *)(addr))
+#define pgm_read_word_near(addr)    (*(const uintptr_t *)(addr))
+
+#define strlen_P(s)                 strlen(s)
+#define strncmp_P(s1, s2, n)        strncmp((s1), (s2), (n))
+
+#endif /* _POSIX_AVR_PGMSPACE_H_ */
@@ -0,0 +1,398 @@
+/* posix/bench.c */
+
+/* Copyright (c) 2024 Peter Welch
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+   * Neither the name of the copyright holders nor the names of
+     contributors may be used to endorse or promote products derived
+     from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* A message-dispatch benchmark.
+ *
+ * Drives the unchanged CLK, CANON, SCAN and MAP tasks through a series of
+ * phases and reports the number of messages dispatched per second in each.
+ *
+ *    PINGING     SYNC messages sent to itself, the bare cost of the kernel.
+ *    ALARMING    rounds of 8, 32 and 64 alarms from CLK, set in a shuffled
+ *                order, with the cost of inserting and expiring each.
+ *    IDLING      alarms minutes apart, reporting the cpu wakeups per hour.
+ *    CANONISING  lines fed to CANON, which sends them to CLI (i.e. BENCH).
+ *    SCANNING    a SCAN for each entry of a NR_DIRENTS directory in turn,
+ *                which is I_INDEXED if BENCH_INDEXED is defined.
+ *    MAPPING     a single zone allocated and freed through MAP.
+ *
+ * The process exits after the last phase, whereupon main.c prints the
+ * per-task tally.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sys/defs.h"
+#include "sys/msg.h"
+#include "sys/clk.h"
+#include "cli/cli.h"
+#include "fs/sfa.h"
+#include "fs/sdc.h"
+#include "fs/scan.h"
+#include "fs/map.h"
+#include "shim.h"
+#include "bench.h"
+
+/* I am .. */
+#define SELF BENCH
+#define this bench
+
+#define NR_PINGS    1000000L
+#define NR_ALARMS   64
+#define NR_ROUNDS   1000
+#define NR_LINES    100000L
+#define NR_DIRENTS  256
+#define NR_SCANS    10000L
+#define NR_MAPS     10000L
+
+#define DIR_ZONE    2
+
+#ifndef BENCH_INDEXED
+#define BENCH_INDEXED 0
+#endif
+#define ALARM_STEP  10 /* milliseconds between staggered alarms */
+#define ALARM_SHUFFLE 37 /* coprime to each number of alarms */
+#define ALARM_BURST 4    /* SET_ALARMs sent before yielding to CLK */
+#define NR_IDLES    3
+#define IDLE_STEP   300000L /* milliseconds between the idle alarms */
+
+typedef enum {
+    IDLE = 0,
+    PINGING,
+    ALARMING,
+    IDLING,
+    CANONISING,
+    SCANNING,
+    MAPPING,
+    FREEING
+} __attribute__ ((packed)) state_t;
+
+typedef struct {
+    state_t state;
+    long count;          /* iterations remaining in this phase */
+    uchar_t pending;     /* alarms outstanding in this round */
+    uchar_t size;        /* index into alarm_sizes[] */
+    uchar_t nr_alarms;   /* alarms set in each round */
+    uchar_t next_alarm;  /* the next alarm to be set in this round */
+    uint64_t clk_ns;     /* time spent in CLK at the start of the phase */
+    uint64_t isr_ns;     /* time spent in its ISR at the start of the phase */
+    ulong_t first_wakeup;
+    ulong_t first_tick;
+    const char *lp;      /* next character to feed to CANON */
+    ulong_t first_msg;
+    uint64_t first_ns;
+    inode_t dir;
+    char name[NAME_SIZE];
+    clk_info clk[NR_ALARMS];
+    union {
+        scan_info scan;
+        map_info map;
+    } info;
+} bench_t;
+
+/* I have .. */
+static bench_t this;
+
+static const char line[] = "ls /log/2026\n";
+
+/* the number of alarms outstanding in each ALARMING phase */
+static const uchar_t alarm_sizes[] = {8, 32, NR_ALARMS};
+
+/* I can .. */
+PRIVATE void format_disk(void);
+PRIVATE void begin(state_t state, long count);
+PRIVATE void finish(const char *label);
+PRIVATE void next_phase(void);
+PRIVATE void begin_alarms(uchar_t nr_alarms);
+PRIVATE void finish_alarms(void);
+PRIVATE void set_alarms(void);
+PRIVATE void finish_idle(void);
+PRIVATE uchar_t getch(char *cp);
+
+PUBLIC uchar_t receive_bench(message *m_ptr)
+{
+    switch (m_ptr->opcode) {
+    case INIT:
+        format_disk();
+        begin(PINGING, NR_PINGS);
+        send_SYNC(SELF);
+        break;
+
+    case SYNC:
+        if (this.state == ALARMING) {
+            set_alarms();
+        } else if (--this.count > 0) {
+            send_SYNC(SELF);
+        } else {
+            finish("ping");
+            next_phase();
+        }
+        break;
+
+    case ALARM:
+        if (this.state == IDLING) {
+            if (--this.pending == 0) {
+                finish_idle();
+                next_phase();
+            }
+        } else if (--this.pending == 0) {
+            if (--this.count > 0) {
+                this.pending = this.nr_alarms;
+                this.next_alarm = 0;
+                set_alarms();
+            } else {
+                finish_alarms();
+                if (++this.size < sizeof(alarm_sizes))
+                    begin_alarms(alarm_sizes[this.size]);
+                else
+                    next_phase();
+            }
+        }
+        break;
+
+    case JOB:
+        /* a line from CANON, addressed to CLI */
+        send_REPLY_RESULT(m_ptr->sender, EOK);
+        if (--this.count > 0) {
+            this.lp = line;
+            send_NOT_EMPTY(CANON, getch);
+        } else {
+            finish("canon");
+            next_phase();
+        }
+        break;
+
+    case REPLY_INFO:
+    case REPLY_RESULT:
+        if (m_ptr->RESULT != EOK) {
+            printf("bench: error %u from task %u\n", m_ptr->RESULT,
+                                                     m_ptr->sender);
+            posix_halt(1);
+        }
+        switch (this.state) {
+        case SCANNING:
+            if (this.info.scan.inum == INVALID_INODE_NR) {
+                printf("bench: %s not found\n", this.name);
+                posix_halt(1);
+            }
+            if (--this.count > 0) {
+                snprintf(this.name, NAME_SIZE, "bar%u",
+                                    (unsigned)(this.count % NR_DIRENTS));
+                send_m3(SELF, SCAN, JOB, &this.info.scan);
+            } else {
+                finish("scan");
+                next_phase();
+            }
+            break;
+
+        case MAPPING:
+            this.state = FREEING;
+            sae_FREE_ZMAP(this.info.map, this.info.map.bit_number, 1);
+            break;
+
+        case FREEING:
+            if (--this.count > 0) {
+                this.state = MAPPING;
+                sae_ALLOC_ZMAP(this.info.map, 1);
+            } else {
+                finish("map");
+                next_phase();
+            }
+            break;
+
+        default:
+            break;
+        }
+        break;
+
+    default:
+        return ENOMSG;
+    }
+    return EOK;
+}
+
+/* Populate the directory zone and the zone bitmap. */
+PRIVATE void format_disk(void)
+{
+    for (ushort_t i = 0; i < NR_DIRENTS; i++) {
+        dir_struct *dp = (dir_struct *)ramdisk_sector(ZONE_SECTORS(DIR_ZONE) +
+                                 DIRENT_SECTOR(i)) + (i & DIRENT_PER_BLOCK_MASK);
+        dp->d_inum = i + ROOT_INODE_NR + 1;
+        snprintf(dp->d_name, NAME_SIZE, "bar%u", i);
+#if BENCH_INDEXED
+        ramdisk_sector(ZONE_SECTORS(DIR_ZONE) + DIR_HASH_SECTOR)[i] =
+                                                   name_hash(dp->d_name);
+#endif
+    }
+    this.dir.i_mode = I_DIRECTORY | RWX_MODES;
+#if BENCH_INDEXED
+    this.dir.i_mode |= I_INDEXED;
+#endif
+    this.dir.i_inum = ROOT_INODE_NR;
+    this.dir.i_zone = DIR_ZONE;
+    this.dir.i_size = NR_DIRENTS * DIRENT_SIZE;
+
+    /* the first few zones are in use */
+    memset(ramdisk_sector(ZMAP_SECTOR_NUMBER), 0xFF, 8);
+}
+
+PRIVATE void begin(state_t state, long count)
+{
+    this.state = state;
+    this.count = count;
+    this.first_msg = msg_count();
+    this.first_ns = posix_now_ns();
+    sdc_clear_stats();
+}
+
+PRIVATE void finish(const char *label)
+{
+    ulong_t msgs = msg_count() - this.first_msg;
+    uint64_t ns = posix_now_ns() - this.first_ns;
+
+    printf("%-8s %10lu messages %10.3f ms %12.0f messages/sec\n", label,
+                  msgs, ns / 1e6, ns ? msgs * 1e9 / ns : 0.0);
+
+    ulong_t reads = sdc_hits() + sdc_misses();
+    if (reads)
+        printf("%-8s %10lu reads    %10lu hits %11.1f%% from the cache\n",
+                  "", reads, sdc_hits(), sdc_hits() * 100.0 / reads);
+    this.state = IDLE;
+}
+
+PRIVATE void next_phase(void)
+{
+    static state_t prev = PINGING;
+
+    switch (prev) {
+    case PINGING:
+        prev = ALARMING;
+        begin_alarms(alarm_sizes[0]);
+        break;
+
+    case ALARMING:
+        prev = IDLING;
+        begin(IDLING, 1);
+        this.first_wakeup = msg_wakeups();
+        this.first_tick = posix_ticks();
+        this.pending = NR_IDLES;
+        for (uchar_t i = 0; i < NR_IDLES; i++)
+            sae_CLK_SET_ALARM(this.clk[i], (i + 1) * IDLE_STEP);
+        break;
+
+    case IDLING:
+        prev = CANONISING;
+        begin(CANONISING, NR_LINES);
+        this.lp = line;
+        send_NOT_EMPTY(CANON, getch);
+        break;
+
+    case CANONISING:
+        prev = SCANNING;
+        begin(SCANNING, NR_SCANS);
+        snprintf(this.name, NAME_SIZE, "bar%u",
+                                    (unsigned)(NR_SCANS % NR_DIRENTS));
+        this.info.scan.namep = this.name;
+        this.info.scan.ip = &this.dir;
+        send_m3(SELF, SCAN, JOB, &this.info.scan);
+        break;
+
+    case SCANNING:
+        prev = MAPPING;
+        begin(MAPPING, NR_MAPS);
+        sae_ALLOC_ZMAP(this.info.map, 1);
+        break;
+
+    default:
+        posix_halt(0);
+        break;
+    }
+}
+
+PRIVATE void begin_alarms(uchar_t nr_alarms)
+{
+    this.nr_alarms = nr_alarms;
+    begin(ALARMING, NR_ROUNDS);
+    this.clk_ns = posix_task_ns(CLK);
+    this.isr_ns = posix_isr_ns();
+    this.pending = nr_alarms;
+    this.next_alarm = 0;
+    set_alarms();
+}
+
+/* Report the cost of SET_ALARM in CLK and of the expiries in its ISR. */
+PRIVATE void finish_alarms(void)
+{
+    double n = (double)this.nr_alarms * NR_ROUNDS;
+    char label[8];
+
+    snprintf(label, sizeof(label), "clk%u", this.nr_alarms);
+    finish(label);
+    printf("%-8s %10.1f ns/insert %10.1f ns/expire\n", "",
+              (posix_task_ns(CLK) - this.clk_ns) / n,
+              (posix_isr_ns() - this.isr_ns) / n);
+}
+
+PRIVATE void set_alarms(void)
+{
+    /* a burst at a time, so as not to overrun the fifo */
+    for (uchar_t n = 0; n < ALARM_BURST && this.next_alarm < this.nr_alarms;
+                                                     n++, this.next_alarm++) {
+        uchar_t i = this.next_alarm;
+        sae_CLK_SET_ALARM(this.clk[i],
+                (i * ALARM_SHUFFLE % this.nr_alarms + 1) * ALARM_STEP);
+    }
+    if (this.next_alarm < this.nr_alarms)
+        send_SYNC(SELF);
+}
+
+/* Report how often the cpu woke whilst waiting for the idle alarms. */
+PRIVATE void finish_idle(void)
+{
+    ulong_t wakeups = msg_wakeups() - this.first_wakeup;
+    double hours = (double)(posix_ticks() - this.first_tick) *
+                                    POSIX_PRESCALER / F_CPU / 3600.0;
+
+    finish("idle");
+    printf("%-8s %10lu wakeups %10.3f h %12.0f wakeups/hour\n", "",
+                  wakeups, hours, hours ? wakeups / hours : 0.0);
+}
+
+/* a CharProc that yields one line, as SER would */
+PRIVATE uchar_t getch(char *cp)
+{
+    if (*this.lp == '\0')
+        return EWOULDBLOCK;
+    *cp = *this.lp++;
+    return EOK;
+}
+
+/* end code */
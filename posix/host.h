@@ -0,0 +1,61 @@
+/* posix/host.h */
+
+/* Copyright (c) 2024 Peter Welch
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+   * Neither the name of the copyright holders nor the names of
+     contributors may be used to endorse or promote products derived
+     from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef _HOST_H_
+#define _HOST_H_
+
+/* 'make DEFS=-DCLK_TIMER=TIMER1' to try the 16-bit timer */
+#ifndef CLK_TIMER
+#define CLK_TIMER TIMER0
+#endif
+
+/* the bench keeps 64 alarms pending */
+#define CLK_ALARMS 64
+
+/* msg's options that are off on the avr hosts, so that they still build */
+#define MSG_SPILL_SIZE 2
+#define MSG_OVERFLOW_COUNTS 1
+
+/* BENCH answers to CLI as well, so that CANON has somewhere to send lines. */
+
+typedef enum {
+    ANY = 0,
+    BENCH,
+    CLI,
+    CLK,
+    CANON,
+    SSD,
+    SCAN,
+    MAP,
+    NR_TASKS
+} __attribute__ ((packed)) ProcNumber;
+
+#endif /* _HOST_H_ */
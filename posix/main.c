@@ -0,0 +1,100 @@
+/* posix/main.c */
+
+/* Copyright (c) 2024 Peter Welch
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+   * Neither the name of the copyright holders nor the names of
+     contributors may be used to endorse or promote products derived
+     from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* posix: a host-native image for measuring the kernel and unchanged tasks. */
+
+#define _MAIN_
+
+#include <stdlib.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#include "sys/defs.h"
+#include "sys/msg.h"
+#include "sys/clk.h"
+#include "cli/canon.h"
+#include "fs/ssd.h"
+#include "fs/scan.h"
+#include "fs/map.h"
+#include "shim.h"
+#include "bench.h"
+
+static const char * const names[] = {
+    [BENCH] = "bench",
+    [CLI] = "cli",
+    [CLK] = "clk",
+    [CANON] = "canon",
+    [SSD] = "ssd",
+    [SCAN] = "scan",
+    [MAP] = "map"
+};
+
+PRIVATE void report(void)
+{
+    posix_report(names, NR_TASKS);
+}
+
+PUBLIC int main(void)
+{
+    extern uchar_t lost_msgs;
+    message msg;
+    MsgProc fp;
+
+    static const MsgProc __flash proctab[] = {
+        [BENCH] = receive_bench,
+        [CLI] = receive_bench,
+        [CLK] = receive_clk,
+        [CANON] = receive_canon,
+        [SSD] = receive_ssd,
+        [SCAN] = receive_scan,
+        [MAP] = receive_map
+    };
+
+    config_msg();
+    config_ssd();
+    atexit(report);
+
+    sei(); /* enable interrupts. */
+
+    send_m1(ANY, BENCH, INIT);
+
+    /* Loop until BENCH exits */
+    for (;;) {
+        extract_msg(&msg);
+        if (msg.receiver && msg.receiver < NR_TASKS &&
+                  (fp = (MsgProc) pgm_read_word_near(proctab + msg.receiver)))
+            if (posix_dispatch(fp, &msg) == ENOMSG)
+                lost_msgs++;
+    }
+}
+
+/* end code */
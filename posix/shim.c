@@ -0,0 +1,225 @@
+/* posix/shim.c */
+
+/* Copyright (c) 2024 Peter Welch
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+   * Neither the name of the copyright holders nor the names of
+     contributors may be used to endorse or promote products derived
+     from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Hardware emulation for the host-native build.
+ *
+ * Provides the register file declared in posix/avr/io.h, the sleep_cpu()
+ * replacement that advances simulated time to the next enabled timer
+ * interrupt, and the per-task accounting used by the dispatch loop in
+ * posix/main.c.
+ *
+ * Only the timers are emulated. When the message fifo is empty and no
+ * timer interrupt is enabled nothing can ever happen again, so the
+ * process exits.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#include "sys/defs.h"
+#include "sys/msg.h"
+#include "shim.h"
+
+/* the register file */
+volatile uint8_t SREG;
+volatile uint8_t PRR = 0xFF;        /* everything powered down at reset */
+volatile uint8_t WDTCSR;
+volatile uint8_t TCCR0A, TCCR0B, TCNT0, OCR0A, TIMSK0;
+volatile uint8_t TCCR1A, TCCR1B, TIMSK1;
+volatile uint16_t TCNT1, OCR1A;
+volatile uint8_t TCCR2A, TCCR2B, TCNT2, OCR2A, TIMSK2;
+
+PUBLIC volatile uint8_t *posix_tifr(uint8_t n)
+{
+    static volatile uint8_t tifr[3];
+
+    tifr[n] = 0;
+    return &tifr[n];
+}
+
+typedef struct {
+    ulong_t calls;
+    uint64_t ns;
+} tally_t;
+
+typedef struct {
+    ulong_t ticks;          /* simulated timer ticks since reset */
+    ulong_t wakeups;        /* times sleep_cpu() was woken by an interrupt */
+    uint64_t isr_ns;        /* time spent in the interrupt service routines */
+    tally_t tally[256];     /* indexed by ProcNumber */
+} shim_t;
+
+static shim_t shim;
+
+#define is_running(prtim, tccrb, timsk, ie) \
+    (bit_is_clear(PRR, (prtim)) && ((tccrb) & 0x07) && ((timsk) & _BV(ie)))
+
+PUBLIC void posix_sleep_cpu(void)
+{
+    ulong_t n;
+    ulong_t nearest = 0;
+    Ptf vect = NULL;
+
+    /* find the interrupt that would occur first */
+    if (is_running(PRTIM0, TCCR0B, TIMSK0, TOIE0) && TIMER0_OVF_vect) {
+        nearest = 0x100 - TCNT0;
+        vect = TIMER0_OVF_vect;
+    }
+    if (is_running(PRTIM0, TCCR0B, TIMSK0, OCIE0A) && TIMER0_COMPA_vect) {
+        n = (uint8_t)(OCR0A - TCNT0) + 1;
+        if (vect == NULL || n < nearest) {
+            nearest = n;
+            vect = TIMER0_COMPA_vect;
+        }
+    }
+    if (is_running(PRTIM1, TCCR1B, TIMSK1, TOIE1) && TIMER1_OVF_vect) {
+        n = 0x10000 - TCNT1;
+        if (vect == NULL || n < nearest) {
+            nearest = n;
+            vect = TIMER1_OVF_vect;
+        }
+    }
+    if (is_running(PRTIM1, TCCR1B, TIMSK1, OCIE1A) && TIMER1_COMPA_vect) {
+        n = (uint16_t)(OCR1A - TCNT1) + 1;
+        if (vect == NULL || n < nearest) {
+            nearest = n;
+            vect = TIMER1_COMPA_vect;
+        }
+    }
+    if (is_running(PRTIM2, TCCR2B, TIMSK2, TOIE2) && TIMER2_OVF_vect) {
+        n = 0x100 - TCNT2;
+        if (vect == NULL || n < nearest) {
+            nearest = n;
+            vect = TIMER2_OVF_vect;
+        }
+    }
+    if (is_running(PRTIM2, TCCR2B, TIMSK2, OCIE2A) && TIMER2_COMPA_vect) {
+        n = (uint8_t)(OCR2A - TCNT2) + 1;
+        if (vect == NULL || n < nearest) {
+            nearest = n;
+            vect = TIMER2_COMPA_vect;
+        }
+    }
+
+    if (vect == NULL) {
+        fprintf(stderr, "posix: idle with no interrupt source, exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* advance every running timer by the same amount */
+    shim.ticks += nearest;
+    if (bit_is_clear(PRR, PRTIM0) && (TCCR0B & 0x07))
+        TCNT0 += nearest;
+    if (bit_is_clear(PRR, PRTIM1) && (TCCR1B & 0x07))
+        TCNT1 += nearest;
+    if (bit_is_clear(PRR, PRTIM2) && (TCCR2B & 0x07))
+        TCNT2 += nearest;
+
+    shim.wakeups++;
+    cli();
+    uint64_t start = posix_now_ns();
+    (*vect)();
+    shim.isr_ns += posix_now_ns() - start;
+    sei();
+}
+
+PUBLIC ulong_t posix_ticks(void)
+{
+    return shim.ticks;
+}
+
+PUBLIC ulong_t posix_wakeups(void)
+{
+    return shim.wakeups;
+}
+
+PUBLIC uint64_t posix_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Call the task and charge it with the elapsed time. */
+PUBLIC uchar_t posix_dispatch(MsgProc fp, message *m_ptr)
+{
+    tally_t *tp = &shim.tally[m_ptr->receiver];
+    uint64_t start = posix_now_ns();
+    uchar_t result = (fp) (m_ptr);
+
+    tp->ns += posix_now_ns() - start;
+    tp->calls++;
+    return result;
+}
+
+PUBLIC uint64_t posix_task_ns(ProcNumber n)
+{
+    return shim.tally[n].ns;
+}
+
+PUBLIC uint64_t posix_isr_ns(void)
+{
+    return shim.isr_ns;
+}
+
+/* The end of the run: exit() calls whatever main.c registered. */
+PUBLIC void posix_halt(int status)
+{
+    exit(status);
+}
+
+PUBLIC void posix_report(const char * const *names, uchar_t nr_tasks)
+{
+    printf("%-8s %10s %12s %14s\n", "task", "messages", "ns/message",
+                                                      "messages/sec");
+    for (uchar_t i = 1; i < nr_tasks; i++) {
+        tally_t *tp = &shim.tally[i];
+        if (tp->calls == 0)
+            continue;
+        printf("%-8s %10lu %12.1f %14.0f\n", names[i] ? names[i] : "?",
+                tp->calls, (double)tp->ns / tp->calls,
+                tp->ns ? tp->calls * 1e9 / tp->ns : 0.0);
+    }
+    printf("depth %u (urgent %u, normal %u), lost %lu, wakeups %lu, "
+            "simulated %.3f s\n", msg_depth(), msg_lane_depth(URGENT_LANE),
+            msg_lane_depth(NORMAL_LANE), msg_lost(), shim.wakeups,
+            (double)shim.ticks * POSIX_PRESCALER / F_CPU);
+}
+
+/* end code */
@@ -0,0 +1,53 @@
+/* posix/shim.h */
+
+/* Copyright (c) 2024 Peter Welch
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+   * Neither the name of the copyright holders nor the names of
+     contributors may be used to endorse or promote products derived
+     from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef _SHIM_H_
+#define _SHIM_H_
+
+#include <stdint.h>
+
+/* The emulated timers run at F_CPU / 1024, as configured by clk.c. */
+#define POSIX_PRESCALER 1024
+
+/* 64 zones of 16 sectors, enough for the scan and map benchmarks. */
+#define RAMDISK_SECTORS 1024
+
+PUBLIC ulong_t posix_ticks(void);
+PUBLIC ulong_t posix_wakeups(void);
+PUBLIC uint64_t posix_now_ns(void);
+PUBLIC uchar_t posix_dispatch(MsgProc fp, message *m_ptr);
+PUBLIC uint64_t posix_task_ns(ProcNumber n);
+PUBLIC uint64_t posix_isr_ns(void);
+PUBLIC void posix_report(const char * const *names, uchar_t nr_tasks);
+PUBLIC void posix_halt(int status);
+PUBLIC uchar_t *ramdisk_sector(ulong_t sector);
+
+#endif /* _SHIM_H_ */
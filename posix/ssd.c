@@ -0,0 +1,119 @@
+/* posix/ssd.c */
+
+/* Copyright (c) 2024 Peter Welch
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in
+     the documentation and/or other materials provided with the
+     distribution.
+   * Neither the name of the copyright holders nor the names of
+     contributors may be used to endorse or promote products derived
+     from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* A RAM disk in place of the SDCard SPI driver.
+ *
+ * Accepts the same ssd_info JOB as fs/ssd.c and completes it at once, so
+ * that the fs tasks above it can be measured without the SPI transfer.
+ */
+
+#include <string.h>
+
+#include "sys/defs.h"
+#include "sys/msg.h"
+#include "fs/sdc.h"
+#include "fs/ssd.h"
+#include "shim.h"
+
+/* I am .. */
+#define SELF SSD
+#define this ssd
+
+typedef struct {
+    uchar_t disk[RAMDISK_SECTORS][BLOCK_SIZE];
+} ssd_t;
+
+/* I have .. */
+static ssd_t this;
+
+/* I can .. */
+PUBLIC void config_ssd(void)
+{
+}
+
+PUBLIC uchar_t receive_ssd(message *m_ptr)
+{
+    switch (m_ptr->opcode) {
+    case JOB:
+        {
+            ssd_info *ip = m_ptr->INFO;
+            uchar_t result = EOK;
+            ip->nextp = NULL;
+            ip->replyTo = m_ptr->sender;
+            if (sdc_lookup(ip)) {
+                /* the sector is in the cache */
+            } else {
+                uchar_t *bp = ip->buf;
+                for (uchar_t i = 0; i < ip->count && result == EOK; i++) {
+                    ulong_t sector = ip->phys_sector + i;
+                    if (sector >= RAMDISK_SECTORS) {
+                        result = ENXIO;
+                    } else if (ip->op == READ_SECTOR) {
+                        memcpy(bp, this.disk[sector], BLOCK_SIZE);
+                    } else if (ip->op == WRITE_SECTOR) {
+                        memcpy(this.disk[sector], bp, BLOCK_SIZE);
+                    } else if (ip->op == FILL_SECTOR) {
+                        memcpy(this.disk[sector], ip->buf, BLOCK_SIZE);
+                    } else {
+                        result = EINVAL;
+                    }
+                    bp += BLOCK_SIZE;
+                }
+                sdc_update(ip, result);
+            }
+            send_REPLY_INFO(ip->replyTo, result, ip);
+        }
+        break;
+
+    default:
+        return ENOMSG;
+    }
+    return EOK;
+}
+
+PUBLIC uchar_t *ramdisk_sector(ulong_t sector)
+{
+    return this.disk[sd_meta.firstSector + sector];
+}
+
+/* convenience function */
+
+PUBLIC void send_SSD_JOB(ProcNumber sender, ssd_info *cp, uchar_t op,
+                               ushort_t sector, uchar_t count, void *bp)
+{
+    cp->op = op;
+    cp->phys_sector = sd_meta.firstSector + sector;
+    cp->count = count;
+    cp->buf = bp;
+    send_m3(sender, SELF, JOB, cp);
+}
+
+/* end code */
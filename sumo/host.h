@@ -33,7 +33,7 @@
 #define _HOST_H_
 
 #define HOST_ADDRESS SUMO_I2C_ADDRESS
-#define CLK_TIMER TIMER0
+#define CLK_TIMER TIMER1    /* 593 wakeups an hour, not 150000 */
 
 typedef enum {
     ANY = 0,
@@ -48,6 +48,10 @@
  *
  * - write one (or more) eeprom bytes
  *   SLA+W, 0x02, 0x02, addrh, addrl, {* bytes}, STO
+ *
+ * - read the CRC-16/XMODEM of one (or more) flash pages, high byte first,
+ *   from PAGE_CRC_VERSION
+ *   SLA+W, 0x02, 0x03, addrh, addrl, SLA+R, {2 bytes per page}, STO
  */
 
 
@@ -61,6 +65,7 @@
 #define CMD_ACCESS_EEPROM       (0x30 | CMD_ACCESS_MEMORY)
 #define CMD_WRITE_FLASH_PAGE    (0x40 | CMD_ACCESS_MEMORY)
 #define CMD_WRITE_EEPROM_PAGE   (0x50 | CMD_ACCESS_MEMORY)
+#define CMD_ACCESS_PAGE_CRC     (0x60 | CMD_ACCESS_MEMORY)
 
 /* SLA+W */
 #define CMD_SWITCH_APPLICATION  CMD_READ_VERSION
@@ -76,6 +81,12 @@
 #define MEMTYPE_CHIPINFO        0x00
 #define MEMTYPE_FLASH           0x01
 #define MEMTYPE_EEPROM          0x02
+#define MEMTYPE_PAGE_CRC        0x03  /* not yet in twiboot.c */
+
+/* The first version to answer MEMTYPE_PAGE_CRC. It is not released
+ * until twiboot.c has been measured to fit with it.
+ */
+#define PAGE_CRC_VERSION        "TWIBOOT v3.2d"
 
 #define VERSION_LEN             16
 #define CHIPINFO_LEN            8